@@ -0,0 +1,172 @@
+#ifdef _MSC_VER
+#pragma warning(disable:4996)
+#endif
+
+#include <mail/smtp/server_session.hpp>
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+#include <iostream>
+#include <memory>
+
+using namespace boost::asio;
+
+// collects the message content in memory
+class sink_reader {
+public:
+	void init(const boost::optional<std::uint64_t>&, boost::beast::error_code& ec)
+	{
+		body_.clear();
+		ec.assign(0, ec.category());
+	}
+	template <class ConstBufferSequence>
+	std::size_t put(const ConstBufferSequence& buffers, boost::beast::error_code& ec)
+	{
+		const auto n = buffer_size(buffers);
+		const auto size = body_.size();
+		body_.resize(size + n);
+		buffer_copy(buffer(&body_[size], n), buffers);
+		ec.assign(0, ec.category());
+		return n;
+	}
+	void finish(boost::beast::error_code& ec)
+	{
+		ec.assign(0, ec.category());
+	}
+
+	const std::string& body() const
+	{
+		return body_;
+	}
+private:
+	std::string body_;
+};
+
+class connection : public std::enable_shared_from_this<connection> {
+public:
+	explicit connection(ip::tcp::socket socket)
+		: session_{ std::move(socket) }
+	{
+		session_.domain("localhost");
+		session_.capabilities().set(mail::smtp::extension::pipelining);
+		session_.capabilities().set(mail::smtp::extension::chunking);
+		session_.capabilities().set(mail::smtp::extension::eightbitmime);
+		session_.capabilities().max_size(10 * 1024 * 1024);
+	}
+
+	void start()
+	{
+		session_.async_open([self = shared_from_this()](auto ec) {
+			if (ec) {
+				std::cout << "Open error: " << ec.message() << "\n";
+				return;
+			}
+			self->read();
+		});
+	}
+private:
+	void read()
+	{
+		session_.async_read_command([self = shared_from_this()](auto ec) {
+			self->on_command(ec);
+		});
+	}
+	void reply(mail::smtp::reply_code code, const char* text)
+	{
+		session_.async_reply(code, text, [self = shared_from_this()](auto ec) {
+			if (ec) {
+				std::cout << "Reply error: " << ec.message() << "\n";
+				return;
+			}
+			self->read();
+		});
+	}
+	void on_command(boost::beast::error_code ec)
+	{
+		using mail::smtp::reply_code;
+		using mail::smtp::verb;
+
+		if (ec == mail::smtp::error::syntax_error) {
+			return reply(reply_code::parameter_syntax_error, "Syntax error");
+		}
+		if (ec) {
+			std::cout << "Read error: " << ec.message() << "\n";
+			return;
+		}
+		const auto& cmd = session_.get_command();
+		switch (cmd.verb()) {
+			case verb::ehlo:
+				session_.async_reply_ehlo([self = shared_from_this()](auto ec) {
+					if (!ec) {
+						self->read();
+					}
+				});
+				return;
+			case verb::helo:
+			case verb::noop:
+			case verb::rset:
+			case verb::mail:
+			case verb::rcpt:
+				return reply(reply_code::completed, "OK");
+			case verb::data:
+				session_.async_read_data(reader_, [self = shared_from_this()](auto ec) {
+					self->on_message(ec);
+				});
+				return;
+			case verb::bdat: {
+				const auto last = cmd.last_chunk();
+				session_.async_read_bdat(reader_, [self = shared_from_this(), last](auto ec) {
+					if (ec || last) {
+						return self->on_message(ec);
+					}
+					self->reply(reply_code::completed, "OK");
+				});
+				return;
+			}
+			case verb::quit:
+				session_.async_reply(reply_code::service_closing, "Bye", [self = shared_from_this()](auto) {
+					boost::beast::error_code ec;
+					self->session_.next_layer().shutdown(ip::tcp::socket::shutdown_both, ec);
+				});
+				return;
+			default:
+				return reply(reply_code::command_unrecognized, "Command unrecognized");
+		}
+	}
+	void on_message(boost::beast::error_code ec)
+	{
+		using mail::smtp::reply_code;
+
+		if (ec == mail::smtp::error::size_exceeded) {
+			return reply(reply_code::exceeded_storage_allocation, "Message too big");
+		}
+		if (ec) {
+			std::cout << "Data error: " << ec.message() << "\n";
+			return;
+		}
+		std::cout << reader_.body() << "\n";
+		reply(reply_code::completed, "OK");
+	}
+
+	mail::smtp::server_session<ip::tcp::socket> session_;
+	sink_reader reader_;
+};
+
+void accept(ip::tcp::acceptor& acceptor)
+{
+	acceptor.async_accept([&acceptor](auto ec, ip::tcp::socket socket) {
+		if (!ec) {
+			std::make_shared<connection>(std::move(socket))->start();
+		}
+		accept(acceptor);
+	});
+}
+
+int main()
+{
+	io_context ioc;
+
+	ip::tcp::acceptor acceptor{ ioc, { ip::tcp::v4(), 2525 } };
+	accept(acceptor);
+
+	ioc.run();
+}
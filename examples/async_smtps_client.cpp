@@ -5,6 +5,7 @@
 #include "test_data.h"
 
 #include <mail/smtp/session.hpp>
+#include <mail/smtp/tls_session_cache.hpp>
 #include <boost/beast.hpp>
 #include <boost/asio.hpp>
 
@@ -14,8 +15,10 @@ using namespace boost::asio;
 
 class client {
 public:
-	client(io_context& ioc, ssl::context& ctx, mail::mime::entity<mail::mime::string_body> m)
+	client(io_context& ioc, ssl::context& ctx, mail::smtp::tls_session_cache& tls_cache,
+		   mail::mime::entity<mail::mime::string_body> m)
 		: session_{ ioc, ctx }
+		, tls_cache_{ tls_cache }
 		, mail_{ std::move(m) }
 	{
 	}
@@ -34,6 +37,8 @@ public:
 private:
 	void ssl_handshake()
 	{
+		// resumes the last session with the server, if any
+		tls_cache_.prepare(session_.next_layer(), smtp_server);
 		session_.next_layer().async_handshake(ssl::stream_base::client, [this](auto ec) {
 			if (ec) {
 				std::cout << "Handshake error: " << ec.message() << "\n";
@@ -87,6 +92,7 @@ private:
 	}
 
 	mail::smtp::session<ssl::stream<ip::tcp::socket>> session_;
+	mail::smtp::tls_session_cache& tls_cache_;
 	mail::mime::entity<mail::mime::string_body> mail_;
 };
 
@@ -98,8 +104,9 @@ int main()
 	auto eps = resolver.resolve(smtp_server, "465");
 
 	ssl::context ctx{ ssl::context_base::tls };
+	mail::smtp::tls_session_cache tls_cache{ ctx };
 
-	client c{ ioc, ctx, make_test_mail() };
+	client c{ ioc, ctx, tls_cache, make_test_mail() };
 	c.start(eps);
 
 	ioc.run();
@@ -0,0 +1,70 @@
+// Measures how delivery_engine scales with shards: each job encodes a
+// message body in base64 on its shard, as a send would, and completes on
+// the next turn of the shard's io_context. The same load runs with 1, 2, 4,
+// ... shards up to the hardware threads, once spread over many
+// destinations and once to a single destination, where only stealing lets
+// more than one shard work. Prints the jobs per second and the speedup over
+// one shard.
+//
+//	engine_benchmark [jobs] [body size]
+
+#include <mail/smtp/delivery_engine.hpp>
+#include <mail/mime/transfer_encoding.hpp>
+#include <boost/asio/post.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+double run(std::size_t shards, int jobs, bool single, const std::string& body)
+{
+	std::atomic<int> left{ jobs };
+	std::atomic<std::size_t> bytes{ 0 };
+	mail::smtp::engine_options options;
+	options.shards = shards;
+	mail::smtp::delivery_engine<int> engine{ [&](auto& shard, const std::string&, int) {
+		bytes += mail::mime::encode(mail::mime::transfer_encoding::base64, body).size();
+		boost::asio::post(shard.context(), [&shard, &left] {
+			--left;
+			shard.done();
+		});
+	}, options };
+	engine.start();
+
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < jobs; ++i) {
+		engine.submit(single ? "example.com" : "example" + std::to_string(i % 1000) + ".com", i);
+	}
+	while (left != 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	const auto s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	engine.stop();
+	return jobs / s;
+}
+
+int main(int argc, char* argv[])
+{
+	const int jobs = argc > 1 ? std::atoi(argv[1]) : 20000;
+	const std::size_t size = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 65536;
+
+	std::string body;
+	while (body.size() < size) {
+		body += "The quick brown fox jumps over the lazy dog.\r\n";
+	}
+
+	const auto cores = static_cast<std::size_t>((std::max)(1u, std::thread::hardware_concurrency()));
+	for (const auto single : { false, true }) {
+		std::cout << (single ? "one destination:\n" : "1000 destinations:\n");
+		double base = 0;
+		for (std::size_t n = 1; n <= cores; n = n * 2 > cores && n != cores ? cores : n * 2) {
+			const auto rate = run(n, jobs, single, body);
+			if (n == 1) {
+				base = rate;
+			}
+			std::cout << "  " << n << " shards: " << rate << " jobs/s, x" << rate / base << "\n";
+		}
+	}
+}
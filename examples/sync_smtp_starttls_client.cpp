@@ -5,6 +5,7 @@
 #include "test_data.h"
 
 #include <mail/smtp/session.hpp>
+#include <mail/smtp/tls_session_cache.hpp>
 #include <boost/beast.hpp>
 #include <boost/asio.hpp>
 
@@ -20,7 +21,9 @@ int main()
 	auto eps = resolver.resolve(smtp_server, "smtp");
 
 	ssl::context ctx{ ssl::context_base::tls };
+	mail::smtp::tls_session_cache tls_cache{ ctx };
 	mail::smtp::session<ssl::stream<ip::tcp::socket>> session{ ioc, ctx };
+	tls_cache.prepare(session.next_layer(), smtp_server);
 
 	connect(session.next_layer().next_layer(), eps);
 
@@ -0,0 +1,257 @@
+// Sends the same load through session<ip::tcp::socket> and
+// session<uring_stream>: many concurrent sessions on one thread, each
+// delivering a few messages to an in-process server. Prints the time taken,
+// the context switches of the client thread and, for io_uring, how many
+// io_uring_enter calls carried the load. For the total of system calls,
+// run it under strace -c -f.
+//
+//	uring_benchmark [sessions] [messages per session] [message size]
+
+#include <mail/smtp/session.hpp>
+#include <mail/smtp/server_session.hpp>
+#include <mail/smtp/uring_stream.hpp>
+#include <mail/mime/string_body.hpp>
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <sys/resource.h>
+
+using namespace boost::asio;
+
+// discards the message content
+class null_reader {
+public:
+	void init(const boost::optional<std::uint64_t>&, boost::beast::error_code& ec)
+	{
+		ec.assign(0, ec.category());
+	}
+	template <class ConstBufferSequence>
+	std::size_t put(const ConstBufferSequence& buffers, boost::beast::error_code& ec)
+	{
+		ec.assign(0, ec.category());
+		return buffer_size(buffers);
+	}
+	void finish(boost::beast::error_code& ec)
+	{
+		ec.assign(0, ec.category());
+	}
+};
+
+class connection : public std::enable_shared_from_this<connection> {
+public:
+	explicit connection(ip::tcp::socket socket)
+		: session_{ std::move(socket) }
+	{
+		session_.domain("localhost");
+	}
+
+	void start()
+	{
+		session_.async_open([self = shared_from_this()](auto ec) {
+			if (!ec) {
+				self->read();
+			}
+		});
+	}
+private:
+	void read()
+	{
+		session_.async_read_command([self = shared_from_this()](auto ec) {
+			if (!ec) {
+				self->on_command();
+			}
+		});
+	}
+	void reply(mail::smtp::reply_code code, const char* text)
+	{
+		session_.async_reply(code, text, [self = shared_from_this()](auto ec) {
+			if (!ec) {
+				self->read();
+			}
+		});
+	}
+	void on_command()
+	{
+		using mail::smtp::reply_code;
+		using mail::smtp::verb;
+
+		switch (session_.get_command().verb()) {
+			case verb::ehlo:
+				session_.async_reply_ehlo([self = shared_from_this()](auto ec) {
+					if (!ec) {
+						self->read();
+					}
+				});
+				return;
+			case verb::data:
+				session_.async_read_data(reader_, [self = shared_from_this()](auto ec) {
+					if (!ec) {
+						self->reply(reply_code::completed, "OK");
+					}
+				});
+				return;
+			case verb::quit:
+				session_.async_reply(reply_code::service_closing, "Bye", [self = shared_from_this()](auto) {
+					boost::beast::error_code ec;
+					self->session_.next_layer().shutdown(ip::tcp::socket::shutdown_both, ec);
+				});
+				return;
+			default:
+				return reply(reply_code::completed, "OK");
+		}
+	}
+
+	mail::smtp::server_session<ip::tcp::socket> session_;
+	null_reader reader_;
+};
+
+void accept(ip::tcp::acceptor& acceptor)
+{
+	acceptor.async_accept([&acceptor](auto ec, ip::tcp::socket socket) {
+		if (!ec) {
+			std::make_shared<connection>(std::move(socket))->start();
+		}
+		accept(acceptor);
+	});
+}
+
+template <class Stream>
+class client {
+public:
+	template <class Arg>
+	client(Arg& arg, const mail::mime::entity<mail::mime::string_body>& m, int messages, int& done)
+		: session_{ arg }
+		, mail_(m)
+		, left_(messages)
+		, done_(done)
+	{
+	}
+
+	void start(const ip::tcp::endpoint& ep)
+	{
+		session_.next_layer().lowest_layer().async_connect(ep, [this](auto ec) {
+			if (ec) {
+				return fail("Connect", ec);
+			}
+			session_.async_open([this](auto ec) {
+				if (ec) {
+					return fail("Open", ec);
+				}
+				send();
+			});
+		});
+	}
+private:
+	void send()
+	{
+		if (left_-- == 0) {
+			return close();
+		}
+		session_.async_send_mail("sender@example.com", "recipient@example.com", mail_, [this](auto ec) {
+			if (ec) {
+				return fail("Send", ec);
+			}
+			send();
+		});
+	}
+	void close()
+	{
+		session_.async_close([this](auto ec) {
+			if (ec) {
+				return fail("Close", ec);
+			}
+			++done_;
+		});
+	}
+	void fail(const char* what, boost::beast::error_code ec)
+	{
+		std::cout << what << " error: " << ec.message() << "\n";
+	}
+
+	mail::smtp::session<Stream> session_;
+	const mail::mime::entity<mail::mime::string_body>& mail_;
+	int left_;
+	int& done_;
+};
+
+struct usage {
+	std::chrono::steady_clock::time_point time;
+	long voluntary;
+	long involuntary;
+
+	static usage now()
+	{
+		rusage ru{};
+		getrusage(RUSAGE_THREAD, &ru);
+		return { std::chrono::steady_clock::now(), ru.ru_nvcsw, ru.ru_nivcsw };
+	}
+};
+
+template <class Stream, class Arg>
+void run(const char* name, io_context& ioc, Arg& arg, const ip::tcp::endpoint& ep,
+		 int sessions, int messages, const mail::mime::entity<mail::mime::string_body>& m)
+{
+	int done = 0;
+	std::vector<std::unique_ptr<client<Stream>>> clients;
+	clients.reserve(sessions);
+	for (int i = 0; i < sessions; ++i) {
+		clients.push_back(std::make_unique<client<Stream>>(arg, m, messages, done));
+	}
+	const auto before = usage::now();
+	for (auto& c : clients) {
+		c->start(ep);
+	}
+	ioc.restart();
+	ioc.run();
+	const auto after = usage::now();
+
+	const auto ms = std::chrono::duration<double, std::milli>(after.time - before.time).count();
+	std::cout << name << ": " << done << "/" << sessions << " sessions, "
+		<< ms << " ms, " << sessions * messages / ms * 1000 << " messages/s, "
+		<< after.voluntary - before.voluntary << " voluntary and "
+		<< after.involuntary - before.involuntary << " involuntary context switches\n";
+}
+
+int main(int argc, char* argv[])
+{
+	const int sessions = argc > 1 ? std::atoi(argv[1]) : 1000;
+	const int messages = argc > 2 ? std::atoi(argv[2]) : 10;
+	const std::size_t size = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 4096;
+
+	// two descriptors per session
+	rlimit rl{};
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	mail::mime::entity<mail::mime::string_body> m;
+	m.set(mail::mime::field::subject, "benchmark");
+	while (m.body().size() < size) {
+		m.body() += "The quick brown fox jumps over the lazy dog.\r\n";
+	}
+
+	io_context server_ioc{ 1 };
+	ip::tcp::acceptor acceptor{ server_ioc, { ip::make_address("127.0.0.1"), 0 } };
+	acceptor.listen(socket_base::max_listen_connections);
+	accept(acceptor);
+	std::thread server{ [&server_ioc] { server_ioc.run(); } };
+	const auto ep = acceptor.local_endpoint();
+
+	io_context ioc{ 1 };
+	run<ip::tcp::socket>("ip::tcp::socket", ioc, ioc, ep, sessions, messages, m);
+
+	mail::smtp::uring_context ring{ ioc };
+	run<mail::smtp::uring_stream>("uring_stream", ioc, ring, ep, sessions, messages, m);
+	const auto& st = ring.stats();
+	std::cout << "  io_uring_enter: " << st.enters << ", wakeups: " << st.wakeups
+		<< ", operations: " << st.submitted << ", completions: " << st.completed
+		<< ", multishot receive: " << (ring.multishot() ? "yes" : "no") << "\n";
+
+	server_ioc.stop();
+	server.join();
+}
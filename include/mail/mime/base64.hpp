@@ -0,0 +1,36 @@
+#pragma once
+
+#include <boost/beast/core/detail/base64.hpp>
+#include <algorithm>
+#include <cstddef>
+
+namespace mail::mime::base64 {
+	// characters per line, the most RFC 2045 allows
+	static std::size_t constexpr line_length = 76;
+	// the bytes encoded in a line
+	static std::size_t constexpr line_input = line_length / 4 * 3;
+
+	// The size of n bytes encoded, every line ending with CRLF.
+	constexpr std::size_t encoded_size(std::size_t n)
+	{
+		const auto chars = (n + 2) / 3 * 4;
+		return chars + (chars + line_length - 1) / line_length * 2;
+	}
+
+	// Encodes the n bytes at data into encoded_size(n) bytes at out.
+	// Returns the bytes written.
+	inline std::size_t encode(char* out, const void* data, std::size_t n)
+	{
+		auto p = out;
+		auto in = static_cast<const char*>(data);
+		while (n > 0) {
+			const auto k = (std::min)(n, line_input);
+			p += boost::beast::detail::base64::encode(p, in, k);
+			*p++ = '\r';
+			*p++ = '\n';
+			in += k;
+			n -= k;
+		}
+		return p - out;
+	}
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include "entity.hpp"
+#include <boost/beast/core/bind_handler.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/asio/executor.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/assert.hpp>
+#include <boost/optional.hpp>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace mail::mime {
+	namespace detail {
+		// A completion handler kept until it is posted, which keeps its
+		// executor busy meanwhile.
+		class waiter
+		{
+		public:
+			explicit operator bool() const
+			{
+				return p_ != nullptr;
+			}
+			template <class Handler, class Executor>
+			void set(Handler&& handler, const Executor& ex)
+			{
+				BOOST_ASSERT(!p_);
+				p_ = std::make_unique<impl<std::decay_t<Handler>, Executor>>(std::forward<Handler>(handler), ex);
+			}
+			void post(boost::beast::error_code ec)
+			{
+				auto p = std::move(p_);
+				p->post(ec);
+			}
+		private:
+			struct base
+			{
+				virtual ~base() = default;
+				virtual void post(boost::beast::error_code ec) = 0;
+			};
+			template <class Handler, class Executor>
+			struct impl : base
+			{
+				template <class DeducedHandler>
+				impl(DeducedHandler&& h, const Executor& ex)
+					: handler(std::forward<DeducedHandler>(h))
+					, work(boost::asio::get_associated_executor(handler, ex))
+				{
+				}
+				void post(boost::beast::error_code ec) override
+				{
+					auto ex = work.get_executor();
+					work.reset();
+					boost::asio::post(ex, boost::beast::bind_handler(std::move(handler), ec));
+				}
+
+				Handler handler;
+				boost::asio::executor_work_guard<boost::asio::associated_executor_t<Handler, Executor>> work;
+			};
+
+			std::unique_ptr<base> p_;
+		};
+	}
+
+	// A body produced while it is sent, from a database cursor or a
+	// renderer say: the producer pushes chunks of content with CRLF line
+	// endings, and calls finish at the end, or fail to abort the message.
+	// At most limit chunks are queued; async_push waits for room, so a
+	// slow connection slows the producer down. Send it through a
+	// serializer with session::async_send_mail, which waits for chunks.
+	//
+	// Not thread safe: use it from the executor of the session.
+	struct channel_body
+	{
+		class value_type
+		{
+		public:
+			using executor_type = boost::asio::executor;
+
+			// Usable once assigned one constructed with an executor.
+			value_type() = default;
+			explicit value_type(const executor_type& ex, std::size_t limit = 4)
+				: ex_(ex)
+				, limit_(limit)
+			{
+			}
+			value_type(value_type&&) = default;
+			value_type& operator=(value_type&&) = default;
+
+			executor_type get_executor() const
+			{
+				return ex_;
+			}
+
+			// Queues chunk, completing with void(error_code) when the
+			// queue had room for it.
+			template <class PushHandler>
+			void async_push(std::string chunk, PushHandler&& handler)
+			{
+				if (ec_) {
+					return post(std::forward<PushHandler>(handler), ec_);
+				}
+				if (chunk.empty()) {
+					return post(std::forward<PushHandler>(handler), {});
+				}
+				chunks_.push_back(std::move(chunk));
+				wake_reader();
+				if (chunks_.size() <= limit_) {
+					return post(std::forward<PushHandler>(handler), {});
+				}
+				producer_.set(std::forward<PushHandler>(handler), ex_);
+			}
+			void finish()
+			{
+				finished_ = true;
+				wake_reader();
+			}
+			// Ends the body with ec, which the send fails with.
+			void fail(boost::beast::error_code ec)
+			{
+				ec_ = ec;
+				wake_reader();
+				if (producer_) {
+					producer_.post(ec);
+				}
+			}
+		private:
+			friend struct channel_body;
+
+			template <class Handler>
+			void post(Handler&& handler, boost::beast::error_code ec)
+			{
+				boost::asio::post(boost::asio::get_associated_executor(handler, ex_),
+								  boost::beast::bind_handler(std::forward<Handler>(handler), ec));
+			}
+			void wake_reader()
+			{
+				if (consumer_) {
+					consumer_.post({});
+				}
+			}
+			// the front chunk was sent
+			void pop()
+			{
+				chunks_.pop_front();
+				if (producer_ && chunks_.size() <= limit_) {
+					producer_.post({});
+				}
+			}
+
+			executor_type ex_;
+			std::size_t limit_ = 4;
+			std::deque<std::string> chunks_;
+			bool finished_ = false;
+			boost::beast::error_code ec_;
+			detail::waiter producer_;
+			detail::waiter consumer_;
+		};
+
+		class writer
+		{
+		public:
+			using const_buffers_type = boost::asio::const_buffer;
+
+			template <class Fields>
+			explicit writer(entity<channel_body, Fields>& e)
+				: v_(e.body())
+			{
+			}
+			template <class Fields>
+			writer(header<Fields>&, value_type& v)
+				: v_(v)
+			{
+			}
+
+			void init(boost::beast::error_code& ec)
+			{
+				ec.assign(0, ec.category());
+			}
+			// http::error::need_more while the next chunk is not there;
+			// async_wait tells when to ask again.
+			boost::optional<std::pair<const_buffers_type, bool>> get(boost::beast::error_code& ec)
+			{
+				if (returned_) {
+					returned_ = false;
+					v_.pop();
+				}
+				if (v_.ec_) {
+					ec = v_.ec_;
+					return boost::none;
+				}
+				if (v_.chunks_.empty()) {
+					if (v_.finished_) {
+						ec.assign(0, ec.category());
+					}
+					else {
+						ec = boost::beast::http::error::need_more;
+					}
+					return boost::none;
+				}
+				ec.assign(0, ec.category());
+				returned_ = true;
+				const auto& c = v_.chunks_.front();
+				return { { boost::asio::const_buffer{ c.data(), c.size() }, true } };
+			}
+			template <class WaitHandler>
+			void async_wait(WaitHandler&& handler)
+			{
+				if (!v_.chunks_.empty() || v_.finished_ || v_.ec_) {
+					return v_.post(std::forward<WaitHandler>(handler), {});
+				}
+				v_.consumer_.set(std::forward<WaitHandler>(handler), v_.ex_);
+			}
+		private:
+			value_type& v_;
+			bool returned_ = false;
+		};
+	};
+}
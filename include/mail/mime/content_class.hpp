@@ -0,0 +1,92 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace mail::mime {
+	// The data classes of RFC 2045 2.7-2.9, which tell what a transport
+	// must carry as it is: lines of at most 998 octets ending with CRLF,
+	// without NUL, in 7bit or 8bit data; anything else is binary.
+	enum class content_class : std::uint8_t
+	{
+		seven_bit							=	0,
+		eight_bit							=	1,
+		binary								=	2,
+	};
+
+	// Finds the class of content given in pieces. Content which does not
+	// end with CRLF is not binary for it: the end of data adds one.
+	class content_classifier
+	{
+	public:
+		static std::size_t constexpr max_line = 998;
+
+		template <class ConstBufferSequence>
+		void scan(const ConstBufferSequence& buffers)
+		{
+			for (auto it = boost::asio::buffer_sequence_begin(buffers);
+				 it != boost::asio::buffer_sequence_end(buffers); ++it) {
+				const boost::asio::const_buffer b = *it;
+				scan(static_cast<const unsigned char*>(b.data()), b.size());
+			}
+		}
+
+		content_class result() const
+		{
+			// a CR not followed by LF
+			return cr_ ? content_class::binary : class_;
+		}
+	private:
+		void scan(const unsigned char* p, std::size_t n)
+		{
+			const auto last = p + n;
+			while (p != last && class_ != content_class::binary) {
+				const auto nl = static_cast<const unsigned char*>(std::memchr(p, '\n', static_cast<std::size_t>(last - p)));
+				const auto end = nl ? nl : last;
+				auto k = static_cast<std::size_t>(end - p);
+				// a CR is allowed last, before the LF
+				const auto trailing_cr = k != 0 && end[-1] == '\r';
+				if (cr_ && k != 0) {
+					class_ = content_class::binary;
+					return;
+				}
+				unsigned high = 0;
+				bool ctl = false;
+				for (std::size_t i = 0; i != k - trailing_cr; ++i) {
+					high |= p[i];
+					ctl |= p[i] == 0 || p[i] == '\r';
+				}
+				if (ctl) {
+					class_ = content_class::binary;
+					return;
+				}
+				if (high & 0x80) {
+					class_ = content_class::eight_bit;
+				}
+				if (!nl) {
+					line_ += k;
+					cr_ = trailing_cr;
+					if (line_ - cr_ > max_line) {
+						class_ = content_class::binary;
+					}
+					return;
+				}
+				if (!(trailing_cr || (k == 0 && cr_)) || line_ + k - 1 > max_line) {
+					// a bare LF, or a line too long
+					class_ = content_class::binary;
+					return;
+				}
+				line_ = 0;
+				cr_ = false;
+				p = nl + 1;
+			}
+		}
+
+		content_class class_ = content_class::seven_bit;
+		// the octets of the current line so far, its CR included
+		std::size_t line_ = 0;
+		bool cr_ = false;
+	};
+}
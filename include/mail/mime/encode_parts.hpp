@@ -0,0 +1,70 @@
+#pragma once
+
+#include "multipart_body.hpp"
+#include "transfer_encoding.hpp"
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/core/string.hpp>
+#include <boost/asio/async_result.hpp>
+#include <cstddef>
+#include <string>
+
+namespace mail::mime {
+	// What async_encode_parts needs of a cache of encoded content, called
+	// through a virtual function so that encoding does not depend on the
+	// hashing of part_cache (OpenSSL) unless a cache is used.
+	class part_cache_base
+	{
+	public:
+		// Returns content encoded with e, encoding it unless it is cached.
+		virtual shared_buffer get(boost::beast::string_view content, transfer_encoding e) = 0;
+	protected:
+		~part_cache_base() = default;
+	};
+
+	// Content to attach. It is the caller's until the encoding completes.
+	struct attachment
+	{
+		std::string content_type = "application/octet-stream";
+		// the name given in Content-Disposition: attachment; shown inline
+		// when empty
+		std::string filename;
+		boost::beast::string_view content;
+		transfer_encoding encoding = transfer_encoding::base64;
+	};
+
+	struct encode_options
+	{
+		// the bytes of base64 content encoded by one job, a multiple of
+		// base64::line_input
+		std::size_t piece = 57 * 1024;
+		// where encoded content is looked up and kept, one job encoding or
+		// finding an attachment; nothing is cached when null
+		part_cache_base* cache = nullptr;
+	};
+
+	// Encodes the attachments of [first, last) into parts appended to the
+	// body of e, setting its MIME-Version and Content-Type, multipart/mixed
+	// with a new boundary, unless the body has a boundary already. The
+	// content is encoded by jobs run on ex, a thread pool say, at the same
+	// time, base64 content being cut into pieces, leaving the threads of the
+	// sessions to I/O. e must be left alone until the handler is called,
+	// through its associated executor (ex when it has none): bind it to
+	// the executor of the session which sends e, for instance.
+	template <class Executor, class Iterator, class Fields, class EncodeHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		EncodeHandler, void(boost::beast::error_code)
+	) async_encode_parts(const Executor& ex,
+						 Iterator first, Iterator last,
+						 entity<multipart_body, Fields>& e,
+						 EncodeHandler&& handler);
+	template <class Executor, class Iterator, class Fields, class EncodeHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		EncodeHandler, void(boost::beast::error_code)
+	) async_encode_parts(const Executor& ex,
+						 Iterator first, Iterator last,
+						 entity<multipart_body, Fields>& e,
+						 const encode_options& options,
+						 EncodeHandler&& handler);
+}
+
+#include "impl/encode_parts.inl"
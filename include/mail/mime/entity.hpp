@@ -2,10 +2,14 @@
 
 #include "fields.hpp"
 #include <boost/core/empty_value.hpp>
+#include <memory>
+#include <type_traits>
 
 namespace mail::mime {
 	template <typename Fields = fields>
-	struct header : Fields {};
+	struct header : Fields {
+		using Fields::Fields;
+	};
 
 	template <typename Body, typename Fields = fields>
 	class entity
@@ -26,6 +30,18 @@ namespace mail::mime {
 		template<class... BodyArgs>
 		explicit entity(header_type const& h, BodyArgs&&... body_args);
 
+		// Constructs the fields, and the body when it is allocator-aware,
+		// with alloc: a pmr::entity<pmr::string_body> built with a memory
+		// resource keeps all of its content there.
+		template<class Allocator, class F = Fields, class = std::enable_if_t<
+			std::is_convertible_v<const Allocator&, typename F::allocator_type>>>
+		explicit entity(const Allocator& alloc)
+			: header_type(typename F::allocator_type(alloc))
+			, boost::empty_value<typename Body::value_type>(boost::empty_init_t{},
+				make_body(typename F::allocator_type(alloc)))
+		{
+		}
+
 		const header_type& base() const
 		{
 			return *this;
@@ -50,5 +66,21 @@ namespace mail::mime {
 		{
 			return boost::empty_value<typename Body::value_type>::get();
 		}
+	private:
+		template<class Allocator>
+		static typename body_type::value_type make_body(const Allocator& alloc)
+		{
+			if constexpr (std::uses_allocator_v<typename body_type::value_type, Allocator>) {
+				return typename body_type::value_type(alloc);
+			}
+			else {
+				return typename body_type::value_type();
+			}
+		}
 	};
+
+	namespace pmr {
+		template <typename Body>
+		using entity = mime::entity<Body, pmr::fields>;
+	}
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <boost/beast/http/fields.hpp>
+#include <memory_resource>
 
 namespace mail::mime {
 	using boost::beast::http::field;
@@ -9,4 +10,8 @@ namespace mail::mime {
 	using basic_fields = boost::beast::http::basic_fields<Allocator>;
 
 	using fields = basic_fields<std::allocator<char>>;
+
+	namespace pmr {
+		using fields = basic_fields<std::pmr::polymorphic_allocator<char>>;
+	}
 }
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "content_class.hpp"
 #include "entity.hpp"
 #include <boost/beast/http/message.hpp>
+#include <boost/asio/buffer.hpp>
 
 namespace mail::mime {
 	namespace detail {
@@ -30,6 +32,15 @@ namespace mail::mime {
 	public:
 		using value_type = typename HttpBody::value_type;
 
+		// The class of contiguous content, a string say, sent as it is.
+		template <class V = value_type, class = decltype(boost::asio::buffer(std::declval<const V&>()))>
+		static content_class classify(const value_type& v)
+		{
+			content_classifier c;
+			c.scan(boost::asio::buffer(v));
+			return c.result();
+		}
+
 		class reader : public HttpBody::reader {
 		private:
 			template <class Fields>
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "../encode_parts.hpp"
+#include <boost/beast/core/bind_handler.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
+#include <atomic>
+#include <memory>
+#include <random>
+
+namespace mail::mime {
+	namespace detail {
+		// "=_" cannot appear in base64 or quoted-printable content, and 8bit
+		// or binary content is most unlikely to hold the random digits
+		inline std::string make_boundary()
+		{
+			static thread_local std::mt19937_64 gen{ std::random_device{}() };
+			static constexpr char digits[] = "0123456789abcdef";
+			std::string r = "=_part_";
+			for (int i = 0; i < 2; ++i) {
+				auto v = gen();
+				for (int j = 0; j < 16; ++j, v >>= 4) {
+					r += digits[v & 15];
+				}
+			}
+			return r;
+		}
+
+		inline void append_quoted(std::string& out, boost::beast::string_view v)
+		{
+			out += '"';
+			for (const auto c : v) {
+				if (c == '"' || c == '\\') {
+					out += '\\';
+				}
+				out += c;
+			}
+			out += '"';
+		}
+
+		inline std::string part_header(const attachment& a)
+		{
+			std::string r = "Content-Type: ";
+			r += a.content_type;
+			if (!a.filename.empty()) {
+				r += "; name=";
+				append_quoted(r, a.filename);
+			}
+			r += "\r\nContent-Transfer-Encoding: ";
+			const auto encoding = to_string(a.encoding);
+			r.append(encoding.data(), encoding.size());
+			r += "\r\n";
+			if (a.filename.empty()) {
+				r += "Content-Disposition: inline\r\n";
+			}
+			else {
+				r += "Content-Disposition: attachment; filename=";
+				append_quoted(r, a.filename);
+				r += "\r\n";
+			}
+			return r;
+		}
+
+		// What the encoding jobs share: the last one to finish calls the
+		// handler.
+		template <class Handler, class Executor>
+		class encode_parts_state
+		{
+		public:
+			template <class DeducedHandler>
+			encode_parts_state(DeducedHandler&& h, const Executor& ex, std::size_t jobs)
+				: handler_(std::forward<DeducedHandler>(h))
+				, work_(boost::asio::get_associated_executor(handler_, ex))
+				, left_(jobs)
+			{
+			}
+
+			void done()
+			{
+				if (left_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					complete();
+				}
+			}
+			void complete()
+			{
+				// from another thread, the work must outlast the post
+				boost::asio::post(work_.get_executor(),
+								  boost::beast::bind_handler(std::move(handler_), boost::beast::error_code{}));
+				work_.reset();
+			}
+		private:
+			Handler handler_;
+			boost::asio::executor_work_guard<boost::asio::associated_executor_t<Handler, Executor>> work_;
+			std::atomic<std::size_t> left_;
+		};
+	}
+
+	template <class Executor, class Iterator, class Fields, class EncodeHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		EncodeHandler, void(boost::beast::error_code)
+	) async_encode_parts(const Executor& ex,
+						 Iterator first, Iterator last,
+						 entity<multipart_body, Fields>& e,
+						 EncodeHandler&& handler)
+	{
+		return async_encode_parts(ex, first, last, e, encode_options{}, std::forward<EncodeHandler>(handler));
+	}
+	template <class Executor, class Iterator, class Fields, class EncodeHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		EncodeHandler, void(boost::beast::error_code)
+	) async_encode_parts(const Executor& ex,
+						 Iterator first, Iterator last,
+						 entity<multipart_body, Fields>& e,
+						 const encode_options& options,
+						 EncodeHandler&& handler)
+	{
+		boost::asio::async_completion<
+			EncodeHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		using handler_type = BOOST_ASIO_HANDLER_TYPE(
+			EncodeHandler,
+			void(boost::beast::error_code));
+		using state_type = detail::encode_parts_state<handler_type, Executor>;
+
+		auto& body = e.body();
+		if (body.boundary.empty()) {
+			body.boundary = detail::make_boundary();
+			e.set(field::mime_version, "1.0");
+			e.set(field::content_type, "multipart/mixed; boundary=\"" + body.boundary + "\"");
+		}
+		const auto piece = (std::max)(options.piece / base64::line_input, std::size_t{ 1 }) * base64::line_input;
+
+		// every slot is in place before a job fills one
+		const auto begin = body.parts.size();
+		std::size_t jobs = 0;
+		for (auto it = first; it != last; ++it) {
+			const attachment& a = *it;
+			multipart_body::part p;
+			p.header = detail::part_header(a);
+			p.data = data_class(a.encoding);
+			if (options.cache != nullptr || a.encoding != transfer_encoding::base64) {
+				p.content.resize(a.content.empty() ? 0 : 1);
+			}
+			else {
+				p.content.resize((a.content.size() + piece - 1) / piece);
+			}
+			jobs += p.content.size();
+			body.parts.push_back(std::move(p));
+		}
+
+		const auto state = std::allocate_shared<state_type>(
+			boost::asio::get_associated_allocator(init.completion_handler),
+			std::move(init.completion_handler), ex, jobs);
+		if (jobs == 0) {
+			state->complete();
+			return init.result.get();
+		}
+		auto part = body.parts.begin() + begin;
+		for (auto it = first; it != last; ++it, ++part) {
+			const attachment& a = *it;
+			if (options.cache != nullptr || a.encoding != transfer_encoding::base64) {
+				if (!part->content.empty()) {
+					boost::asio::post(ex, [state, out = &part->content[0], in = a.content, e = a.encoding, cache = options.cache] {
+						*out = cache != nullptr ? cache->get(in, e) : shared_buffer{ encode(e, in) };
+						state->done();
+					});
+				}
+				continue;
+			}
+			for (std::size_t i = 0; i < part->content.size(); ++i) {
+				boost::asio::post(ex, [state, out = &part->content[i], in = a.content.substr(i * piece, piece)] {
+					*out = shared_buffer{ encode(transfer_encoding::base64, in) };
+					state->done();
+				});
+			}
+		}
+		return init.result.get();
+	}
+}
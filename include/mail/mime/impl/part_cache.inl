@@ -0,0 +1,209 @@
+#pragma once
+
+#include "../part_cache.hpp"
+#include <openssl/evp.h>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#if !defined(_WIN32)
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mail::mime {
+#if !defined(_WIN32)
+	namespace detail {
+		class mapped_file
+		{
+		public:
+			mapped_file(void* p, std::size_t n)
+				: p_(p)
+				, n_(n)
+			{
+			}
+			mapped_file(const mapped_file&) = delete;
+			mapped_file& operator=(const mapped_file&) = delete;
+			~mapped_file()
+			{
+				::munmap(p_, n_);
+			}
+		private:
+			void* p_;
+			std::size_t n_;
+		};
+
+		// The content of the file at path, mapped; empty when the file is
+		// empty or cannot be mapped.
+		inline shared_buffer map_file(const char* path)
+		{
+			const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (fd == -1) {
+				return {};
+			}
+			struct stat st;
+			void* p = MAP_FAILED;
+			if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+				p = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+			}
+			::close(fd);
+			if (p == MAP_FAILED) {
+				return {};
+			}
+			const auto n = static_cast<std::size_t>(st.st_size);
+			return { std::make_shared<mapped_file>(p, n), static_cast<const char*>(p), n };
+		}
+
+		inline bool write_file(const char* path, const std::string& content)
+		{
+			const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+			if (fd == -1) {
+				return false;
+			}
+			std::size_t done = 0;
+			while (done < content.size()) {
+				const auto r = ::write(fd, content.data() + done, content.size() - done);
+				if (r < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					break;
+				}
+				done += static_cast<std::size_t>(r);
+			}
+			// a file found after a crash is complete
+			const auto ok = done == content.size() && ::fdatasync(fd) == 0;
+			::close(fd);
+			return ok;
+		}
+	}
+#endif
+
+	inline part_cache::part_cache(std::size_t capacity)
+		: capacity_(capacity)
+	{
+	}
+	inline part_cache::part_cache(std::size_t capacity, std::string directory)
+		: capacity_(capacity)
+		, directory_(std::move(directory))
+	{
+	}
+
+	inline std::size_t part_cache::key_hash::operator()(const key_type& k) const noexcept
+	{
+		std::size_t h;
+		std::memcpy(&h, k.data(), sizeof(h));
+		return h ^ k.back();
+	}
+
+	inline shared_buffer part_cache::get(boost::beast::string_view content, transfer_encoding e)
+	{
+		if (content.empty()) {
+			return {};
+		}
+		const auto key = make_key(content, e);
+		{
+			std::lock_guard<std::mutex> lock{ m_ };
+			const auto it = index_.find(key);
+			if (it != index_.end()) {
+				++stats_.hits;
+				lru_.splice(lru_.begin(), lru_, it->second);
+				return it->second->value;
+			}
+			++stats_.misses;
+		}
+		auto value = load(key);
+		if (value.empty()) {
+			value = store(key, encode(e, content));
+		}
+		return insert(key, std::move(value));
+	}
+
+	inline part_cache::stats_type part_cache::stats() const
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		return stats_;
+	}
+
+	inline part_cache::key_type part_cache::make_key(boost::beast::string_view content, transfer_encoding e)
+	{
+		key_type key{};
+		unsigned int n = 0;
+		::EVP_Digest(content.data(), content.size(), key.data(), &n, ::EVP_sha256(), nullptr);
+		key.back() = static_cast<unsigned char>(e);
+		return key;
+	}
+
+	inline std::string part_cache::path(const key_type& key) const
+	{
+		static constexpr char digits[] = "0123456789abcdef";
+		std::string r = directory_;
+		r += '/';
+		for (const auto c : key) {
+			r += digits[c >> 4];
+			r += digits[c & 15];
+		}
+		return r;
+	}
+
+	inline shared_buffer part_cache::load(const key_type& key) const
+	{
+#if !defined(_WIN32)
+		if (!directory_.empty()) {
+			return detail::map_file(path(key).c_str());
+		}
+#endif
+		return {};
+	}
+
+	inline shared_buffer part_cache::store(const key_type& key, std::string value) const
+	{
+#if !defined(_WIN32)
+		if (!directory_.empty()) {
+			// written under another name, then renamed into place whole
+			const auto p = path(key);
+			static std::atomic<unsigned> n{ 0 };
+			const auto tmp = p + ".tmp" + std::to_string(::getpid()) + "." + std::to_string(n++);
+			if (detail::write_file(tmp.c_str(), value) && std::rename(tmp.c_str(), p.c_str()) == 0) {
+				auto mapped = detail::map_file(p.c_str());
+				if (!mapped.empty()) {
+					return mapped;
+				}
+			}
+			else {
+				::unlink(tmp.c_str());
+			}
+		}
+#endif
+		return shared_buffer{ std::move(value) };
+	}
+
+	inline shared_buffer part_cache::insert(const key_type& key, shared_buffer value)
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		const auto it = index_.find(key);
+		if (it != index_.end()) {
+			lru_.splice(lru_.begin(), lru_, it->second);
+			return it->second->value;
+		}
+		lru_.push_front({ key, value });
+		index_.emplace(key, lru_.begin());
+		stats_.size += value.size();
+		while (stats_.size > capacity_ && lru_.size() > 1) {
+			auto& last = lru_.back();
+#if !defined(_WIN32)
+			if (!directory_.empty()) {
+				::unlink(path(last.key).c_str());
+			}
+#endif
+			stats_.size -= last.value.size();
+			++stats_.evictions;
+			index_.erase(last.key);
+			lru_.pop_back();
+		}
+		return value;
+	}
+}
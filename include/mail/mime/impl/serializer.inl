@@ -3,6 +3,7 @@
 #include "../serializer.hpp"
 #include <boost/beast/core/detail/buffers_ref.hpp>
 #include <boost/beast/core/detail/config.hpp>
+#include <boost/beast/http/error.hpp>
 #include <boost/assert.hpp>
 
 namespace mail::mime {
@@ -18,38 +19,146 @@ namespace mail::mime {
 	template <typename Body, typename Fields>
 	serializer<Body, Fields>::serializer(value_type& e)
 		: e_(e)
-		, wr_(e.base(), e.body())
+		, wr_(boost::in_place_init, e.base(), e.body())
 	{
 	}
 	template <typename Body, typename Fields>
+	void serializer<Body, Fields>::reset()
+	{
+		v_.reset();
+		pv_.reset();
+		fwr_ = boost::none;
+		wr_ = boost::none;
+		wr_.emplace(e_.base(), e_.body());
+		s_ = do_construct;
+		header_done_ = false;
+	}
+	template <typename Body, typename Fields>
+	template <class Visit>
+	void serializer<Body, Fields>::walk(boost::beast::error_code& ec, Visit&& visit) const
+	{
+		if constexpr (!std::is_const_v<value_type>) {
+			ec = boost::beast::http::error::need_more;
+			return;
+		}
+		else {
+			if (cache_header_ && !header_.empty()) {
+				visit(boost::asio::const_buffer{ header_.data(), header_.size() });
+			}
+			else {
+				typename Fields::writer fwr{ e_ };
+				visit(fwr.get());
+			}
+			writer wr{ e_.base(), e_.body() };
+			wr.init(ec);
+			if (ec) {
+				return;
+			}
+			while (true) {
+				auto result = wr.get(ec);
+				if (ec || !result) {
+					return;
+				}
+				visit(result->first);
+				if (!result->second) {
+					return;
+				}
+			}
+		}
+	}
+	template <typename Body, typename Fields>
+	std::uint64_t serializer<Body, Fields>::size(boost::beast::error_code& ec) const
+	{
+		std::uint64_t n = 0;
+		if constexpr (detail::has_size<Body>::value) {
+			ec.assign(0, ec.category());
+			if (cache_header_ && !header_.empty()) {
+				n = header_.size();
+			}
+			else {
+				typename Fields::writer fwr{ e_ };
+				n = boost::asio::buffer_size(fwr.get());
+			}
+			return n + Body::size(e_.body());
+		}
+		else {
+			walk(ec, [&n](const auto& buffers) {
+				n += boost::asio::buffer_size(buffers);
+			});
+			return ec ? 0 : n;
+		}
+	}
+	template <typename Body, typename Fields>
+	content_class serializer<Body, Fields>::header_class() const
+	{
+		content_classifier c;
+		if (cache_header_ && !header_.empty()) {
+			c.scan(boost::asio::const_buffer{ header_.data(), header_.size() });
+		}
+		else {
+			typename Fields::writer fwr{ e_ };
+			c.scan(fwr.get());
+		}
+		return c.result();
+	}
+	template <typename Body, typename Fields>
+	content_class serializer<Body, Fields>::body_class() const
+	{
+		if constexpr (detail::has_classify<Body>::value) {
+			return Body::classify(e_.body());
+		}
+		else {
+			return content_class::eight_bit;
+		}
+	}
+	template <typename Body, typename Fields>
 	template <class Visit>
 	void serializer<Body, Fields>::next(boost::beast::error_code& ec, Visit&& visit)
 	{
 		switch (s_) {
 			case do_construct: {
-				fwr_.emplace(e_);
+				if (!cache_header_) {
+					fwr_.emplace(e_);
+				}
+				else if (header_.empty()) {
+					typename Fields::writer fwr{ e_ };
+					const auto b = fwr.get();
+					header_.resize(boost::asio::buffer_size(b));
+					boost::asio::buffer_copy(boost::asio::buffer(&header_[0], header_.size()), b);
+				}
 				s_ = do_init;
 				BOOST_FALLTHROUGH;
 			}
 			case do_init: {
-				wr_.init(ec);
+				wr_->init(ec);
 				if (ec) {
 					return;
 				}
 				if (split_) {
 					goto go_header_only;
 				}
-				auto result = wr_.get(ec);
+				auto result = wr_->get(ec);
 				if (ec == boost::beast::http::error::need_more) {
+					// the body follows once it is produced
+					more_ = true;
 					goto go_header_only;
 				}
 				if (ec) {
 					return;
 				}
 				if (!result) {
+					more_ = false;
 					goto go_header_only;
 				}
 				more_ = result->second;
+				if (cache_header_) {
+					v_.template emplace<5>(
+						boost::in_place_init,
+						boost::asio::const_buffer{ header_.data(), header_.size() },
+						result->first);
+					s_ = do_cached;
+					goto go_cached;
+				}
 				v_.template emplace<2>(
 					boost::in_place_init,
 					fwr_->get(),
@@ -61,7 +170,17 @@ namespace mail::mime {
 				do_visit<2>(ec, visit);
 				break;
 
+			case do_cached:
+			go_cached:
+				do_visit<5>(ec, visit);
+				break;
+
 			go_header_only:
+				if (cache_header_) {
+					v_.template emplace<4>(boost::asio::const_buffer{ header_.data(), header_.size() });
+					s_ = do_cached_only;
+					goto go_cached_only;
+				}
 				v_.template emplace<1>(fwr_->get());
 				s_ = do_header_only;
 				BOOST_FALLTHROUGH;
@@ -69,12 +188,17 @@ namespace mail::mime {
 				do_visit<1>(ec, visit);
 				break;
 
+			case do_cached_only:
+			go_cached_only:
+				do_visit<4>(ec, visit);
+				break;
+
 			case do_body:
 				s_ = do_body + 1;
 				BOOST_FALLTHROUGH;
 
 			case do_body + 1: {
-				auto result = wr_.get(ec);
+				auto result = wr_->get(ec);
 				if (ec) {
 					return;
 				}
@@ -112,6 +236,15 @@ namespace mail::mime {
 				if (buffer_size(v_.template get<2>()) > 0) {
 					break;
 				}
+				goto go_header_done;
+
+			case do_cached:
+				BOOST_ASSERT(n <= buffer_size(v_.template get<5>()));
+				v_.template get<5>().consume(n);
+				if (buffer_size(v_.template get<5>()) > 0) {
+					break;
+				}
+			go_header_done:
 				header_done_ = true;
 				v_.reset();
 				if (!more_) {
@@ -126,9 +259,18 @@ namespace mail::mime {
 				if (buffer_size(v_.template get<1>()) > 0) {
 					break;
 				}
+				goto go_header_only_done;
+
+			case do_cached_only:
+				BOOST_ASSERT(n <= buffer_size(v_.template get<4>()));
+				v_.template get<4>().consume(n);
+				if (buffer_size(v_.template get<4>()) > 0) {
+					break;
+				}
+			go_header_only_done:
 				fwr_ = boost::none;
 				header_done_ = true;
-				if (!split_) {
+				if (!split_ && !more_) {
 					goto go_complete;
 				}
 				s_ = do_body;
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "content_class.hpp"
+#include "entity.hpp"
+#include <boost/beast/core/error.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/optional.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mail::mime {
+	// Content shared by the messages which send it, and changed by none:
+	// a view of memory which the owner keeps, a string or a mapped file.
+	class shared_buffer
+	{
+	public:
+		shared_buffer() = default;
+		explicit shared_buffer(std::string s)
+		{
+			auto p = std::make_shared<const std::string>(std::move(s));
+			data_ = p->data();
+			size_ = p->size();
+			owner_ = std::move(p);
+		}
+		shared_buffer(std::shared_ptr<const void> owner, const char* data, std::size_t size)
+			: owner_(std::move(owner))
+			, data_(data)
+			, size_(size)
+		{
+		}
+
+		const char* data() const noexcept
+		{
+			return data_;
+		}
+		std::size_t size() const noexcept
+		{
+			return size_;
+		}
+		bool empty() const noexcept
+		{
+			return size_ == 0;
+		}
+	private:
+		std::shared_ptr<const void> owner_;
+		const char* data_ = nullptr;
+		std::size_t size_ = 0;
+	};
+
+	// The body of a multipart entity whose Content-Type carries boundary.
+	// Each part is a block of header fields and its content, encoded
+	// already and in CRLF lines, as one or more buffers; the writer sends
+	// them as they are. See async_encode_parts.
+	struct multipart_body
+	{
+		struct part
+		{
+			// the fields, each line ending with CRLF
+			std::string header;
+			std::vector<shared_buffer> content;
+			// the class of content, as its transfer encoding makes it;
+			// taken for 8bit unless known
+			content_class data = content_class::eight_bit;
+		};
+
+		struct value_type
+		{
+			std::string boundary;
+			std::vector<part> parts;
+		};
+
+		// The bytes the writer produces for v, delimiters included.
+		static std::uint64_t size(const value_type& v)
+		{
+			// "--" boundary CRLF, the header, and the empty line, per part
+			std::uint64_t n = 0;
+			bool line_start = false;
+			for (std::size_t i = 0; i != v.parts.size(); ++i) {
+				if (i != 0 && !line_start) {
+					n += 2;
+				}
+				n += v.boundary.size() + v.parts[i].header.size() + 6;
+				line_start = false;
+				for (const auto& c : v.parts[i].content) {
+					if (!c.empty()) {
+						n += c.size();
+						line_start = c.data()[c.size() - 1] == '\n';
+					}
+				}
+			}
+			if (!v.parts.empty() && !line_start) {
+				n += 2;
+			}
+			// "--" boundary "--" CRLF
+			return n + v.boundary.size() + 6;
+		}
+
+		// The class of the content the writer produces for v, from the
+		// classes of the parts and their headers, without reading content.
+		static content_class classify(const value_type& v)
+		{
+			auto c = content_class::seven_bit;
+			for (const auto& p : v.parts) {
+				content_classifier header;
+				header.scan(boost::asio::buffer(p.header));
+				c = (std::max)({ c, p.data, header.result() });
+			}
+			return c;
+		}
+
+		class writer
+		{
+		public:
+			// a line break, the delimiter line and the part's header
+			using const_buffers_type = std::array<boost::asio::const_buffer, 6>;
+
+			template <class Fields>
+			explicit writer(const entity<multipart_body, Fields>& e)
+				: v_(e.body())
+			{
+			}
+			template <class Fields>
+			writer(const header<Fields>&, const value_type& v)
+				: v_(v)
+			{
+			}
+
+			void init(boost::beast::error_code& ec)
+			{
+				ec.assign(0, ec.category());
+			}
+			boost::optional<std::pair<const_buffers_type, bool>> get(boost::beast::error_code& ec)
+			{
+				ec.assign(0, ec.category());
+				if (open_) {
+					const auto& content = v_.parts[next_ - 1].content;
+					while (chunk_ < content.size()) {
+						const auto& c = content[chunk_++];
+						if (!c.empty()) {
+							line_start_ = c.data()[c.size() - 1] == '\n';
+							return { { const_buffers_type{ boost::asio::const_buffer{ c.data(), c.size() } }, true } };
+						}
+					}
+					open_ = false;
+				}
+				if (done_) {
+					return boost::none;
+				}
+				// the delimiter starts a line, the CRLF before it being its own
+				const auto crlf = next_ != 0 && !line_start_;
+				if (next_ < v_.parts.size()) {
+					const auto& header = v_.parts[next_++].header;
+					open_ = true;
+					chunk_ = 0;
+					line_start_ = false;
+					return { { delimiter(crlf, false, boost::asio::buffer(header)), true } };
+				}
+				done_ = true;
+				return { { delimiter(crlf, true, {}), false } };
+			}
+		private:
+			const_buffers_type delimiter(bool crlf, bool close, boost::asio::const_buffer header) const
+			{
+				return {
+					boost::asio::const_buffer{ "\r\n", crlf ? 2u : 0u },
+					boost::asio::const_buffer{ "--", 2 },
+					boost::asio::buffer(v_.boundary),
+					close ? boost::asio::const_buffer{ "--\r\n", 4 } : boost::asio::const_buffer{ "\r\n", 2 },
+					header,
+					// the empty line which ends the header
+					boost::asio::const_buffer{ "\r\n", close ? 0u : 2u },
+				};
+			}
+
+			const value_type& v_;
+			// the part opened next
+			std::size_t next_ = 0;
+			// the content of part next_ - 1 is being sent, from chunk_ on
+			bool open_ = false;
+			std::size_t chunk_ = 0;
+			bool line_start_ = false;
+			bool done_ = false;
+		};
+	};
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "encode_parts.hpp"
+#include "multipart_body.hpp"
+#include "transfer_encoding.hpp"
+#include <boost/beast/core/string.hpp>
+#include <array>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace mail::mime {
+	// Encoded part content by the SHA-256 of the content and the encoding,
+	// for content sent again and again, like a logo or the PDF of a
+	// campaign: it is encoded once, and the messages which send it share
+	// the buffer get returns, which stays valid after it is evicted. The
+	// least recently used entries go when the content held exceeds
+	// capacity bytes. Given a directory (POSIX), the encoded content is
+	// written to a file there and mapped instead of kept on the heap, and
+	// the files a previous run left are used again. Thread safe.
+	//
+	//	part_cache cache{ 256 << 20, "/var/cache/mail-parts" };
+	//	encode_options options;
+	//	options.cache = &cache;
+	//	async_encode_parts(pool.get_executor(), first, last, e, options, handler);
+	class part_cache final
+		: public part_cache_base
+	{
+	public:
+		struct stats_type
+		{
+			std::uint64_t hits = 0;
+			std::uint64_t misses = 0;
+			std::uint64_t evictions = 0;
+			// the encoded bytes held
+			std::size_t size = 0;
+		};
+
+		explicit part_cache(std::size_t capacity);
+		part_cache(std::size_t capacity, std::string directory);
+		part_cache(const part_cache&) = delete;
+		part_cache& operator=(const part_cache&) = delete;
+
+		// Returns content encoded with e, encoding it unless it is cached.
+		shared_buffer get(boost::beast::string_view content, transfer_encoding e) override;
+
+		stats_type stats() const;
+	private:
+		using key_type = std::array<unsigned char, 33>;
+		struct key_hash
+		{
+			std::size_t operator()(const key_type& k) const noexcept;
+		};
+		struct entry
+		{
+			key_type key;
+			shared_buffer value;
+		};
+
+		static key_type make_key(boost::beast::string_view content, transfer_encoding e);
+		std::string path(const key_type& key) const;
+		// The buffer of the file of key, empty when there is none.
+		shared_buffer load(const key_type& key) const;
+		// Writes the file of key and maps it; returns value when that fails.
+		shared_buffer store(const key_type& key, std::string value) const;
+		// Adds value as the most recently used, unless another thread did.
+		shared_buffer insert(const key_type& key, shared_buffer value);
+
+		const std::size_t capacity_;
+		const std::string directory_;
+		mutable std::mutex m_;
+		// most recently used first
+		std::list<entry> lru_;
+		std::unordered_map<key_type, std::list<entry>::iterator, key_hash> index_;
+		stats_type stats_;
+	};
+}
+
+#include "impl/part_cache.inl"
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+
+namespace mail::mime::quoted_printable {
+	// characters per line, the most RFC 2045 allows
+	static std::size_t constexpr line_length = 76;
+
+	// The most n bytes take encoded.
+	constexpr std::size_t max_encoded_size(std::size_t n)
+	{
+		return 3 * n + (3 * n / (line_length - 3) + 1) * 3;
+	}
+
+	// The bytes encode writes for the n bytes at data.
+	inline std::size_t encoded_size(const void* data, std::size_t n)
+	{
+		const auto in = static_cast<const unsigned char*>(data);
+		std::size_t r = 0;
+		std::size_t line = 0;
+		for (std::size_t i = 0; i < n; ++i) {
+			const auto c = in[i];
+			if (c == '\r' && i + 1 < n && in[i + 1] == '\n') {
+				r += 2;
+				line = 0;
+				++i;
+				continue;
+			}
+			const auto line_end = i + 1 == n || (in[i + 1] == '\r' && i + 2 < n && in[i + 2] == '\n');
+			const auto literal = (c >= 33 && c <= 126 && c != '=') ||
+				((c == ' ' || c == '\t') && !line_end);
+			const std::size_t size = literal ? 1 : 3;
+			if (line + size > line_length - 1) {
+				r += 3;
+				line = 0;
+			}
+			r += size;
+			line += size;
+		}
+		return r;
+	}
+
+	// Encodes the n bytes at data into at most max_encoded_size(n) bytes
+	// at out, keeping CRLF line breaks. Returns the bytes written.
+	inline std::size_t encode(char* out, const void* data, std::size_t n)
+	{
+		static constexpr char digits[] = "0123456789ABCDEF";
+		const auto in = static_cast<const unsigned char*>(data);
+		auto p = out;
+		std::size_t line = 0;
+		for (std::size_t i = 0; i < n; ++i) {
+			const auto c = in[i];
+			if (c == '\r' && i + 1 < n && in[i + 1] == '\n') {
+				*p++ = '\r';
+				*p++ = '\n';
+				line = 0;
+				++i;
+				continue;
+			}
+			// white space ending a line would be taken away in transit
+			const auto line_end = i + 1 == n || (in[i + 1] == '\r' && i + 2 < n && in[i + 2] == '\n');
+			const auto literal = (c >= 33 && c <= 126 && c != '=') ||
+				((c == ' ' || c == '\t') && !line_end);
+			const std::size_t size = literal ? 1 : 3;
+			// room for the "=" of a soft line break
+			if (line + size > line_length - 1) {
+				*p++ = '=';
+				*p++ = '\r';
+				*p++ = '\n';
+				line = 0;
+			}
+			if (literal) {
+				*p++ = static_cast<char>(c);
+			}
+			else {
+				*p++ = '=';
+				*p++ = digits[c >> 4];
+				*p++ = digits[c & 15];
+			}
+			line += size;
+		}
+		return p - out;
+	}
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "content_class.hpp"
 #include "entity.hpp"
 #include <boost/beast/core/detail/config.hpp>
 #include <boost/beast/core/buffers_cat.hpp>
@@ -9,9 +10,32 @@
 #include <boost/beast/core/type_traits.hpp>
 #include <boost/beast/core/detail/variant.hpp>
 #include <boost/asio/buffer.hpp>
+#include <boost/optional/optional.hpp>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <type_traits>
 
 namespace mail::mime {
 	using boost::beast::http::is_body;
+
+	namespace detail {
+		// a body which tells the size of its content, like beast's sized bodies
+		template <class Body, class = void>
+		struct has_size : std::false_type {};
+		template <class Body>
+		struct has_size<Body, std::void_t<
+			decltype(std::uint64_t{ Body::size(std::declval<const typename Body::value_type&>()) })
+		>> : std::true_type {};
+		// a body which tells the class of its content without reading it all
+		// through its writer
+		template <class Body, class = void>
+		struct has_classify : std::false_type {};
+		template <class Body>
+		struct has_classify<Body, std::void_t<
+			decltype(content_class{ Body::classify(std::declval<const typename Body::value_type&>()) })
+		>> : std::true_type {};
+	}
 	//template<class T, class = void>
 	//struct is_body_writer : std::false_type {};
 
@@ -36,7 +60,9 @@ namespace mail::mime {
 
 			do_init             =  10,
 			do_header_only      =  20,
+			do_cached_only      =  25,
 			do_header           =  30,
+			do_cached           =  35,
 			do_body             =  40,
 
 			do_complete         = 120
@@ -60,18 +86,30 @@ namespace mail::mime {
 			typename writer::const_buffers_type>;       // body
 		using pcb3_t = boost::beast::buffers_prefix_view<cb3_t const&>;
 
+		using cb4_t = boost::beast::buffers_suffix<
+			boost::asio::const_buffer>;                 // cached header
+		using pcb4_t = boost::beast::buffers_prefix_view<cb4_t const&>;
+
+		using cb5_t = boost::beast::buffers_suffix<boost::beast::buffers_cat_view<
+			boost::asio::const_buffer,                  // cached header
+			typename writer::const_buffers_type>>;      // body
+		using pcb5_t = boost::beast::buffers_prefix_view<cb5_t const&>;
+
 		value_type& e_;
-		writer wr_;
+		boost::optional<writer> wr_;
 		boost::optional<typename Fields::writer> fwr_;
 		boost::beast::detail::variant<
-			cb1_t, cb2_t, cb3_t> v_;
+			cb1_t, cb2_t, cb3_t, cb4_t, cb5_t> v_;
 		boost::beast::detail::variant<
-			pcb1_t, pcb2_t, pcb3_t> pv_;
+			pcb1_t, pcb2_t, pcb3_t, pcb4_t, pcb5_t> pv_;
 		std::size_t limit_ = std::numeric_limits<std::size_t>::max();
 		int s_ = do_construct;
 		bool split_ = false;
 		bool header_done_ = false;
 		bool more_;
+		bool cache_header_ = false;
+		// the header rendered once, when cache_header_
+		std::string header_;
 	public:
 		serializer(serializer&&) = default;
 		serializer(const serializer&) = default;
@@ -109,6 +147,42 @@ namespace mail::mime {
 			return s_ == do_complete;
 		}
 
+		// Starts over, to send the entity again: after a failed attempt, or
+		// on another session. The body writer is constructed again.
+		void reset();
+
+		// When set, the header is rendered once into the serializer and
+		// sent from there by every send after reset(), which saves building
+		// the fields writer again. Set it again after changing the fields.
+		bool cache_header() const
+		{
+			return cache_header_;
+		}
+		void cache_header(bool v)
+		{
+			cache_header_ = v;
+			header_.clear();
+		}
+
+		// Calls visit(buffers) with each buffer sequence of the output, from
+		// the start and header first, leaving the serializer as it is: the
+		// body is read by a writer of its own and nothing is copied. Fails
+		// with http::error::need_more for a body which can only be read
+		// once, its writer taking the entity non-const (channel_body).
+		template<class Visit>
+		void walk(boost::beast::error_code& ec, Visit&& visit) const;
+
+		// The bytes of the output, without serializing: bodies with a static
+		// size(value_type), like string_body and multipart_body, are not
+		// read at all, others through walk.
+		std::uint64_t size(boost::beast::error_code& ec) const;
+
+		// The class of the header, and that of the body, without serializing:
+		// bodies with a static classify(value_type), like string_body and
+		// multipart_body, tell theirs, others are taken for 8bit.
+		content_class header_class() const;
+		content_class body_class() const;
+
 		template<class Visit>
 		void next(boost::beast::error_code& ec, Visit&& visit);
 
@@ -116,7 +190,7 @@ namespace mail::mime {
 
 		writer& writer_impl()
 		{
-			return wr_;
+			return *wr_;
 		}
 	};
 }
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "base64.hpp"
+#include "content_class.hpp"
+#include "quoted_printable.hpp"
+#include <boost/beast/core/string.hpp>
+#include <cstdint>
+#include <string>
+
+namespace mail::mime {
+	// base64 and quoted_printable fit any transport; eight_bit and binary
+	// leave content as it is, for servers which advertise 8BITMIME, or
+	// BINARYMIME and CHUNKING (see smtp::session::extensions): 8bit content
+	// has lines of at most 998 bytes which end with CRLF, and no NUL.
+	enum class transfer_encoding : std::uint8_t
+	{
+		base64								=	0,
+		quoted_printable					=	1,
+		eight_bit							=	2,
+		binary								=	3,
+	};
+
+	// The Content-Transfer-Encoding value.
+	inline boost::beast::string_view to_string(transfer_encoding e)
+	{
+		switch (e) {
+			case transfer_encoding::base64:
+				return "base64";
+			case transfer_encoding::quoted_printable:
+				return "quoted-printable";
+			case transfer_encoding::eight_bit:
+				return "8bit";
+			case transfer_encoding::binary:
+				return "binary";
+		}
+		return {};
+	}
+
+	// The class of content encoded with e: 7bit for base64 and
+	// quoted-printable, and otherwise what e declares.
+	inline content_class data_class(transfer_encoding e)
+	{
+		switch (e) {
+			case transfer_encoding::eight_bit:
+				return content_class::eight_bit;
+			case transfer_encoding::binary:
+				return content_class::binary;
+			default:
+				return content_class::seven_bit;
+		}
+	}
+
+	// The bytes of content encoded with e, to size a message before its
+	// parts are encoded.
+	inline std::size_t encoded_size(transfer_encoding e, boost::beast::string_view content)
+	{
+		switch (e) {
+			case transfer_encoding::base64:
+				return base64::encoded_size(content.size());
+			case transfer_encoding::quoted_printable:
+				return quoted_printable::encoded_size(content.data(), content.size());
+			case transfer_encoding::eight_bit:
+			case transfer_encoding::binary:
+				return content.size();
+		}
+		return 0;
+	}
+
+	// Returns content encoded with e.
+	inline std::string encode(transfer_encoding e, boost::beast::string_view content)
+	{
+		std::string r;
+		switch (e) {
+			case transfer_encoding::base64:
+				r.resize(base64::encoded_size(content.size()));
+				r.resize(base64::encode(&r[0], content.data(), content.size()));
+				break;
+			case transfer_encoding::quoted_printable:
+				r.resize(quoted_printable::max_encoded_size(content.size()));
+				r.resize(quoted_printable::encode(&r[0], content.data(), content.size()));
+				break;
+			case transfer_encoding::eight_bit:
+			case transfer_encoding::binary:
+				r.assign(content.data(), content.size());
+				break;
+		}
+		return r;
+	}
+}
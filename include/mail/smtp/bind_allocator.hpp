@@ -0,0 +1,78 @@
+#pragma once
+
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace mail::smtp {
+	// A completion handler with an associated allocator, which the
+	// operations it is given to allocate their state with: bound to a
+	// std::pmr::polymorphic_allocator over a monotonic_buffer_resource,
+	// everything a send allocates is released with the resource.
+	template <class Handler, class Allocator>
+	class allocator_binder
+	{
+	public:
+		using allocator_type = Allocator;
+
+		template <class DeducedHandler>
+		allocator_binder(const Allocator& alloc, DeducedHandler&& handler)
+			: h_(std::forward<DeducedHandler>(handler))
+			, alloc_(alloc)
+		{
+		}
+
+		allocator_type get_allocator() const noexcept
+		{
+			return alloc_;
+		}
+
+		Handler& get() noexcept
+		{
+			return h_;
+		}
+		const Handler& get() const noexcept
+		{
+			return h_;
+		}
+
+		template <class... Args>
+		auto operator()(Args&&... args)
+			-> decltype(std::declval<Handler&>()(std::forward<Args>(args)...))
+		{
+			return h_(std::forward<Args>(args)...);
+		}
+
+		friend bool asio_handler_is_continuation(allocator_binder* b)
+		{
+			using boost::asio::asio_handler_is_continuation;
+			return asio_handler_is_continuation(std::addressof(b->h_));
+		}
+	private:
+		Handler h_;
+		Allocator alloc_;
+	};
+
+	template <class Allocator, class Handler>
+	allocator_binder<std::decay_t<Handler>, Allocator> bind_allocator(const Allocator& alloc, Handler&& handler)
+	{
+		return { alloc, std::forward<Handler>(handler) };
+	}
+}
+
+namespace boost::asio {
+	template <class Handler, class Allocator, class Executor>
+	struct associated_executor<mail::smtp::allocator_binder<Handler, Allocator>, Executor>
+	{
+		using type = associated_executor_t<Handler, Executor>;
+
+		static type get(const mail::smtp::allocator_binder<Handler, Allocator>& b,
+						const Executor& ex = Executor()) noexcept
+		{
+			return get_associated_executor(b.get(), ex);
+		}
+	};
+}
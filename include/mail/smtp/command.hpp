@@ -0,0 +1,96 @@
+#pragma once
+
+#include <boost/beast/core/string.hpp>
+#include <cstdint>
+
+namespace mail::smtp {
+	enum class verb
+	{
+		unknown,
+
+		helo,
+		ehlo,
+		mail,
+		rcpt,
+		data,
+		bdat,
+		rset,
+		noop,
+		quit,
+		vrfy,
+		help,
+		starttls,
+		auth,
+	};
+
+	// A parsed command line. The views refer to the read buffer of the
+	// session that produced the command and stay valid until the next read.
+	class command
+	{
+	public:
+		command() = default;
+		command(const command&) = default;
+		command& operator=(const command&) = default;
+
+		smtp::verb verb() const
+		{
+			return verb_;
+		}
+		void verb(smtp::verb v)
+		{
+			verb_ = v;
+		}
+
+		// everything after the verb, without the separating space
+		boost::beast::string_view argument() const
+		{
+			return argument_;
+		}
+		void argument(boost::beast::string_view v)
+		{
+			argument_ = v;
+		}
+
+		// MAIL FROM:<path> params / RCPT TO:<path> params
+		boost::beast::string_view path() const
+		{
+			return path_;
+		}
+		boost::beast::string_view parameters() const
+		{
+			return parameters_;
+		}
+		void path(boost::beast::string_view path, boost::beast::string_view params)
+		{
+			path_ = path;
+			parameters_ = params;
+		}
+
+		// BDAT chunk-size [LAST]
+		std::uint64_t chunk_size() const
+		{
+			return chunk_size_;
+		}
+		bool last_chunk() const
+		{
+			return last_chunk_;
+		}
+		void chunk(std::uint64_t size, bool last)
+		{
+			chunk_size_ = size;
+			last_chunk_ = last;
+		}
+
+		void clear()
+		{
+			*this = command{};
+		}
+	private:
+		smtp::verb verb_ = smtp::verb::unknown;
+		boost::beast::string_view argument_;
+		boost::beast::string_view path_;
+		boost::beast::string_view parameters_;
+		std::uint64_t chunk_size_ = 0;
+		bool last_chunk_ = false;
+	};
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "command.hpp"
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/error.hpp>
+
+namespace mail::smtp {
+	class command_parser
+	{
+	public:
+		// RFC 5321 4.5.3.1.4
+		static std::size_t constexpr max_line_length = 512;
+
+		command_parser() = default;
+
+		const command& get() const
+		{
+			return cmd_;
+		}
+
+		void reset()
+		{
+			cmd_.clear();
+			skipping_ = false;
+		}
+
+		// Parses one command line from contiguous memory without copying.
+		// Returns the number of bytes used, including the CRLF. A line too
+		// long is used up as it comes, with error::need_more, and fails
+		// with error::line_too_long once its LF is used.
+		std::size_t put(boost::asio::const_buffer buffer, boost::beast::error_code& ec);
+	private:
+		command cmd_;
+		// within a line too long
+		bool skipping_ = false;
+	};
+}
+
+#include "impl/command_parser.inl"
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "mpsc_queue.hpp"
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/beast/core/string.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace mail::smtp {
+	struct engine_options
+	{
+		// 0 for one shard per hardware thread
+		std::size_t shards = 0;
+		// pin shard i to core i (Linux)
+		bool pin_threads = true;
+		// jobs a shard runs at the same time
+		std::size_t max_in_flight = 64;
+	};
+
+	// Runs one io_context per core. Each shard owns the sessions it opens and
+	// runs its jobs on its own thread, so nothing inside a shard is locked.
+	// Jobs are routed to a shard by destination, which keeps the sessions to
+	// a destination in one place; producers hand them over through a
+	// lock-free queue per shard. A shard running out of work asks the others
+	// for their queued jobs, preferring those of destinations it already has
+	// warm sessions to; once none has any, it sleeps until a shard with a
+	// backlog wakes it.
+	//
+	//	delivery_engine<job> engine{ [](auto& shard, const std::string& dest, job j) {
+	//		// deliver j on shard.context(), then:
+	//		shard.warm(dest, true);
+	//		shard.done();
+	//	} };
+	//	engine.start();
+	//	engine.submit("example.com", std::move(j));
+	template <class Job>
+	class delivery_engine
+	{
+	public:
+		class shard;
+		using handler_type = std::function<void(shard&, const std::string&, Job)>;
+
+		class shard
+		{
+		public:
+			boost::asio::io_context& context()
+			{
+				return ioc_;
+			}
+			std::size_t index() const
+			{
+				return index_;
+			}
+
+			// Declares whether the shard keeps a session open to destination,
+			// which makes that destination's jobs the first it steals.
+			// Shard thread only.
+			void warm(const std::string& destination, bool v);
+			// Ends a job and starts the next. Shard thread only.
+			void done();
+		private:
+			friend class delivery_engine;
+
+			struct item
+			{
+				std::string destination;
+				Job job;
+			};
+			struct steal_request
+			{
+				std::size_t thief;
+				std::vector<std::string> destinations;
+			};
+
+			shard(delivery_engine& e, std::size_t index);
+
+			void submit(item&& i);
+			void drain();
+			void run_jobs();
+			void steal(std::size_t from);
+			void on_steal_reply(bool found);
+			void give(steal_request&& r);
+
+			delivery_engine& e_;
+			std::size_t index_;
+			boost::asio::io_context ioc_{ 1 };
+			mpsc_queue<item> inbox_;
+			std::atomic<bool> signaled_{ false };
+			// asleep until a shard with a backlog wakes it
+			std::atomic<bool> idle_{ true };
+			// owned by the shard thread
+			std::deque<item> queue_;
+			std::unordered_set<std::string> warm_;
+			std::size_t in_flight_ = 0;
+			std::size_t victim_ = 0;
+			std::size_t tried_ = 0;
+			bool running_ = false;
+			bool stealing_ = false;
+			std::thread thread_;
+		};
+
+		explicit delivery_engine(handler_type handler, const engine_options& options = {});
+		delivery_engine(const delivery_engine&) = delete;
+		delivery_engine& operator=(const delivery_engine&) = delete;
+		~delivery_engine();
+
+		std::size_t size() const
+		{
+			return shards_.size();
+		}
+		shard& at(std::size_t i)
+		{
+			return *shards_[i];
+		}
+
+		void start();
+		// Stops the shards, jobs still queued are dropped.
+		void stop();
+
+		// Any thread.
+		void submit(boost::beast::string_view destination, Job job);
+	private:
+		// Has an idle shard steal from shard victim.
+		void wake(std::size_t victim);
+
+		handler_type handler_;
+		engine_options options_;
+		std::atomic<std::size_t> idle_{ 0 };
+		std::vector<std::unique_ptr<shard>> shards_;
+		std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work_;
+	};
+}
+
+#include "impl/delivery_engine.inl"
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "error.hpp"
+#include "response.hpp"
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/core/string.hpp>
+
+namespace mail::smtp {
+	enum class delivery_status
+	{
+		delivered,
+		// 4xx: try the recipient again later
+		temporary,
+		// 5xx: give up
+		permanent,
+		// the session is unusable (421 or a stream error), try again on another
+		connection,
+	};
+
+	// RFC 3463 class.subject.detail at the start of a reply line
+	struct enhanced_status
+	{
+		unsigned cls = 0;
+		unsigned subject = 0;
+		unsigned detail = 0;
+
+		explicit operator bool() const
+		{
+			return cls != 0;
+		}
+	};
+
+	inline enhanced_status parse_enhanced_status(boost::beast::string_view line)
+	{
+		enhanced_status st;
+		unsigned v[3] = {};
+		std::size_t i = 0;
+		for (std::size_t n = 0; n < 3; ++n) {
+			const auto first = i;
+			while (i < line.size() && i - first < 3 && line[i] >= '0' && line[i] <= '9') {
+				v[n] = v[n] * 10 + static_cast<unsigned>(line[i++] - '0');
+			}
+			if (i == first || (n == 0 && i - first != 1)) {
+				return st;
+			}
+			if (n != 2) {
+				if (i == line.size() || line[i] != '.') {
+					return st;
+				}
+				++i;
+			}
+		}
+		if ((i != line.size() && line[i] != ' ') || (v[0] != 2 && v[0] != 4 && v[0] != 5)) {
+			return st;
+		}
+		st.cls = v[0];
+		st.subject = v[1];
+		st.detail = v[2];
+		return st;
+	}
+
+	inline delivery_status classify(reply_code code)
+	{
+		const auto v = static_cast<unsigned>(code);
+		if (code == reply_code::service_not_available) {
+			return delivery_status::connection;
+		}
+		if (v >= 200 && v < 400) {
+			return delivery_status::delivered;
+		}
+		if (v >= 400 && v < 500) {
+			return delivery_status::temporary;
+		}
+		if (v >= 500 && v < 600) {
+			return delivery_status::permanent;
+		}
+		return delivery_status::connection;
+	}
+	// The enhanced status of the reply, when given, wins over the reply code
+	// class, e.g. 550 5.x.x is permanent but 550 4.x.x is not. Errors other
+	// than error::failed come from the stream and are connection failures.
+	inline delivery_status classify(const boost::beast::error_code& ec, const response& resp)
+	{
+		if (ec && ec != error::failed) {
+			return delivery_status::connection;
+		}
+		const auto status = classify(resp.code());
+		if (status == delivery_status::connection || resp.lines().empty()) {
+			return status;
+		}
+		switch (parse_enhanced_status(resp.lines().front()).cls) {
+			case 2: return delivery_status::delivered;
+			case 4: return delivery_status::temporary;
+			case 5: return delivery_status::permanent;
+			default: return status;
+		}
+	}
+	inline delivery_status classify(const boost::beast::error_code& ec, reply_code code)
+	{
+		if (ec && ec != error::failed) {
+			return delivery_status::connection;
+		}
+		return classify(code);
+	}
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace mail::smtp {
+	namespace detail {
+		// Streaming insertion of the transparency dots of RFC 5321 4.5.2:
+		// a dot which starts a line is doubled.
+		class dot_stuffer
+		{
+		public:
+			// Without stuff, content is copied as it is, for BDAT.
+			void reset(bool stuff = true)
+			{
+				state_ = state::line_start;
+				stuff_ = stuff;
+			}
+			// whether the content so far ends with CRLF (or is empty)
+			bool at_line_start() const
+			{
+				return state_ == state::line_start;
+			}
+
+			// Whether buffers can be sent as they are, no dot starting a line.
+			template <class ConstBufferSequence>
+			bool clean(const ConstBufferSequence& buffers) const
+			{
+				if (!stuff_) {
+					return true;
+				}
+				auto st = state_;
+				for (auto it = boost::asio::buffer_sequence_begin(buffers);
+					 it != boost::asio::buffer_sequence_end(buffers); ++it) {
+					const boost::asio::const_buffer b = *it;
+					const auto first = static_cast<const char*>(b.data());
+					const auto last = first + b.size();
+					for (auto p = first; p != last; ++p) {
+						p = static_cast<const char*>(std::memchr(p, '.', static_cast<std::size_t>(last - p)));
+						if (!p) {
+							break;
+						}
+						const auto i = p - first;
+						if (i == 0 ? st == state::line_start :
+							i == 1 ? first[0] == '\n' && st == state::cr :
+							p[-2] == '\r' && p[-1] == '\n') {
+							return false;
+						}
+					}
+					st = advance(st, first, b.size());
+				}
+				return true;
+			}
+			// Moves past buffers, returning the dots copy would add to them.
+			template <class ConstBufferSequence>
+			std::size_t count(const ConstBufferSequence& buffers)
+			{
+				std::size_t n = 0;
+				for (auto it = boost::asio::buffer_sequence_begin(buffers);
+					 it != boost::asio::buffer_sequence_end(buffers); ++it) {
+					const boost::asio::const_buffer b = *it;
+					const auto first = static_cast<const char*>(b.data());
+					const auto last = first + b.size();
+					for (auto p = first; p != last; ++p) {
+						p = static_cast<const char*>(std::memchr(p, '.', static_cast<std::size_t>(last - p)));
+						if (!p) {
+							break;
+						}
+						const auto i = p - first;
+						if (i == 0 ? state_ == state::line_start :
+							i == 1 ? first[0] == '\n' && state_ == state::cr :
+							p[-2] == '\r' && p[-1] == '\n') {
+							++n;
+						}
+					}
+					state_ = advance(state_, first, b.size());
+				}
+				return n;
+			}
+			// Moves past the first n bytes of buffers, sent as they are.
+			template <class ConstBufferSequence>
+			void skip(const ConstBufferSequence& buffers, std::size_t n)
+			{
+				for (auto it = boost::asio::buffer_sequence_begin(buffers);
+					 it != boost::asio::buffer_sequence_end(buffers) && n != 0; ++it) {
+					const boost::asio::const_buffer b = *it;
+					const auto k = (std::min)(n, b.size());
+					state_ = advance(state_, static_cast<const char*>(b.data()), k);
+					n -= k;
+				}
+			}
+			// Copies buffers into out, doubling the dots which start a line,
+			// until out is full. Returns the bytes of buffers used; produced
+			// receives the bytes written to out. out may overlap the input
+			// when it starts at least as many bytes before it as there are.
+			template <class ConstBufferSequence>
+			std::size_t copy(const ConstBufferSequence& buffers, boost::asio::mutable_buffer out, std::size_t& produced)
+			{
+				auto o = static_cast<char*>(out.data());
+				const auto o_last = o + out.size();
+				std::size_t used = 0;
+				for (auto it = boost::asio::buffer_sequence_begin(buffers);
+					 it != boost::asio::buffer_sequence_end(buffers); ++it) {
+					const boost::asio::const_buffer b = *it;
+					auto p = static_cast<const char*>(b.data());
+					const auto last = p + b.size();
+					if (!stuff_) {
+						const auto k = static_cast<std::size_t>((std::min)(last - p, o_last - o));
+						if (k != 0) {
+							std::memmove(o, p, k);
+						}
+						o += k;
+						used += k;
+						if (k != b.size()) {
+							goto full;
+						}
+						continue;
+					}
+					while (p != last) {
+						if (state_ == state::line_start && *p == '.') {
+							if (o_last - o < 2) {
+								goto full;
+							}
+							*o++ = '.';
+							*o++ = '.';
+							++p;
+							++used;
+							state_ = state::in_line;
+							continue;
+						}
+						const auto avail = static_cast<std::size_t>((std::min)(last - p, o_last - o));
+						if (avail == 0) {
+							goto full;
+						}
+						const auto nl = static_cast<const char*>(std::memchr(p, '\n', avail));
+						const auto k = nl ? static_cast<std::size_t>(nl - p + 1) : avail;
+						std::memmove(o, p, k);
+						state_ = advance(state_, p, k);
+						o += k;
+						p += k;
+						used += k;
+					}
+				}
+			full:
+				produced = static_cast<std::size_t>(o - static_cast<char*>(out.data()));
+				return used;
+			}
+		private:
+			enum class state {
+				line_start,
+				in_line,
+				cr,
+			};
+			static state advance(state st, const char* p, std::size_t n)
+			{
+				if (n == 0) {
+					return st;
+				}
+				if (p[n - 1] == '\r') {
+					return state::cr;
+				}
+				if (p[n - 1] == '\n' && (n >= 2 ? p[n - 2] == '\r' : st == state::cr)) {
+					return state::line_start;
+				}
+				return state::in_line;
+			}
+
+			state state_ = state::line_start;
+			bool stuff_ = true;
+		};
+	}
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <boost/beast/core/string.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mail::smtp {
+	// The delivery status notifications (RFC 3461) asked for a recipient:
+	// never, or any of success, failure and delay; none leaves it to the
+	// server.
+	enum class dsn_notify : std::uint8_t
+	{
+		none								=	0,
+		never								=	1 << 0,
+		success								=	1 << 1,
+		failure								=	1 << 2,
+		delay								=	1 << 3,
+	};
+	constexpr dsn_notify operator|(dsn_notify a, dsn_notify b)
+	{
+		return static_cast<dsn_notify>(static_cast<std::uint8_t>(a) | static_cast<std::uint8_t>(b));
+	}
+
+	// What a notification returns of the message; none leaves it to the
+	// server.
+	enum class dsn_return : std::uint8_t
+	{
+		none								=	0,
+		full								=	1,
+		headers								=	2,
+	};
+
+	namespace detail {
+		// Appends v as xtext (RFC 3461 4), the form DSN parameters are sent in.
+		inline void append_xtext(std::string& out, boost::beast::string_view v)
+		{
+			static constexpr char digits[] = "0123456789ABCDEF";
+			for (const auto ch : v) {
+				const auto c = static_cast<unsigned char>(ch);
+				if (c < 33 || c > 126 || c == '+' || c == '=') {
+					out += '+';
+					out += digits[c >> 4];
+					out += digits[c & 15];
+				}
+				else {
+					out += ch;
+				}
+			}
+		}
+		// The text v holds as xtext; a malformed "+HH" is kept as it is.
+		inline std::string decode_xtext(boost::beast::string_view v)
+		{
+			const auto hex = [](char c) {
+				return c >= '0' && c <= '9' ? c - '0' : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+			};
+			std::string out;
+			out.reserve(v.size());
+			for (std::size_t i = 0; i != v.size(); ++i) {
+				if (v[i] == '+' && v.size() - i > 2 && hex(v[i + 1]) >= 0 && hex(v[i + 2]) >= 0) {
+					out += static_cast<char>(hex(v[i + 1]) << 4 | hex(v[i + 2]));
+					i += 2;
+				}
+				else {
+					out += v[i];
+				}
+			}
+			return out;
+		}
+	}
+
+	// MAIL FROM and RCPT TO paths of one transaction, with the DSN
+	// parameters sent to servers which advertise DSN. Those of recipients
+	// take 8 bytes each, and only once one is set.
+	class envelope
+	{
+	public:
+		envelope() = default;
+		envelope(envelope&&) = default;
+		envelope(const envelope&) = default;
+		envelope& operator=(envelope&&) = default;
+		envelope& operator=(const envelope&) = default;
+
+		boost::beast::string_view from() const
+		{
+			return from_;
+		}
+		void from(boost::beast::string_view v)
+		{
+			from_.assign(v.data(), v.size());
+		}
+
+		const std::vector<std::string>& recipients() const
+		{
+			return to_;
+		}
+		void add_recipient(boost::beast::string_view v)
+		{
+			to_.emplace_back(v.data(), v.size());
+			if (!dsn_.empty()) {
+				dsn_.push_back({});
+			}
+		}
+		// orcpt is the address the recipient was originally given as,
+		// sent as ORCPT=rfc822;orcpt; none when empty.
+		void add_recipient(boost::beast::string_view v, dsn_notify notify,
+						   boost::beast::string_view orcpt = {})
+		{
+			dsn_.resize(to_.size());
+			to_.emplace_back(v.data(), v.size());
+			recipient_dsn r;
+			r.orcpt_offset = static_cast<std::uint32_t>(orcpt_.size());
+			detail::append_xtext(orcpt_, orcpt);
+			r.orcpt_size = static_cast<std::uint16_t>(orcpt_.size() - r.orcpt_offset);
+			r.notify = notify;
+			dsn_.push_back(r);
+		}
+		template <class Iterator>
+		void add_recipients(Iterator first, Iterator last)
+		{
+			for (; first != last; ++first) {
+				add_recipient(*first);
+			}
+		}
+
+		// NOTIFY of recipient n
+		dsn_notify notify(std::size_t n) const
+		{
+			return n < dsn_.size() ? dsn_[n].notify : dsn_notify::none;
+		}
+		// ORCPT of recipient n, as xtext; empty when none
+		boost::beast::string_view orcpt(std::size_t n) const
+		{
+			if (n >= dsn_.size()) {
+				return {};
+			}
+			return { orcpt_.data() + dsn_[n].orcpt_offset, dsn_[n].orcpt_size };
+		}
+
+		// whether any DSN parameter is set
+		bool has_dsn() const
+		{
+			return !dsn_.empty() || ret_ != dsn_return::none || !envid_.empty();
+		}
+
+		// RET of MAIL
+		dsn_return ret() const
+		{
+			return ret_;
+		}
+		void ret(dsn_return v)
+		{
+			ret_ = v;
+		}
+		// ENVID of MAIL, which notifications carry back; kept as xtext
+		boost::beast::string_view envid() const
+		{
+			return envid_;
+		}
+		void envid(boost::beast::string_view v)
+		{
+			envid_.clear();
+			detail::append_xtext(envid_, v);
+		}
+
+		void clear()
+		{
+			from_.clear();
+			to_.clear();
+			dsn_.clear();
+			orcpt_.clear();
+			envid_.clear();
+			ret_ = dsn_return::none;
+		}
+	private:
+		struct recipient_dsn
+		{
+			std::uint32_t orcpt_offset = 0;
+			std::uint16_t orcpt_size = 0;
+			dsn_notify notify = dsn_notify::none;
+		};
+
+		std::string from_;
+		std::vector<std::string> to_;
+		// by recipient once one has DSN parameters, ORCPT in orcpt_
+		std::vector<recipient_dsn> dsn_;
+		std::string orcpt_;
+		std::string envid_;
+		dsn_return ret_ = dsn_return::none;
+	};
+}
@@ -11,6 +11,14 @@ namespace mail::smtp {
 		buffer_overflow,
 
 		syntax_error,
+
+		line_too_long,
+
+		size_exceeded,
+
+		premature_reply,
+
+		binary_not_supported,
 	};
 }
 
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <boost/beast/core/string.hpp>
+#include <cstdint>
+#include <limits>
+
+namespace mail::smtp {
+	enum class extension : unsigned
+	{
+		pipelining							=	1u << 0,
+		size								=	1u << 1,
+		eightbitmime						=	1u << 2,
+		binarymime							=	1u << 3,
+		chunking							=	1u << 4,
+		smtputf8							=	1u << 5,
+		dsn									=	1u << 6,
+		enhancedstatuscodes					=	1u << 7,
+		starttls							=	1u << 8,
+		auth_login							=	1u << 9,
+	};
+
+	// EHLO keywords (RFC 5321 4.1.1.1), shared by the client which parses them
+	// and the server which advertises them.
+	class extensions
+	{
+	public:
+		extensions() = default;
+
+		bool has(extension ext) const
+		{
+			return (mask_ & static_cast<unsigned>(ext)) != 0;
+		}
+		void set(extension ext)
+		{
+			mask_ |= static_cast<unsigned>(ext);
+		}
+		void reset(extension ext)
+		{
+			mask_ &= ~static_cast<unsigned>(ext);
+		}
+		void clear()
+		{
+			mask_ = 0;
+			max_size_ = 0;
+		}
+
+		// SIZE parameter, 0 if none was advertised or no limit applies
+		std::uint64_t max_size() const
+		{
+			return max_size_;
+		}
+		void max_size(std::uint64_t v)
+		{
+			max_size_ = v;
+			set(extension::size);
+		}
+
+		// One line of a 250 EHLO reply, without the reply code.
+		void parse_line(boost::beast::string_view line)
+		{
+			const auto sp = line.find(' ');
+			const auto keyword = line.substr(0, sp);
+			const auto param = sp == boost::beast::string_view::npos
+				? boost::beast::string_view{}
+				: line.substr(sp + 1);
+
+			if (boost::beast::iequals(keyword, "PIPELINING")) {
+				set(extension::pipelining);
+			}
+			else if (boost::beast::iequals(keyword, "SIZE")) {
+				std::uint64_t n = 0;
+				for (const auto ch : param) {
+					if (ch < '0' || ch > '9' || n > (std::numeric_limits<std::uint64_t>::max)() / 10) {
+						break;
+					}
+					n = n * 10 + static_cast<unsigned>(ch - '0');
+				}
+				max_size(n);
+			}
+			else if (boost::beast::iequals(keyword, "8BITMIME")) {
+				set(extension::eightbitmime);
+			}
+			else if (boost::beast::iequals(keyword, "BINARYMIME")) {
+				set(extension::binarymime);
+			}
+			else if (boost::beast::iequals(keyword, "CHUNKING")) {
+				set(extension::chunking);
+			}
+			else if (boost::beast::iequals(keyword, "SMTPUTF8")) {
+				set(extension::smtputf8);
+			}
+			else if (boost::beast::iequals(keyword, "DSN")) {
+				set(extension::dsn);
+			}
+			else if (boost::beast::iequals(keyword, "ENHANCEDSTATUSCODES")) {
+				set(extension::enhancedstatuscodes);
+			}
+			else if (boost::beast::iequals(keyword, "STARTTLS")) {
+				set(extension::starttls);
+			}
+			else if (boost::beast::iequals(keyword, "AUTH")) {
+				for (auto rest = param; !rest.empty();) {
+					const auto n = rest.find(' ');
+					if (boost::beast::iequals(rest.substr(0, n), "LOGIN")) {
+						set(extension::auth_login);
+					}
+					rest = n == boost::beast::string_view::npos
+						? boost::beast::string_view{}
+						: rest.substr(n + 1);
+				}
+			}
+		}
+	private:
+		unsigned mask_ = 0;
+		std::uint64_t max_size_ = 0;
+	};
+}
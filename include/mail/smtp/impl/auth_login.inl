@@ -87,6 +87,8 @@ namespace mail::smtp {
 	{
 		auto& d = *d_;
 		BOOST_ASIO_CORO_REENTER(*this) {
+			d.s.probe_.start();
+			d.s.transcribe(detail::auth_login_buffer());
 			BOOST_ASIO_CORO_YIELD
 				boost::asio::async_write(d.s.s_, detail::auth_login_buffer(), std::move(*this));
 			if (ec) {
@@ -96,10 +98,12 @@ namespace mail::smtp {
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply();
 			if (d.s.resp_parser_.get().code() != reply_code::authentication_continue) {
 				ec = error::failed;
 				goto upcall;
 			}
+			d.s.transcribe_redacted();
 			BOOST_ASIO_CORO_YIELD
 				boost::asio::async_write(d.s.s_, boost::asio::buffer(d.b64_username), std::move(*this));
 			if (ec) {
@@ -109,10 +113,12 @@ namespace mail::smtp {
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply();
 			if (d.s.resp_parser_.get().code() != reply_code::authentication_continue) {
 				ec = error::failed;
 				goto upcall;
 			}
+			d.s.transcribe_redacted();
 			BOOST_ASIO_CORO_YIELD
 				boost::asio::async_write(d.s.s_, boost::asio::buffer(d.b64_password), std::move(*this));
 			if (ec) {
@@ -122,6 +128,7 @@ namespace mail::smtp {
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply(phase::auth);
 			if (d.s.resp_parser_.get().code() != reply_code::authentication_succeeded) {
 				ec = error::failed;
 				goto upcall;
@@ -151,6 +158,8 @@ namespace mail::smtp {
 		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
 					  "SyncStream requirements not met");
 
+		probe_.start();
+		transcribe(detail::auth_login_buffer());
 		boost::asio::write(s_, detail::auth_login_buffer(), ec);
 		if (ec) {
 			return;
@@ -159,12 +168,14 @@ namespace mail::smtp {
 		if (ec) {
 			return;
 		}
+		on_reply();
 		if (resp_parser_.get().code() != reply_code::authentication_continue) {
 			ec = error::failed;
 			return;
 		}
 		auto b64_username = detail::base64_encode(username);
 		b64_username += "\r\n";
+		transcribe_redacted();
 		boost::asio::write(s_, boost::asio::buffer(b64_username), ec);
 		if (ec) {
 			return;
@@ -173,12 +184,14 @@ namespace mail::smtp {
 		if (ec) {
 			return;
 		}
+		on_reply();
 		if (resp_parser_.get().code() != reply_code::authentication_continue) {
 			ec = error::failed;
 			return;
 		}
 		auto b64_password = detail::base64_encode(password);
 		b64_password += "\r\n";
+		transcribe_redacted();
 		boost::asio::write(s_, boost::asio::buffer(b64_password), ec);
 		if (ec) {
 			return;
@@ -187,6 +200,7 @@ namespace mail::smtp {
 		if (ec) {
 			return;
 		}
+		on_reply(phase::auth);
 		if (resp_parser_.get().code() != reply_code::authentication_succeeded) {
 			ec = error::failed;
 			return;
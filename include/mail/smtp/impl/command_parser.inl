@@ -0,0 +1,154 @@
+#pragma once
+
+#include "../command_parser.hpp"
+
+#include "../error.hpp"
+#include <boost/beast/core/string.hpp>
+#include <cstring>
+#include <limits>
+
+namespace mail::smtp {
+	namespace detail {
+		inline verb string_to_verb(boost::beast::string_view s)
+		{
+			using boost::beast::iequals;
+			switch (s.size()) {
+				case 4:
+					if (iequals(s, "MAIL")) return verb::mail;
+					if (iequals(s, "RCPT")) return verb::rcpt;
+					if (iequals(s, "DATA")) return verb::data;
+					if (iequals(s, "BDAT")) return verb::bdat;
+					if (iequals(s, "EHLO")) return verb::ehlo;
+					if (iequals(s, "HELO")) return verb::helo;
+					if (iequals(s, "RSET")) return verb::rset;
+					if (iequals(s, "NOOP")) return verb::noop;
+					if (iequals(s, "QUIT")) return verb::quit;
+					if (iequals(s, "VRFY")) return verb::vrfy;
+					if (iequals(s, "HELP")) return verb::help;
+					if (iequals(s, "AUTH")) return verb::auth;
+					break;
+				case 8:
+					if (iequals(s, "STARTTLS")) return verb::starttls;
+					break;
+			}
+			return verb::unknown;
+		}
+
+		// "FROM:<path> params" / "TO:<path> params"
+		inline bool parse_path_argument(boost::beast::string_view arg,
+										boost::beast::string_view prefix,
+										command& cmd)
+		{
+			if (arg.size() < prefix.size() ||
+				!boost::beast::iequals(arg.substr(0, prefix.size()), prefix)) {
+				return false;
+			}
+			arg.remove_prefix(prefix.size());
+			while (!arg.empty() && arg.front() == ' ') {
+				arg.remove_prefix(1);
+			}
+			if (arg.empty() || arg.front() != '<') {
+				return false;
+			}
+			const auto close = arg.find('>');
+			if (close == boost::beast::string_view::npos) {
+				return false;
+			}
+			auto params = arg.substr(close + 1);
+			if (!params.empty() && params.front() != ' ') {
+				return false;
+			}
+			while (!params.empty() && params.front() == ' ') {
+				params.remove_prefix(1);
+			}
+			cmd.path(arg.substr(1, close - 1), params);
+			return true;
+		}
+
+		// "chunk-size [LAST]"
+		inline bool parse_chunk_argument(boost::beast::string_view arg, command& cmd)
+		{
+			std::uint64_t n = 0;
+			std::size_t i = 0;
+			for (; i != arg.size() && arg[i] >= '0' && arg[i] <= '9'; ++i) {
+				if (n > ((std::numeric_limits<std::uint64_t>::max)() - 9) / 10) {
+					return false;
+				}
+				n = n * 10 + static_cast<unsigned>(arg[i] - '0');
+			}
+			if (i == 0) {
+				return false;
+			}
+			arg.remove_prefix(i);
+			if (arg.empty()) {
+				cmd.chunk(n, false);
+				return true;
+			}
+			if (arg.size() == 5 && boost::beast::iequals(arg, " LAST")) {
+				cmd.chunk(n, true);
+				return true;
+			}
+			return false;
+		}
+	}
+
+	inline std::size_t command_parser::put(boost::asio::const_buffer buffer, boost::beast::error_code& ec)
+	{
+		const auto p = static_cast<const char*>(buffer.data());
+		const auto size = buffer.size();
+
+		const auto lf = static_cast<const char*>(std::memchr(p, '\n', size));
+		if (!lf) {
+			if (skipping_ || size > max_line_length) {
+				skipping_ = true;
+				ec = error::need_more;
+				return size;
+			}
+			ec = error::need_more;
+			return 0;
+		}
+		const auto used = static_cast<std::size_t>(lf - p) + 1;
+		if (skipping_ || used > max_line_length + 2) {
+			skipping_ = false;
+			ec = error::line_too_long;
+			return used;
+		}
+		if (used < 2 || lf[-1] != '\r') {
+			ec = error::syntax_error;
+			return used;
+		}
+
+		cmd_.clear();
+		const boost::beast::string_view line{ p, used - 2 };
+		const auto sp = line.find(' ');
+		cmd_.verb(detail::string_to_verb(line.substr(0, sp)));
+		if (sp != boost::beast::string_view::npos) {
+			cmd_.argument(line.substr(sp + 1));
+		}
+
+		bool ok = true;
+		switch (cmd_.verb()) {
+			case verb::mail:
+				ok = detail::parse_path_argument(cmd_.argument(), "FROM:", cmd_);
+				break;
+			case verb::rcpt:
+				ok = detail::parse_path_argument(cmd_.argument(), "TO:", cmd_);
+				break;
+			case verb::bdat:
+				ok = detail::parse_chunk_argument(cmd_.argument(), cmd_);
+				break;
+			case verb::helo:
+			case verb::ehlo:
+				ok = !cmd_.argument().empty();
+				break;
+			default:
+				break;
+		}
+		if (!ok) {
+			ec = error::syntax_error;
+			return used;
+		}
+		ec.assign(0, ec.category());
+		return used;
+	}
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include "../delivery_engine.hpp"
+#include <boost/asio/post.hpp>
+#include <algorithm>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace mail::smtp {
+	template <class Job>
+	delivery_engine<Job>::shard::shard(delivery_engine& e, std::size_t index)
+		: e_(e)
+		, index_(index)
+		, victim_(index)
+	{
+	}
+
+	template <class Job>
+	void delivery_engine<Job>::shard::warm(const std::string& destination, bool v)
+	{
+		if (v) {
+			warm_.insert(destination);
+		}
+		else {
+			warm_.erase(destination);
+		}
+	}
+	template <class Job>
+	void delivery_engine<Job>::shard::done()
+	{
+		--in_flight_;
+		run_jobs();
+	}
+
+	template <class Job>
+	void delivery_engine<Job>::shard::submit(item&& i)
+	{
+		inbox_.push(std::move(i));
+		// one wake-up per batch of submissions, not one per job
+		if (!signaled_.exchange(true, std::memory_order_acq_rel)) {
+			boost::asio::post(ioc_, [this] { drain(); });
+		}
+	}
+	template <class Job>
+	void delivery_engine<Job>::shard::drain()
+	{
+		// cleared first: a push the loop misses posts another drain
+		signaled_.store(false, std::memory_order_release);
+		if (idle_.exchange(false, std::memory_order_relaxed)) {
+			e_.idle_.fetch_sub(1, std::memory_order_relaxed);
+		}
+		while (auto i = inbox_.pop()) {
+			queue_.push_back(std::move(*i));
+		}
+		run_jobs();
+	}
+	template <class Job>
+	void delivery_engine<Job>::shard::run_jobs()
+	{
+		// a handler calling done() right away continues the outer loop
+		if (running_) {
+			return;
+		}
+		running_ = true;
+		while (in_flight_ < e_.options_.max_in_flight && !queue_.empty()) {
+			auto i = std::move(queue_.front());
+			queue_.pop_front();
+			++in_flight_;
+			e_.handler_(*this, i.destination, std::move(i.job));
+		}
+		running_ = false;
+		if (!queue_.empty()) {
+			e_.wake(index_);
+		}
+		else if (in_flight_ < e_.options_.max_in_flight && !idle_.load(std::memory_order_relaxed)) {
+			steal((victim_ + 1) % e_.shards_.size());
+		}
+	}
+
+	template <class Job>
+	void delivery_engine<Job>::shard::steal(std::size_t from)
+	{
+		if (stealing_ || e_.shards_.size() < 2) {
+			return;
+		}
+		stealing_ = true;
+		victim_ = from == index_ ? (from + 1) % e_.shards_.size() : from;
+		steal_request r{ index_, { warm_.begin(), warm_.end() } };
+		auto& victim = *e_.shards_[victim_];
+		boost::asio::post(victim.ioc_, [&victim, r = std::move(r)]() mutable {
+			victim.give(std::move(r));
+		});
+	}
+	template <class Job>
+	void delivery_engine<Job>::shard::give(steal_request&& r)
+	{
+		auto& thief = *e_.shards_[r.thief];
+		const auto wanted = [&r](const item& i) {
+			return std::find(r.destinations.begin(), r.destinations.end(), i.destination) != r.destinations.end();
+		};
+		// half of the matching jobs, the rest stays with its warm sessions
+		// here; without any, half of the backlog
+		auto n = (static_cast<std::size_t>(std::count_if(queue_.begin(), queue_.end(), wanted)) + 1) / 2;
+		const auto found = !queue_.empty();
+		if (n == 0 && found) {
+			n = (queue_.size() + 1) / 2;
+			for (; n != 0; --n) {
+				thief.submit(std::move(queue_.back()));
+				queue_.pop_back();
+			}
+		}
+		else if (found) {
+			std::deque<item> keep;
+			for (auto& i : queue_) {
+				if (n != 0 && wanted(i)) {
+					thief.submit(std::move(i));
+					--n;
+				}
+				else {
+					keep.push_back(std::move(i));
+				}
+			}
+			queue_.swap(keep);
+		}
+		boost::asio::post(thief.ioc_, [&thief, found] {
+			thief.on_steal_reply(found);
+		});
+	}
+	template <class Job>
+	void delivery_engine<Job>::shard::on_steal_reply(bool found)
+	{
+		stealing_ = false;
+		if (found) {
+			tried_ = 0;
+			return;
+		}
+		if (++tried_ < e_.shards_.size() - 1) {
+			return steal((victim_ + 1) % e_.shards_.size());
+		}
+		// every shard asked, sleep until one has a backlog
+		tried_ = 0;
+		if (!queue_.empty()) {
+			return;
+		}
+		idle_.store(true, std::memory_order_relaxed);
+		e_.idle_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	template <class Job>
+	delivery_engine<Job>::delivery_engine(handler_type handler, const engine_options& options)
+		: handler_(std::move(handler))
+		, options_(options)
+	{
+		auto n = options_.shards;
+		if (n == 0) {
+			n = (std::max)(1u, std::thread::hardware_concurrency());
+		}
+		shards_.reserve(n);
+		for (std::size_t i = 0; i < n; ++i) {
+			shards_.emplace_back(new shard{ *this, i });
+		}
+		idle_.store(n, std::memory_order_relaxed);
+	}
+	template <class Job>
+	delivery_engine<Job>::~delivery_engine()
+	{
+		stop();
+	}
+
+	template <class Job>
+	void delivery_engine<Job>::start()
+	{
+		for (auto& s : shards_) {
+			work_.emplace_back(s->ioc_.get_executor());
+		}
+		for (auto& p : shards_) {
+			auto& s = *p;
+			s.thread_ = std::thread{ [&s] { s.ioc_.run(); } };
+#if defined(__linux__)
+			if (options_.pin_threads) {
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				CPU_SET(static_cast<int>(s.index_ % (std::max)(1u, std::thread::hardware_concurrency())), &set);
+				::pthread_setaffinity_np(s.thread_.native_handle(), sizeof(set), &set);
+			}
+#endif
+		}
+	}
+	template <class Job>
+	void delivery_engine<Job>::stop()
+	{
+		work_.clear();
+		for (auto& s : shards_) {
+			s->ioc_.stop();
+		}
+		for (auto& s : shards_) {
+			if (s->thread_.joinable()) {
+				s->thread_.join();
+			}
+		}
+	}
+
+	template <class Job>
+	void delivery_engine<Job>::wake(std::size_t victim)
+	{
+		if (idle_.load(std::memory_order_relaxed) == 0) {
+			return;
+		}
+		for (auto& p : shards_) {
+			auto& s = *p;
+			if (s.idle_.load(std::memory_order_relaxed) && s.idle_.exchange(false, std::memory_order_relaxed)) {
+				idle_.fetch_sub(1, std::memory_order_relaxed);
+				boost::asio::post(s.ioc_, [this, &s, victim] {
+					if (s.queue_.empty() && s.in_flight_ < options_.max_in_flight) {
+						s.steal(victim);
+					}
+				});
+				return;
+			}
+		}
+	}
+
+	template <class Job>
+	void delivery_engine<Job>::submit(boost::beast::string_view destination, Job job)
+	{
+		typename shard::item i{ std::string{ destination.data(), destination.size() }, std::move(job) };
+		const auto n = std::hash<std::string>{}(i.destination) % shards_.size();
+		shards_[n]->submit(std::move(i));
+	}
+}
@@ -29,6 +29,10 @@ namespace mail::smtp {
 					case error::need_more: return "need more";
 					case error::buffer_overflow: return "buffer overflow";
 					case error::syntax_error: return "syntax error";
+					case error::line_too_long: return "line too long";
+					case error::size_exceeded: return "size exceeded";
+					case error::premature_reply: return "premature reply";
+					case error::binary_not_supported: return "binary content not supported";
 
 					default:
 						return "mail.smtp error";
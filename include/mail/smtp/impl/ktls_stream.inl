@@ -0,0 +1,446 @@
+#pragma once
+
+#include "../ktls_stream.hpp"
+#include <boost/asio/ssl/error.hpp>
+#include <boost/beast/core/bind_handler.hpp>
+#include <boost/beast/core/handler_ptr.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/throw_exception.hpp>
+#include <cerrno>
+#include <limits>
+
+namespace mail::smtp {
+	namespace detail {
+		// what to call on the SSL, until it stops asking for I/O
+		struct ktls_handshake
+		{
+			static bool constexpr has_bytes = false;
+
+			int operator()(SSL* ssl, std::size_t&)
+			{
+				return SSL_do_handshake(ssl);
+			}
+		};
+		struct ktls_shutdown
+		{
+			static bool constexpr has_bytes = false;
+
+			int operator()(SSL* ssl, std::size_t&)
+			{
+				// 0: close_notify sent, the peer's is not waited for
+				const auto r = SSL_shutdown(ssl);
+				return r == 0 ? 1 : r;
+			}
+		};
+		template <class MutableBufferSequence>
+		struct ktls_read
+		{
+			static bool constexpr has_bytes = true;
+
+			MutableBufferSequence buffers;
+
+			int operator()(SSL* ssl, std::size_t& n)
+			{
+				for (auto it = boost::asio::buffer_sequence_begin(buffers);
+					 it != boost::asio::buffer_sequence_end(buffers); ++it) {
+					const boost::asio::mutable_buffer b = *it;
+					if (b.size() != 0) {
+						return SSL_read_ex(ssl, b.data(), b.size(), &n);
+					}
+				}
+				n = 0;
+				return 1;
+			}
+		};
+		template <class ConstBufferSequence>
+		struct ktls_write
+		{
+			static bool constexpr has_bytes = true;
+
+			ConstBufferSequence buffers;
+
+			int operator()(SSL* ssl, std::size_t& n)
+			{
+				for (auto it = boost::asio::buffer_sequence_begin(buffers);
+					 it != boost::asio::buffer_sequence_end(buffers); ++it) {
+					const boost::asio::const_buffer b = *it;
+					if (b.size() != 0) {
+						return SSL_write_ex(ssl, b.data(), b.size(), &n);
+					}
+				}
+				n = 0;
+				return 1;
+			}
+		};
+		struct ktls_sendfile
+		{
+			static bool constexpr has_bytes = true;
+
+			int fd;
+			std::uint64_t offset;
+			std::size_t size;
+
+			int operator()(SSL* ssl, std::size_t& n)
+			{
+				n = 0;
+				if (size == 0) {
+					return 1;
+				}
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+				const auto r = SSL_sendfile(ssl, fd, static_cast<off_t>(offset),
+					(std::min)(size, std::size_t{ 1 } << 30), 0);
+				if (r < 0) {
+					return -1;
+				}
+				n = static_cast<std::size_t>(r);
+				return 1;
+#else
+				(void)ssl;
+				errno = ENOTSUP;
+				return -1;
+#endif
+			}
+		};
+
+		inline boost::beast::error_code ktls_error(int e)
+		{
+			switch (e) {
+				case SSL_ERROR_ZERO_RETURN:
+					return boost::asio::error::eof;
+				case SSL_ERROR_SYSCALL: {
+					const auto err = ERR_get_error();
+					if (err != 0) {
+						return { static_cast<int>(err), boost::asio::error::get_ssl_category() };
+					}
+					if (errno != 0) {
+						return { errno, boost::system::system_category() };
+					}
+					return boost::asio::ssl::error::stream_truncated;
+				}
+				default:
+					return { static_cast<int>(ERR_get_error()), boost::asio::error::get_ssl_category() };
+			}
+		}
+	}
+
+	template <class Operation, class Handler>
+	class ktls_stream::io_op
+		: public boost::asio::coroutine {
+	private:
+		struct data
+		{
+			ktls_stream& s;
+			Operation op;
+			std::size_t bytes = 0;
+			int wait = 0;
+			bool io = false;
+
+			data(const Handler&, ktls_stream& s_, Operation&& op_)
+				: s(s_)
+				, op(std::move(op_))
+			{
+			}
+		};
+		boost::beast::handler_ptr<data, Handler> d_;
+	public:
+		io_op(io_op&&) = default;
+		io_op(const io_op&) = delete;
+
+		template <class DeducedHandler, class... Args>
+		io_op(DeducedHandler&& h,
+			  ktls_stream& s, Args&&... args)
+			: d_(std::forward<DeducedHandler>(h),
+				 s, std::forward<Args>(args)...)
+		{
+		}
+
+		using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+		allocator_type get_allocator() const noexcept
+		{
+			return boost::asio::get_associated_allocator(d_.handler());
+		}
+
+		using executor_type = boost::asio::associated_executor_t<
+			Handler, decltype(std::declval<ktls_stream&>().get_executor())>;
+
+		executor_type get_executor() const noexcept
+		{
+			return boost::asio::get_associated_executor(d_.handler(), d_->s.get_executor());
+		}
+
+		void operator()(boost::beast::error_code ec = {}, std::size_t bytes = 0)
+		{
+			auto& d = *d_;
+			BOOST_ASIO_CORO_REENTER(*this) {
+				while ((d.wait = d.s.step(d.op, d.bytes, ec)) != 0) {
+					d.io = true;
+					BOOST_ASIO_CORO_YIELD
+						d.s.next_layer_.async_wait(
+							static_cast<boost::asio::socket_base::wait_type>(d.wait - 1), std::move(*this));
+					if (ec) {
+						break;
+					}
+				}
+				if (!d.io) {
+					BOOST_ASIO_CORO_YIELD
+						boost::asio::post(d.s.get_executor(), boost::beast::bind_handler(std::move(*this), ec, 0));
+				}
+				if constexpr (Operation::has_bytes) {
+					// the state is gone when the handler runs
+					const auto n = d.bytes;
+					d_.invoke(ec, n);
+				}
+				else {
+					d_.invoke(ec);
+				}
+			}
+		}
+
+		friend bool asio_handler_is_continuation(io_op* op)
+		{
+			using boost::asio::asio_handler_is_continuation;
+			return asio_handler_is_continuation(std::addressof(op->d_.handler()));
+		}
+	};
+
+	template <class Arg>
+	ktls_stream::ktls_stream(Arg&& arg, boost::asio::ssl::context& ctx)
+		: next_layer_(std::forward<Arg>(arg))
+		, ssl_(SSL_new(ctx.native_handle()))
+	{
+		if (ssl_ == nullptr) {
+			const boost::beast::error_code ec{ static_cast<int>(ERR_get_error()), boost::asio::error::get_ssl_category() };
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+		}
+		SSL_set_mode(ssl_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#if defined(SSL_OP_ENABLE_KTLS)
+		SSL_set_options(ssl_, SSL_OP_ENABLE_KTLS);
+#endif
+	}
+	inline ktls_stream::ktls_stream(ktls_stream&& other) noexcept
+		: next_layer_(std::move(other.next_layer_))
+		, ssl_(other.ssl_)
+	{
+		other.ssl_ = nullptr;
+	}
+	inline ktls_stream::~ktls_stream()
+	{
+		if (ssl_ != nullptr) {
+			SSL_free(ssl_);
+		}
+	}
+
+	inline bool ktls_stream::ktls_send() const
+	{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+		const auto b = SSL_get_wbio(ssl_);
+		return b != nullptr && BIO_get_ktls_send(b);
+#else
+		return false;
+#endif
+	}
+	inline bool ktls_stream::ktls_recv() const
+	{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+		const auto b = SSL_get_rbio(ssl_);
+		return b != nullptr && BIO_get_ktls_recv(b);
+#else
+		return false;
+#endif
+	}
+
+	inline void ktls_stream::start(handshake_type type, boost::beast::error_code& ec)
+	{
+		// non-blocking for OpenSSL only, asio's own operations still block
+		next_layer_.native_non_blocking(true, ec);
+		if (ec) {
+			return;
+		}
+		if (SSL_set_fd(ssl_, static_cast<int>(next_layer_.native_handle())) != 1) {
+			ec = { static_cast<int>(ERR_get_error()), boost::asio::error::get_ssl_category() };
+			return;
+		}
+		if (type == client) {
+			SSL_set_connect_state(ssl_);
+		}
+		else {
+			SSL_set_accept_state(ssl_);
+		}
+	}
+	template <class Operation>
+	int ktls_stream::step(Operation& op, std::size_t& bytes, boost::beast::error_code& ec)
+	{
+		ERR_clear_error();
+		errno = 0;
+		const auto r = op(ssl_, bytes);
+		if (r > 0) {
+			ec.assign(0, ec.category());
+			return 0;
+		}
+		const auto e = SSL_get_error(ssl_, r);
+		if (e == SSL_ERROR_WANT_READ) {
+			return boost::asio::socket_base::wait_read + 1;
+		}
+		if (e == SSL_ERROR_WANT_WRITE) {
+			return boost::asio::socket_base::wait_write + 1;
+		}
+		ec = detail::ktls_error(e);
+		return 0;
+	}
+	template <class Operation>
+	std::size_t ktls_stream::run(Operation op, boost::beast::error_code& ec)
+	{
+		std::size_t bytes = 0;
+		int wait;
+		while ((wait = step(op, bytes, ec)) != 0) {
+			next_layer_.wait(static_cast<boost::asio::socket_base::wait_type>(wait - 1), ec);
+			if (ec) {
+				return 0;
+			}
+		}
+		return bytes;
+	}
+	template <class Operation, class Handler>
+	void ktls_stream::async_run(Operation&& op, Handler&& handler)
+	{
+		io_op<std::decay_t<Operation>, std::decay_t<Handler>>{
+			std::forward<Handler>(handler),
+			*this,
+			std::forward<Operation>(op)
+		}();
+	}
+
+	inline void ktls_stream::handshake(handshake_type type)
+	{
+		boost::beast::error_code ec;
+		handshake(type, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	inline void ktls_stream::handshake(handshake_type type, boost::beast::error_code& ec)
+	{
+		start(type, ec);
+		if (ec) {
+			return;
+		}
+		run(detail::ktls_handshake{}, ec);
+	}
+	template <class HandshakeHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		HandshakeHandler, void(boost::beast::error_code)
+	) ktls_stream::async_handshake(handshake_type type, HandshakeHandler&& handler)
+	{
+		boost::asio::async_completion<
+			HandshakeHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		boost::beast::error_code ec;
+		start(type, ec);
+		if (ec) {
+			boost::asio::post(get_executor(), boost::beast::bind_handler(std::move(init.completion_handler), ec));
+		}
+		else {
+			async_run(detail::ktls_handshake{}, std::move(init.completion_handler));
+		}
+
+		return init.result.get();
+	}
+
+	inline void ktls_stream::shutdown(boost::beast::error_code& ec)
+	{
+		run(detail::ktls_shutdown{}, ec);
+	}
+	template <class ShutdownHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		ShutdownHandler, void(boost::beast::error_code)
+	) ktls_stream::async_shutdown(ShutdownHandler&& handler)
+	{
+		boost::asio::async_completion<
+			ShutdownHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		async_run(detail::ktls_shutdown{}, std::move(init.completion_handler));
+
+		return init.result.get();
+	}
+
+	template <class MutableBufferSequence>
+	std::size_t ktls_stream::read_some(const MutableBufferSequence& buffers)
+	{
+		boost::beast::error_code ec;
+		const auto n = read_some(buffers, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+		return n;
+	}
+	template <class MutableBufferSequence>
+	std::size_t ktls_stream::read_some(const MutableBufferSequence& buffers, boost::beast::error_code& ec)
+	{
+		return run(detail::ktls_read<MutableBufferSequence>{ buffers }, ec);
+	}
+	template <class MutableBufferSequence, class ReadHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		ReadHandler, void(boost::beast::error_code, std::size_t)
+	) ktls_stream::async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler)
+	{
+		boost::asio::async_completion<
+			ReadHandler,
+			void(boost::beast::error_code, std::size_t)> init{ handler };
+
+		async_run(detail::ktls_read<MutableBufferSequence>{ buffers }, std::move(init.completion_handler));
+
+		return init.result.get();
+	}
+
+	template <class ConstBufferSequence>
+	std::size_t ktls_stream::write_some(const ConstBufferSequence& buffers)
+	{
+		boost::beast::error_code ec;
+		const auto n = write_some(buffers, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+		return n;
+	}
+	template <class ConstBufferSequence>
+	std::size_t ktls_stream::write_some(const ConstBufferSequence& buffers, boost::beast::error_code& ec)
+	{
+		return run(detail::ktls_write<ConstBufferSequence>{ buffers }, ec);
+	}
+	template <class ConstBufferSequence, class WriteHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		WriteHandler, void(boost::beast::error_code, std::size_t)
+	) ktls_stream::async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+	{
+		boost::asio::async_completion<
+			WriteHandler,
+			void(boost::beast::error_code, std::size_t)> init{ handler };
+
+		async_run(detail::ktls_write<ConstBufferSequence>{ buffers }, std::move(init.completion_handler));
+
+		return init.result.get();
+	}
+
+	inline std::size_t ktls_stream::sendfile(int fd, std::uint64_t offset, std::size_t n, boost::beast::error_code& ec)
+	{
+		return run(detail::ktls_sendfile{ fd, offset, n }, ec);
+	}
+	template <class WriteHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		WriteHandler, void(boost::beast::error_code, std::size_t)
+	) ktls_stream::async_sendfile(int fd, std::uint64_t offset, std::size_t n, WriteHandler&& handler)
+	{
+		boost::asio::async_completion<
+			WriteHandler,
+			void(boost::beast::error_code, std::size_t)> init{ handler };
+
+		async_run(detail::ktls_sendfile{ fd, offset, n }, std::move(init.completion_handler));
+
+		return init.result.get();
+	}
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "../metrics.hpp"
+#include <algorithm>
+
+namespace mail::smtp {
+	namespace detail {
+		inline unsigned log2_floor(std::uint64_t v)
+		{
+			unsigned e = 0;
+			for (unsigned s = 32; s != 0; s >>= 1) {
+				if ((v >> s) != 0) {
+					v >>= s;
+					e += s;
+				}
+			}
+			return e;
+		}
+
+		// single writer, so a load and a store instead of a locked add
+		inline void bump(std::atomic<std::uint64_t>& a, std::uint64_t n)
+		{
+			a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		inline std::uint64_t next_metrics_id()
+		{
+			static std::atomic<std::uint64_t> id{ 0 };
+			return ++id;
+		}
+	}
+
+	inline std::size_t histogram::bucket(std::uint64_t v)
+	{
+		std::uint64_t constexpr sub = std::uint64_t{ 1 } << sub_bucket_bits;
+		if (v < sub) {
+			return static_cast<std::size_t>(v);
+		}
+		const auto e = detail::log2_floor(v);
+		if (e > max_exponent) {
+			return bucket_count - 1;
+		}
+		return (std::size_t{ e - sub_bucket_bits + 1 } << sub_bucket_bits) +
+			static_cast<std::size_t>((v >> (e - sub_bucket_bits)) - sub);
+	}
+	inline std::uint64_t histogram::highest_equivalent(std::size_t i)
+	{
+		std::uint64_t constexpr sub = std::uint64_t{ 1 } << sub_bucket_bits;
+		if (i < sub) {
+			return i;
+		}
+		const auto shift = static_cast<unsigned>(i >> sub_bucket_bits) - 1;
+		const auto m = (i & (sub - 1)) + sub;
+		return ((m + 1) << shift) - 1;
+	}
+	inline void histogram::record(std::uint64_t v, std::uint64_t n)
+	{
+		counts_[bucket(v)] += n;
+		count_ += n;
+		sum_ += v * n;
+		min_ = (std::min)(min_, v);
+		max_ = (std::max)(max_, v);
+	}
+	inline void histogram::merge(const histogram& other)
+	{
+		for (std::size_t i = 0; i < bucket_count; ++i) {
+			counts_[i] += other.counts_[i];
+		}
+		count_ += other.count_;
+		sum_ += other.sum_;
+		min_ = (std::min)(min_, other.min_);
+		max_ = (std::max)(max_, other.max_);
+	}
+	inline std::uint64_t histogram::value_at(double q) const
+	{
+		if (count_ == 0) {
+			return 0;
+		}
+		q = (std::min)((std::max)(q, 0.0), 1.0);
+		const auto rank = (std::max)(std::uint64_t{ 1 },
+			static_cast<std::uint64_t>(q * static_cast<double>(count_) + 0.5));
+		std::uint64_t seen = 0;
+		for (std::size_t i = 0; i < bucket_count; ++i) {
+			seen += counts_[i];
+			if (seen >= rank) {
+				return (std::min)(highest_equivalent(i), max_);
+			}
+		}
+		return max_;
+	}
+
+	namespace detail {
+		inline void atomic_histogram::record(std::uint64_t v)
+		{
+			bump(counts[histogram::bucket(v)], 1);
+			bump(count, 1);
+			bump(sum, v);
+			if (v < min.load(std::memory_order_relaxed)) {
+				min.store(v, std::memory_order_relaxed);
+			}
+			if (v > max.load(std::memory_order_relaxed)) {
+				max.store(v, std::memory_order_relaxed);
+			}
+		}
+		inline void atomic_histogram::load(histogram& h) const
+		{
+			for (std::size_t i = 0; i < histogram::bucket_count; ++i) {
+				h.counts_[i] = counts[i].load(std::memory_order_relaxed);
+			}
+			h.count_ = count.load(std::memory_order_relaxed);
+			h.sum_ = sum.load(std::memory_order_relaxed);
+			h.min_ = min.load(std::memory_order_relaxed);
+			h.max_ = max.load(std::memory_order_relaxed);
+		}
+	}
+
+	inline metrics::metrics()
+		: id_(detail::next_metrics_id())
+	{
+	}
+	inline metrics::local& metrics::get()
+	{
+		// the last instance this thread used; ids are never reused, so a
+		// new instance at the address of a destroyed one does not match
+		struct cache
+		{
+			std::uint64_t id = 0;
+			local* l = nullptr;
+		};
+		static thread_local cache c;
+		if (c.id == id_) {
+			return *c.l;
+		}
+		std::lock_guard<std::mutex> lock{ m_ };
+		const auto thread = std::this_thread::get_id();
+		local* l = nullptr;
+		for (auto& p : locals_) {
+			if (p->thread == thread) {
+				l = p.get();
+				break;
+			}
+		}
+		if (l == nullptr) {
+			locals_.emplace_back(new local);
+			l = locals_.back().get();
+			l->thread = thread;
+		}
+		c.id = id_;
+		c.l = l;
+		return *l;
+	}
+	inline void metrics::record(phase p, clock::duration d)
+	{
+		const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+		get().phases[static_cast<std::size_t>(p)].record(ns > 0 ? static_cast<std::uint64_t>(ns) : 0);
+	}
+	inline void metrics::count_reply(reply_code code)
+	{
+		auto& l = get();
+		const auto i = static_cast<std::size_t>(code);
+		detail::bump(l.replies[i < l.replies.size() ? i : 0], 1);
+	}
+	inline void metrics::count_body_bytes(std::size_t n)
+	{
+		detail::bump(get().body_bytes, n);
+	}
+	inline metrics_snapshot metrics::snapshot() const
+	{
+		metrics_snapshot r;
+		histogram h;
+		std::lock_guard<std::mutex> lock{ m_ };
+		for (const auto& l : locals_) {
+			for (std::size_t i = 0; i < phase_count; ++i) {
+				l->phases[i].load(h);
+				r.phases[i].merge(h);
+			}
+			for (std::size_t i = 0; i < r.replies.size(); ++i) {
+				r.replies[i] += l->replies[i].load(std::memory_order_relaxed);
+			}
+			r.body_bytes += l->body_bytes.load(std::memory_order_relaxed);
+		}
+		return r;
+	}
+}
@@ -73,6 +73,7 @@ namespace mail::smtp {
 	{
 		auto& d = *d_;
 		BOOST_ASIO_CORO_REENTER(*this) {
+			d.s.transcribe(detail::noop_buffer());
 			BOOST_ASIO_CORO_YIELD
 				boost::asio::async_write(d.s.s_, detail::noop_buffer(), std::move(*this));
 			if (ec) {
@@ -82,6 +83,7 @@ namespace mail::smtp {
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply();
 			if (d.s.resp_parser_.get().code() != reply_code::completed) {
 				ec = error::failed;
 				goto upcall;
@@ -108,6 +110,7 @@ namespace mail::smtp {
 		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
 					  "SyncStream requirements not met");
 
+		transcribe(detail::noop_buffer());
 		boost::asio::write(s_, detail::noop_buffer(), ec);
 		if (ec) {
 			return;
@@ -116,6 +119,7 @@ namespace mail::smtp {
 		if (ec) {
 			return;
 		}
+		on_reply();
 		if (resp_parser_.get().code() != reply_code::completed) {
 			ec = error::failed;
 			return;
@@ -134,7 +138,7 @@ namespace mail::smtp {
 			NoopHandler,
 			void(boost::beast::error_code)> init{ handler };
 
-		async_noop<
+		noop_op<
 			BOOST_ASIO_HANDLER_TYPE(
 				NoopHandler,
 				void(boost::beast::error_code)
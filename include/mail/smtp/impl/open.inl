@@ -100,14 +100,18 @@ namespace mail::smtp {
 	{
 		auto& d = *d_;
 		BOOST_ASIO_CORO_REENTER(*this) {
+			d.s.probe_.start();
 			BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply(phase::banner);
 			if (d.s.resp_parser_.get().code() != reply_code::service_ready) {
 				ec = error::failed;
 				goto upcall;
 			}
+			d.s.probe_.start();
+			d.s.transcribe(detail::ehlo_buffer(d.domain));
 			BOOST_ASIO_CORO_YIELD
 				boost::asio::async_write(d.s.s_, detail::ehlo_buffer(d.domain), std::move(*this));
 			if (ec) {
@@ -117,12 +121,15 @@ namespace mail::smtp {
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply(phase::ehlo);
 			if (d.s.resp_parser_.get().code() != reply_code::completed) {
 				if (d.s.resp_parser_.get().code() != reply_code::command_unrecognized &&
 					d.s.resp_parser_.get().code() != reply_code::command_not_implemented) {
 					ec = error::failed;
 					goto upcall;
 				}
+				d.s.probe_.start();
+				d.s.transcribe(detail::helo_buffer(d.domain));
 				BOOST_ASIO_CORO_YIELD
 					boost::asio::async_write(d.s.s_, detail::helo_buffer(d.domain), std::move(*this));
 				if (ec) {
@@ -132,12 +139,13 @@ namespace mail::smtp {
 				if (ec) {
 					goto upcall;
 				}
+				d.s.on_reply(phase::ehlo);
 				if (d.s.resp_parser_.get().code() != reply_code::completed) {
 					ec = error::failed;
 					goto upcall;
 				}
 			}
-			//// parse response lines
+			d.s.parse_capabilities();
 		upcall:
 			d_.invoke(ec);
 		}
@@ -207,14 +215,18 @@ namespace mail::smtp {
 	{
 		auto& d = *d_;
 		BOOST_ASIO_CORO_REENTER(*this) {
+			d.s.probe_.start();
 			BOOST_ASIO_CORO_YIELD async_read_response(d.s.s_.next_layer(), d.s.rd_buf_, d.s.resp_parser_, std::move(*this));
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply(phase::banner);
 			if (d.s.resp_parser_.get().code() != reply_code::service_ready) {
 				ec = error::failed;
 				goto upcall;
 			}
+			d.s.probe_.start();
+			d.s.transcribe(detail::ehlo_buffer(d.domain));
 			BOOST_ASIO_CORO_YIELD
 				boost::asio::async_write(d.s.s_.next_layer(), detail::ehlo_buffer(d.domain), std::move(*this));
 			if (ec) {
@@ -224,12 +236,16 @@ namespace mail::smtp {
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply(phase::ehlo);
 			if (d.s.resp_parser_.get().code() != reply_code::completed) {
 				ec = error::failed;
 				goto upcall;
 			}
-			//// parse response lines
+			d.s.parse_capabilities();
 
+			// STARTTLS and the handshake
+			d.s.probe_.start();
+			d.s.transcribe(detail::starttls_buffer());
 			BOOST_ASIO_CORO_YIELD
 				boost::asio::async_write(d.s.s_.next_layer(), detail::starttls_buffer(), std::move(*this));
 			if (ec) {
@@ -239,6 +255,7 @@ namespace mail::smtp {
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply();
 			if (d.s.resp_parser_.get().code() != reply_code::service_ready) {
 				ec = error::failed;
 				goto upcall;
@@ -248,7 +265,10 @@ namespace mail::smtp {
 			if (ec) {
 				goto upcall;
 			}
+			d.s.probe_.stop(phase::starttls);
 
+			d.s.probe_.start();
+			d.s.transcribe(detail::ehlo_buffer(d.domain));
 			BOOST_ASIO_CORO_YIELD
 				boost::asio::async_write(d.s.s_, detail::ehlo_buffer(d.domain), std::move(*this));
 			if (ec) {
@@ -258,11 +278,12 @@ namespace mail::smtp {
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply(phase::ehlo);
 			if (d.s.resp_parser_.get().code() != reply_code::completed) {
 				ec = error::failed;
 				goto upcall;
 			}
-			//// parse response lines
+			d.s.parse_capabilities();
 		upcall:
 			d_.invoke(ec);
 		}
@@ -301,14 +322,18 @@ namespace mail::smtp {
 		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
 					  "SyncStream requirements not met");
 
+		probe_.start();
 		read_resp(ec);
 		if (ec) {
 			return;
 		}
+		on_reply(phase::banner);
 		if (resp_parser_.get().code() != reply_code::service_ready) {
 			ec = error::failed;
 			return;
 		}
+		probe_.start();
+		transcribe(detail::ehlo_buffer(domain));
 		boost::asio::write(s_, detail::ehlo_buffer(domain), ec);
 		if (ec) {
 			return;
@@ -317,12 +342,15 @@ namespace mail::smtp {
 		if (ec) {
 			return;
 		}
+		on_reply(phase::ehlo);
 		if (resp_parser_.get().code() != reply_code::completed) {
 			if (resp_parser_.get().code() != reply_code::command_unrecognized &&
 				resp_parser_.get().code() != reply_code::command_not_implemented) {
 				ec = error::failed;
 				return;
 			}
+			probe_.start();
+			transcribe(detail::helo_buffer(domain));
 			boost::asio::write(s_, detail::helo_buffer(domain), ec);
 			if (ec) {
 				return;
@@ -331,12 +359,13 @@ namespace mail::smtp {
 			if (ec) {
 				return;
 			}
+			on_reply(phase::ehlo);
 			if (resp_parser_.get().code() != reply_code::completed) {
 				ec = error::failed;
 				return;
 			}
 		}
-		//// parse response lines
+		parse_capabilities();
 	}
 	template<class Stream>
 	template <class OpenHandler>
@@ -409,14 +438,18 @@ namespace mail::smtp {
 		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
 					  "SyncStream requirements not met");
 
+		probe_.start();
 		read_response(s_.next_layer(), rd_buf_, resp_parser_, ec);
 		if (ec) {
 			return;
 		}
+		on_reply(phase::banner);
 		if (resp_parser_.get().code() != reply_code::service_ready) {
 			ec = error::failed;
 			return;
 		}
+		probe_.start();
+		transcribe(detail::ehlo_buffer(domain));
 		boost::asio::write(s_.next_layer(), detail::ehlo_buffer(domain), ec);
 		if (ec) {
 			return;
@@ -425,12 +458,16 @@ namespace mail::smtp {
 		if (ec) {
 			return;
 		}
+		on_reply(phase::ehlo);
 		if (resp_parser_.get().code() != reply_code::completed) {
 			ec = error::failed;
 			return;
 		}
-		//// parse response lines
+		parse_capabilities();
 
+		// STARTTLS and the handshake
+		probe_.start();
+		transcribe(detail::starttls_buffer());
 		boost::asio::write(s_.next_layer(), detail::starttls_buffer(), ec);
 		if (ec) {
 			return;
@@ -439,6 +476,7 @@ namespace mail::smtp {
 		if (ec) {
 			return;
 		}
+		on_reply();
 		if (resp_parser_.get().code() != reply_code::service_ready) {
 			ec = error::failed;
 			return;
@@ -448,7 +486,10 @@ namespace mail::smtp {
 		if (ec) {
 			return;
 		}
+		probe_.stop(phase::starttls);
 
+		probe_.start();
+		transcribe(detail::ehlo_buffer(domain));
 		boost::asio::write(s_, detail::ehlo_buffer(domain), ec);
 		if (ec) {
 			return;
@@ -457,11 +498,12 @@ namespace mail::smtp {
 		if (ec) {
 			return;
 		}
+		on_reply(phase::ehlo);
 		if (resp_parser_.get().code() != reply_code::completed) {
 			ec = error::failed;
 			return;
 		}
-		//// parse response lines
+		parse_capabilities();
 	}
 
 	template<class Stream>
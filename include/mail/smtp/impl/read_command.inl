@@ -0,0 +1,182 @@
+#pragma once
+
+#include "../server_session.hpp"
+#include <boost/beast/core/bind_handler.hpp>
+#include <boost/beast/core/handler_ptr.hpp>
+#include <boost/beast/core/type_traits.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+
+namespace mail::smtp {
+	template <class Stream>
+	template <class Handler>
+	class server_session<Stream>::read_command_op
+		: public boost::asio::coroutine {
+	private:
+		struct data
+		{
+			server_session<Stream>& s;
+			bool io = false;
+
+			data(const Handler&, server_session<Stream>& s_)
+				: s(s_)
+			{
+			}
+		};
+		boost::beast::handler_ptr<data, Handler> d_;
+	public:
+		read_command_op(read_command_op&&) = default;
+		read_command_op(const read_command_op&) = delete;
+
+		template <class DeducedHandler, class... Args>
+		read_command_op(DeducedHandler&& h,
+						server_session<Stream>& s, Args&&... args)
+			: d_(std::forward<DeducedHandler>(h),
+				 s, std::forward<Args>(args)...)
+		{
+		}
+
+		using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+		allocator_type get_allocator() const noexcept
+		{
+			return boost::asio::get_associated_allocator(d_.handler());
+		}
+
+		using executor_type = boost::asio::associated_executor_t<
+			Handler, decltype(std::declval<server_session<Stream>&>().get_executor())>;
+
+		executor_type get_executor() const noexcept
+		{
+			return boost::asio::get_associated_executor(d_.handler(), d_->s.get_executor());
+		}
+
+		void operator()(boost::beast::error_code ec = {}, std::size_t bytes = 0);
+
+		friend bool asio_handler_is_continuation(read_command_op* op)
+		{
+			using boost::asio::asio_handler_is_continuation;
+			return op->d_->io ||
+				asio_handler_is_continuation(std::addressof(op->d_.handler()));
+		}
+	};
+	template <class Stream>
+	template <class Handler>
+	void server_session<Stream>::read_command_op<Handler>::operator()(boost::beast::error_code ec, std::size_t bytes)
+	{
+		auto& d = *d_;
+		BOOST_ASIO_CORO_REENTER(*this) {
+			d.s.consume_command();
+			while (true) {
+				d.s.cmd_size_ = d.s.cmd_parser_.put(d.s.rd_buf_.data(), ec);
+				if (ec != error::need_more) {
+					break;
+				}
+				// the part of a line too long seen so far
+				d.s.consume_command();
+				if (d.s.wr_buf_.size() != 0) {
+					// about to block, send the replies held back for pipelining
+					d.io = true;
+					BOOST_ASIO_CORO_YIELD
+						boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+					if (ec) {
+						goto upcall;
+					}
+					d.s.wr_buf_.consume(bytes);
+				}
+				if (d.s.rd_buf_.size() == d.s.rd_buf_.capacity()) {
+					ec = error::buffer_overflow;
+					break;
+				}
+				d.io = true;
+				BOOST_ASIO_CORO_YIELD
+					d.s.s_.async_read_some(
+						d.s.rd_buf_.prepare(d.s.rd_buf_.capacity() - d.s.rd_buf_.size()),
+						std::move(*this));
+				if (ec) {
+					goto upcall;
+				}
+				d.s.rd_buf_.commit(bytes);
+			}
+			if (!d.io) {
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::post(d.s.get_executor(), boost::beast::bind_handler(std::move(*this), ec, 0));
+			}
+		upcall:
+			d_.invoke(ec);
+		}
+	}
+
+	template <class Stream>
+	void server_session<Stream>::read_command()
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		read_command(ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	void server_session<Stream>::read_command(boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		consume_command();
+		while (true) {
+			cmd_size_ = cmd_parser_.put(rd_buf_.data(), ec);
+			if (ec != error::need_more) {
+				return;
+			}
+			// the part of a line too long seen so far
+			consume_command();
+			if (wr_buf_.size() != 0) {
+				const auto n = boost::asio::write(s_, wr_buf_.data(), ec);
+				wr_buf_.consume(n);
+				if (ec) {
+					return;
+				}
+			}
+			if (rd_buf_.size() == rd_buf_.capacity()) {
+				ec = error::buffer_overflow;
+				return;
+			}
+			const auto n = s_.read_some(rd_buf_.prepare(rd_buf_.capacity() - rd_buf_.size()), ec);
+			if (ec) {
+				return;
+			}
+			rd_buf_.commit(n);
+		}
+	}
+	template <class Stream>
+	template <class ReadHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		ReadHandler, void(boost::beast::error_code)
+	) server_session<Stream>::async_read_command(ReadHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			ReadHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		read_command_op<
+			BOOST_ASIO_HANDLER_TYPE(
+				ReadHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this
+		}();
+
+		return init.result.get();
+	}
+}
@@ -0,0 +1,534 @@
+#pragma once
+
+#include "../server_session.hpp"
+#include <boost/beast/core/bind_handler.hpp>
+#include <boost/beast/core/buffers_cat.hpp>
+#include <boost/beast/core/handler_ptr.hpp>
+#include <boost/beast/core/type_traits.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/optional/optional.hpp>
+
+namespace mail::smtp {
+	namespace detail {
+		inline auto start_mail_input_buffer()
+		{
+			return boost::asio::const_buffer{ "354 End data with <CR><LF>.<CR><LF>\r\n", 37 };
+		}
+
+		template <class BodyReader>
+		void put_body(BodyReader& reader, boost::asio::const_buffer b, boost::beast::error_code& ec)
+		{
+			while (b.size() != 0) {
+				const auto n = reader.put(b, ec);
+				if (ec) {
+					return;
+				}
+				if (n == 0) {
+					ec = error::buffer_overflow;
+					return;
+				}
+				b += n;
+			}
+		}
+
+		// Streaming removal of the transparency dots of RFC 5321 4.5.2.
+		class dot_unstuffer
+		{
+		public:
+			bool is_done() const
+			{
+				return state_ == state::done;
+			}
+			// body bytes seen so far, including those over the limit
+			std::uint64_t size() const
+			{
+				return size_;
+			}
+
+			// Passes the unstuffed body in buffer to reader, up to and excluding
+			// the terminating ".CRLF" line. Nothing is passed on once more than
+			// limit bytes (0 for no limit) have been seen. Returns the bytes used.
+			template <class BodyReader>
+			std::size_t put(boost::asio::const_buffer buffer, BodyReader& reader,
+							std::uint64_t limit, boost::beast::error_code& ec)
+			{
+				const auto first = static_cast<const char*>(buffer.data());
+				const auto last = first + buffer.size();
+				auto p = first;
+				auto run = first;
+				const auto flush = [&](const char* run_last) {
+					const auto n = static_cast<std::size_t>(run_last - run);
+					size_ += n;
+					if (n != 0 && (limit == 0 || size_ <= limit)) {
+						put_body(reader, { run, n }, ec);
+					}
+				};
+
+				while (p != last) {
+					switch (state_) {
+						case state::line_start:
+							if (*p == '.') {
+								flush(p);
+								if (ec) {
+									return static_cast<std::size_t>(p - first);
+								}
+								run = ++p;
+								state_ = state::dot;
+								continue;
+							}
+							state_ = state::in_line;
+							[[fallthrough]];
+						case state::in_line: {
+							const auto cr = static_cast<const char*>(
+								std::memchr(p, '\r', static_cast<std::size_t>(last - p)));
+							if (!cr) {
+								p = last;
+								continue;
+							}
+							p = cr + 1;
+							state_ = state::cr;
+							continue;
+						}
+						case state::cr:
+							if (*p == '\n') {
+								++p;
+								state_ = state::line_start;
+								continue;
+							}
+							state_ = state::in_line;
+							continue;
+						case state::dot:
+							if (*p == '\r') {
+								if (last - p < 2) {
+									// keep the CR until we know what follows
+									flush(p);
+									return static_cast<std::size_t>(p - first);
+								}
+								if (p[1] == '\n') {
+									state_ = state::done;
+									return static_cast<std::size_t>(p + 2 - first);
+								}
+							}
+							state_ = state::in_line;
+							continue;
+						case state::done:
+							return static_cast<std::size_t>(p - first);
+					}
+				}
+				flush(p);
+				return static_cast<std::size_t>(p - first);
+			}
+		private:
+			enum class state {
+				line_start,
+				in_line,
+				cr,
+				dot,
+				done,
+			};
+			state state_ = state::line_start;
+			std::uint64_t size_ = 0;
+		};
+	}
+
+	template <class Stream>
+	template <class BodyReader, class Handler>
+	class server_session<Stream>::read_data_op
+		: public boost::asio::coroutine {
+	private:
+		struct data
+		{
+			server_session<Stream>& s;
+			BodyReader& reader;
+			detail::dot_unstuffer unstuffer;
+
+			data(const Handler&, server_session<Stream>& s_, BodyReader& reader_)
+				: s(s_)
+				, reader(reader_)
+			{
+			}
+		};
+		boost::beast::handler_ptr<data, Handler> d_;
+	public:
+		read_data_op(read_data_op&&) = default;
+		read_data_op(const read_data_op&) = delete;
+
+		template <class DeducedHandler, class... Args>
+		read_data_op(DeducedHandler&& h,
+					 server_session<Stream>& s, Args&&... args)
+			: d_(std::forward<DeducedHandler>(h),
+				 s, std::forward<Args>(args)...)
+		{
+		}
+
+		using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+		allocator_type get_allocator() const noexcept
+		{
+			return boost::asio::get_associated_allocator(d_.handler());
+		}
+
+		using executor_type = boost::asio::associated_executor_t<
+			Handler, decltype(std::declval<server_session<Stream>&>().get_executor())>;
+
+		executor_type get_executor() const noexcept
+		{
+			return boost::asio::get_associated_executor(d_.handler(), d_->s.get_executor());
+		}
+
+		void operator()(boost::beast::error_code ec = {}, std::size_t bytes = 0);
+
+		friend bool asio_handler_is_continuation(read_data_op* op)
+		{
+			using boost::asio::asio_handler_is_continuation;
+			return asio_handler_is_continuation(std::addressof(op->d_.handler()));
+		}
+	};
+	template <class Stream>
+	template <class BodyReader, class Handler>
+	void server_session<Stream>::read_data_op<BodyReader, Handler>::operator()(boost::beast::error_code ec, std::size_t bytes)
+	{
+		auto& d = *d_;
+		BOOST_ASIO_CORO_REENTER(*this) {
+			d.s.consume_command();
+			d.reader.init(boost::none, ec);
+			if (ec) {
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::post(d.s.get_executor(), boost::beast::bind_handler(std::move(*this), ec, 0));
+				goto upcall;
+			}
+			BOOST_ASIO_CORO_YIELD
+				boost::asio::async_write(d.s.s_,
+										 boost::beast::buffers_cat(d.s.wr_buf_.data(), detail::start_mail_input_buffer()),
+										 std::move(*this));
+			if (ec) {
+				goto upcall;
+			}
+			d.s.wr_buf_.consume(d.s.wr_buf_.size());
+
+			while (true) {
+				{
+					const auto limit = d.s.ext_.has(extension::size) ? d.s.ext_.max_size() : 0;
+					const auto n = d.unstuffer.put(d.s.rd_buf_.data(), d.reader, limit, ec);
+					d.s.rd_buf_.consume(n);
+					if (ec) {
+						goto upcall;
+					}
+				}
+				if (d.unstuffer.is_done()) {
+					break;
+				}
+				BOOST_ASIO_CORO_YIELD
+					d.s.s_.async_read_some(
+						d.s.rd_buf_.prepare(d.s.rd_buf_.capacity() - d.s.rd_buf_.size()),
+						std::move(*this));
+				if (ec) {
+					goto upcall;
+				}
+				d.s.rd_buf_.commit(bytes);
+			}
+			d.reader.finish(ec);
+			if (!ec && d.s.ext_.has(extension::size) && d.s.ext_.max_size() != 0 &&
+				d.unstuffer.size() > d.s.ext_.max_size()) {
+				ec = error::size_exceeded;
+			}
+		upcall:
+			d_.invoke(ec);
+		}
+	}
+
+	template <class Stream>
+	template <class BodyReader, class Handler>
+	class server_session<Stream>::read_bdat_op
+		: public boost::asio::coroutine {
+	private:
+		struct data
+		{
+			server_session<Stream>& s;
+			BodyReader& reader;
+			std::uint64_t remain;
+			bool last;
+			bool io = false;
+
+			data(const Handler&, server_session<Stream>& s_, BodyReader& reader_)
+				: s(s_)
+				, reader(reader_)
+				, remain(s_.get_command().chunk_size())
+				, last(s_.get_command().last_chunk())
+			{
+			}
+		};
+		boost::beast::handler_ptr<data, Handler> d_;
+	public:
+		read_bdat_op(read_bdat_op&&) = default;
+		read_bdat_op(const read_bdat_op&) = delete;
+
+		template <class DeducedHandler, class... Args>
+		read_bdat_op(DeducedHandler&& h,
+					 server_session<Stream>& s, Args&&... args)
+			: d_(std::forward<DeducedHandler>(h),
+				 s, std::forward<Args>(args)...)
+		{
+		}
+
+		using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+		allocator_type get_allocator() const noexcept
+		{
+			return boost::asio::get_associated_allocator(d_.handler());
+		}
+
+		using executor_type = boost::asio::associated_executor_t<
+			Handler, decltype(std::declval<server_session<Stream>&>().get_executor())>;
+
+		executor_type get_executor() const noexcept
+		{
+			return boost::asio::get_associated_executor(d_.handler(), d_->s.get_executor());
+		}
+
+		void operator()(boost::beast::error_code ec = {}, std::size_t bytes = 0);
+
+		friend bool asio_handler_is_continuation(read_bdat_op* op)
+		{
+			using boost::asio::asio_handler_is_continuation;
+			return op->d_->io ||
+				asio_handler_is_continuation(std::addressof(op->d_.handler()));
+		}
+	};
+	template <class Stream>
+	template <class BodyReader, class Handler>
+	void server_session<Stream>::read_bdat_op<BodyReader, Handler>::operator()(boost::beast::error_code ec, std::size_t bytes)
+	{
+		auto& d = *d_;
+		BOOST_ASIO_CORO_REENTER(*this) {
+			d.s.consume_command();
+			if (!d.s.bdat_started_) {
+				d.reader.init(boost::none, ec);
+				if (ec) {
+					goto post_upcall;
+				}
+				d.s.bdat_started_ = true;
+				d.s.bdat_size_ = 0;
+			}
+			while (d.remain != 0) {
+				if (d.s.rd_buf_.size() == 0) {
+					d.io = true;
+					BOOST_ASIO_CORO_YIELD
+						d.s.s_.async_read_some(
+							d.s.rd_buf_.prepare(d.s.rd_buf_.capacity()),
+							std::move(*this));
+					if (ec) {
+						d.s.bdat_started_ = false;
+						goto upcall;
+					}
+					d.s.rd_buf_.commit(bytes);
+				}
+				{
+					const auto b = d.s.rd_buf_.data();
+					const auto n = static_cast<std::size_t>((std::min<std::uint64_t>)(d.remain, b.size()));
+					d.s.bdat_size_ += n;
+					if (!d.s.ext_.has(extension::size) || d.s.ext_.max_size() == 0 ||
+						d.s.bdat_size_ <= d.s.ext_.max_size()) {
+						detail::put_body(d.reader, { b.data(), n }, ec);
+					}
+					d.s.rd_buf_.consume(n);
+					d.remain -= n;
+					if (ec) {
+						d.s.bdat_started_ = false;
+						goto post_upcall;
+					}
+				}
+			}
+			if (d.last) {
+				d.s.bdat_started_ = false;
+				d.reader.finish(ec);
+				if (!ec && d.s.ext_.has(extension::size) && d.s.ext_.max_size() != 0 &&
+					d.s.bdat_size_ > d.s.ext_.max_size()) {
+					ec = error::size_exceeded;
+				}
+			}
+		post_upcall:
+			if (!d.io) {
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::post(d.s.get_executor(), boost::beast::bind_handler(std::move(*this), ec, 0));
+			}
+		upcall:
+			d_.invoke(ec);
+		}
+	}
+
+	template <class Stream>
+	template <class BodyReader>
+	void server_session<Stream>::read_data(BodyReader& reader)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		read_data(reader, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	template <class BodyReader>
+	void server_session<Stream>::read_data(BodyReader& reader, boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		consume_command();
+		reader.init(boost::none, ec);
+		if (ec) {
+			return;
+		}
+		boost::asio::write(s_, boost::beast::buffers_cat(wr_buf_.data(), detail::start_mail_input_buffer()), ec);
+		if (ec) {
+			return;
+		}
+		wr_buf_.consume(wr_buf_.size());
+
+		const auto limit = ext_.has(extension::size) ? ext_.max_size() : 0;
+		detail::dot_unstuffer unstuffer;
+		while (true) {
+			const auto n = unstuffer.put(rd_buf_.data(), reader, limit, ec);
+			rd_buf_.consume(n);
+			if (ec) {
+				return;
+			}
+			if (unstuffer.is_done()) {
+				break;
+			}
+			const auto bytes = s_.read_some(rd_buf_.prepare(rd_buf_.capacity() - rd_buf_.size()), ec);
+			if (ec) {
+				return;
+			}
+			rd_buf_.commit(bytes);
+		}
+		reader.finish(ec);
+		if (!ec && limit != 0 && unstuffer.size() > limit) {
+			ec = error::size_exceeded;
+		}
+	}
+	template <class Stream>
+	template <class BodyReader, class ReadHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		ReadHandler, void(boost::beast::error_code)
+	) server_session<Stream>::async_read_data(BodyReader& reader, ReadHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			ReadHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		read_data_op<
+			BodyReader,
+			BOOST_ASIO_HANDLER_TYPE(
+				ReadHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			reader
+		}();
+
+		return init.result.get();
+	}
+
+	template <class Stream>
+	template <class BodyReader>
+	void server_session<Stream>::read_bdat(BodyReader& reader)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		read_bdat(reader, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	template <class BodyReader>
+	void server_session<Stream>::read_bdat(BodyReader& reader, boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		auto remain = get_command().chunk_size();
+		const auto last = get_command().last_chunk();
+		const auto limit = ext_.has(extension::size) ? ext_.max_size() : 0;
+
+		consume_command();
+		if (!bdat_started_) {
+			reader.init(boost::none, ec);
+			if (ec) {
+				return;
+			}
+			bdat_started_ = true;
+			bdat_size_ = 0;
+		}
+		while (remain != 0) {
+			if (rd_buf_.size() == 0) {
+				const auto bytes = s_.read_some(rd_buf_.prepare(rd_buf_.capacity()), ec);
+				if (ec) {
+					bdat_started_ = false;
+					return;
+				}
+				rd_buf_.commit(bytes);
+			}
+			const auto b = rd_buf_.data();
+			const auto n = static_cast<std::size_t>((std::min<std::uint64_t>)(remain, b.size()));
+			bdat_size_ += n;
+			if (limit == 0 || bdat_size_ <= limit) {
+				detail::put_body(reader, { b.data(), n }, ec);
+			}
+			rd_buf_.consume(n);
+			remain -= n;
+			if (ec) {
+				bdat_started_ = false;
+				return;
+			}
+		}
+		if (last) {
+			bdat_started_ = false;
+			reader.finish(ec);
+			if (!ec && limit != 0 && bdat_size_ > limit) {
+				ec = error::size_exceeded;
+			}
+		}
+	}
+	template <class Stream>
+	template <class BodyReader, class ReadHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		ReadHandler, void(boost::beast::error_code)
+	) server_session<Stream>::async_read_bdat(BodyReader& reader, ReadHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			ReadHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		read_bdat_op<
+			BodyReader,
+			BOOST_ASIO_HANDLER_TYPE(
+				ReadHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			reader
+		}();
+
+		return init.result.get();
+	}
+}
@@ -1,7 +1,6 @@
 #pragma once
 
 #include "../read_response.hpp"
-#include <boost/beast/core/handler_ptr.hpp>
 #include <boost/beast/core/type_traits.hpp>
 #include <boost/asio/associated_allocator.hpp>
 #include <boost/asio/associated_executor.hpp>
@@ -10,6 +9,8 @@
 
 namespace mail::smtp {
 	namespace detail {
+		// The state is small and moves with the handler, so that reading a
+		// reply allocates nothing.
 		template <class Stream, class DynamicBuffer, class Handler>
 		class read_response_op {
 			struct data {
@@ -25,7 +26,8 @@ namespace mail::smtp {
 				{
 				}
 			};
-			boost::beast::handler_ptr<data, Handler> d_;
+			Handler h_;
+			data d_;
 		public:
 			read_response_op(read_response_op&&) = default;
 			read_response_op(const read_response_op&) = delete;
@@ -36,7 +38,8 @@ namespace mail::smtp {
 							 DynamicBuffer& buf,
 							 response_parser& parser,
 							 Args&&... args)
-				: d_(std::forward<DeducedHandler>(handler),
+				: h_(std::forward<DeducedHandler>(handler))
+				, d_(h_,
 					 s,
 					 buf,
 					 parser,
@@ -48,7 +51,7 @@ namespace mail::smtp {
 
 			allocator_type get_allocator() const noexcept
 			{
-				return boost::asio::get_associated_allocator(d_.handler());
+				return boost::asio::get_associated_allocator(h_);
 			}
 
 			using executor_type = boost::asio::associated_executor_t<
@@ -57,7 +60,7 @@ namespace mail::smtp {
 			executor_type get_executor() const noexcept
 			{
 				return boost::asio::get_associated_executor(
-					d_.handler(), d_->s.get_executor());
+					h_, d_.s.get_executor());
 			}
 
 			void operator()(boost::beast::error_code ec = {}, std::size_t bytes_transferred = 0);
@@ -65,16 +68,16 @@ namespace mail::smtp {
 			friend bool asio_handler_is_continuation(read_response_op* op)
 			{
 				using boost::asio::asio_handler_is_continuation;
-				return op->d_->state >= 2 ||
+				return op->d_.state >= 2 ||
 					asio_handler_is_continuation(
-						std::addressof(op->d_.handler()));
+						std::addressof(op->h_));
 			}
 		};
 		template <class Stream, class DynamicBuffer, class Handler>
 		void read_response_op<Stream, DynamicBuffer, Handler>::operator()(
 			boost::beast::error_code ec, std::size_t bytes_transferred)
 		{
-			auto& d = *d_;
+			auto& d = d_;
 
 			switch (d.state) {
 				case 0:
@@ -88,13 +91,13 @@ namespace mail::smtp {
 					[[fallthrough]];
 				case 2: {
 					if (ec) {
-						return d_.invoke(ec);
+						return h_(ec);
 					}
 					d.buf.commit(bytes_transferred);
 					const auto n = d.parser.put(d.buf.data(), ec);
 					d.buf.consume(n);
 					if (ec != error::need_more) {
-						return d_.invoke(ec);
+						return h_(ec);
 					}
 				}
 				do_read:
@@ -104,7 +107,7 @@ namespace mail::smtp {
 					}
 					catch (const std::length_error&) {
 						ec = error::buffer_overflow;
-						return d_.invoke(ec);
+						return h_(ec);
 					}
 			}
 		}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "../recipient_planner.hpp"
+#include <algorithm>
+#include <utility>
+
+namespace mail::smtp {
+	namespace detail {
+		inline char ascii_tolower(char c)
+		{
+			return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+		}
+		inline int icompare(boost::beast::string_view a, boost::beast::string_view b)
+		{
+			const auto n = (std::min)(a.size(), b.size());
+			for (std::size_t i = 0; i < n; ++i) {
+				const auto x = ascii_tolower(a[i]);
+				const auto y = ascii_tolower(b[i]);
+				if (x != y) {
+					return x < y ? -1 : 1;
+				}
+			}
+			return a.size() == b.size() ? 0 : a.size() < b.size() ? -1 : 1;
+		}
+		inline boost::beast::string_view address_domain(boost::beast::string_view address)
+		{
+			const auto at = address.rfind('@');
+			return at == boost::beast::string_view::npos
+				? boost::beast::string_view{}
+				: address.substr(at + 1);
+		}
+	}
+
+	inline std::size_t recipient_limits::get(boost::beast::string_view server) const
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		const auto it = limits_.find(server);
+		return it == limits_.end() ? default_ : it->second;
+	}
+	inline void recipient_limits::learn(boost::beast::string_view server, std::size_t n)
+	{
+		if (n == 0) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock{ m_ };
+		const auto it = limits_.find(server);
+		if (it == limits_.end()) {
+			limits_.emplace(std::string{ server.data(), server.size() }, (std::min)(n, default_));
+		}
+		else if (n < it->second) {
+			it->second = n;
+		}
+	}
+
+	inline void recipient_planner::normalize()
+	{
+		// stable, the first spelling of a duplicate is kept
+		std::stable_sort(pending_.begin(), pending_.end(), [](const std::string& a, const std::string& b) {
+			const auto c = detail::icompare(detail::address_domain(a), detail::address_domain(b));
+			return c != 0 ? c < 0 : detail::icompare(a, b) < 0;
+		});
+		pending_.erase(std::unique(pending_.begin(), pending_.end(), [](const std::string& a, const std::string& b) {
+			return detail::icompare(a, b) == 0;
+		}), pending_.end());
+	}
+	inline void recipient_planner::plan(boost::beast::string_view server,
+										boost::beast::string_view from,
+										std::vector<envelope>& out)
+	{
+		out.clear();
+		if (pending_.empty()) {
+			return;
+		}
+		normalize();
+		const auto limit = (std::max)(limits_.get(server), std::size_t{ 1 });
+		out.resize((pending_.size() + limit - 1) / limit);
+		for (std::size_t i = 0; i < pending_.size(); ++i) {
+			auto& env = out[i / limit];
+			if (i % limit == 0) {
+				env.from(from);
+			}
+			env.add_recipient(pending_[i]);
+		}
+		pending_.clear();
+	}
+	template <class Body, class Fields>
+	void recipient_planner::plan(boost::beast::string_view server,
+								 boost::beast::string_view from,
+								 const mime::entity<Body, Fields>& entity,
+								 std::vector<message_ref<Body, Fields>>& out)
+	{
+		std::vector<envelope> envelopes;
+		plan(server, from, envelopes);
+		out.clear();
+		out.reserve(envelopes.size());
+		for (auto& env : envelopes) {
+			out.push_back({ std::move(env), &entity });
+		}
+	}
+	template <class Iterator>
+	std::size_t recipient_planner::update(boost::beast::string_view server,
+										  Iterator first, Iterator last,
+										  const std::vector<send_result>& results)
+	{
+		std::size_t n = 0;
+		for (auto r = results.begin(); first != last && r != results.end(); ++first, ++r) {
+			const auto& to = first->envelope.recipients();
+			const auto& codes = r->recipients;
+			const auto full = std::find(codes.begin(), codes.end(), reply_code::insufficient_system_storage);
+			const auto accepted = std::count_if(codes.begin(), full, [](reply_code c) {
+				return c == reply_code::completed || c == reply_code::forward_to;
+			});
+			if (full == codes.end() || accepted == 0) {
+				// nothing accepted, a temporary failure rather than the limit
+				continue;
+			}
+			limits_.learn(server, static_cast<std::size_t>(full - codes.begin()));
+			for (auto c = full; c != codes.end(); ++c) {
+				if (*c == reply_code::insufficient_system_storage) {
+					add(to[static_cast<std::size_t>(c - codes.begin())]);
+					++n;
+				}
+			}
+		}
+		return n;
+	}
+}
@@ -0,0 +1,362 @@
+#pragma once
+
+#include "../server_session.hpp"
+#include <boost/beast/core/bind_handler.hpp>
+#include <boost/beast/core/handler_ptr.hpp>
+#include <boost/beast/core/type_traits.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <iterator>
+
+namespace mail::smtp {
+	template <class Stream>
+	void server_session<Stream>::queue_line(reply_code code, bool more,
+											boost::beast::string_view text1,
+											boost::beast::string_view text2,
+											boost::beast::error_code& ec)
+	{
+		const auto n = 4 + text1.size() + text2.size() + 2;
+		if (n > wr_buf_.capacity() - wr_buf_.size()) {
+			ec = error::buffer_overflow;
+			return;
+		}
+		auto p = static_cast<char*>(wr_buf_.prepare(n).data());
+		const auto v = static_cast<unsigned>(code);
+		p[0] = static_cast<char>('0' + v / 100 % 10);
+		p[1] = static_cast<char>('0' + v / 10 % 10);
+		p[2] = static_cast<char>('0' + v % 10);
+		p[3] = more ? '-' : ' ';
+		p += 4;
+		std::memcpy(p, text1.data(), text1.size());
+		p += text1.size();
+		std::memcpy(p, text2.data(), text2.size());
+		p += text2.size();
+		p[0] = '\r';
+		p[1] = '\n';
+		wr_buf_.commit(n);
+	}
+	template <class Stream>
+	void server_session<Stream>::queue_reply(reply_kind kind, reply_code code,
+											 boost::beast::string_view text,
+											 boost::beast::error_code& ec)
+	{
+		switch (kind) {
+			case reply_kind::banner:
+				queue_line(reply_code::service_ready, false, domain_, " ESMTP", ec);
+				return;
+			case reply_kind::text:
+				queue_line(code, false, text, {}, ec);
+				return;
+			case reply_kind::ehlo:
+				break;
+		}
+
+		const boost::beast::string_view keywords[] = {
+			ext_.has(extension::pipelining) ? "PIPELINING" : "",
+			ext_.has(extension::eightbitmime) ? "8BITMIME" : "",
+			ext_.has(extension::binarymime) ? "BINARYMIME" : "",
+			ext_.has(extension::chunking) ? "CHUNKING" : "",
+			ext_.has(extension::smtputf8) ? "SMTPUTF8" : "",
+			ext_.has(extension::dsn) ? "DSN" : "",
+			ext_.has(extension::enhancedstatuscodes) ? "ENHANCEDSTATUSCODES" : "",
+			ext_.has(extension::starttls) ? "STARTTLS" : "",
+			ext_.has(extension::auth_login) ? "AUTH LOGIN" : "",
+		};
+		char digits[20];
+		auto first = std::end(digits);
+		for (auto v = ext_.max_size(); first == std::end(digits) || v != 0; v /= 10) {
+			*--first = static_cast<char>('0' + v % 10);
+		}
+		const boost::beast::string_view size_param{
+			first, static_cast<std::size_t>(std::end(digits) - first) };
+
+		std::size_t n = 0;
+		std::size_t bytes = 4 + domain_.size() + 2;
+		if (ext_.has(extension::size)) {
+			++n;
+			bytes += 4 + 5 + size_param.size() + 2;
+		}
+		for (const auto k : keywords) {
+			if (!k.empty()) {
+				++n;
+				bytes += 4 + k.size() + 2;
+			}
+		}
+		if (bytes > wr_buf_.capacity() - wr_buf_.size()) {
+			ec = error::buffer_overflow;
+			return;
+		}
+
+		queue_line(reply_code::completed, n != 0, domain_, {}, ec);
+		if (ext_.has(extension::size)) {
+			queue_line(reply_code::completed, --n != 0, "SIZE ", size_param, ec);
+		}
+		for (const auto k : keywords) {
+			if (!k.empty()) {
+				queue_line(reply_code::completed, --n != 0, k, {}, ec);
+			}
+		}
+	}
+	template <class Stream>
+	void server_session<Stream>::write_reply(reply_kind kind, reply_code code,
+											 boost::beast::string_view text,
+											 boost::beast::error_code& ec)
+	{
+		queue_reply(kind, code, text, ec);
+		if (ec == error::buffer_overflow && wr_buf_.size() != 0) {
+			// too many held-back replies, make room
+			const auto n = boost::asio::write(s_, wr_buf_.data(), ec);
+			wr_buf_.consume(n);
+			if (ec) {
+				return;
+			}
+			queue_reply(kind, code, text, ec);
+		}
+		if (ec || kind != reply_kind::banner && has_pipelined_input()) {
+			return;
+		}
+		const auto n = boost::asio::write(s_, wr_buf_.data(), ec);
+		wr_buf_.consume(n);
+	}
+
+	template <class Stream>
+	template <class Handler>
+	class server_session<Stream>::reply_op
+		: public boost::asio::coroutine {
+	private:
+		struct data
+		{
+			server_session<Stream>& s;
+			reply_kind kind;
+			reply_code code;
+			boost::beast::string_view text;
+
+			data(const Handler&, server_session<Stream>& s_,
+				 reply_kind kind_, reply_code code_,
+				 boost::beast::string_view text_)
+				: s(s_)
+				, kind(kind_)
+				, code(code_)
+				, text(text_)
+			{
+			}
+		};
+		boost::beast::handler_ptr<data, Handler> d_;
+	public:
+		reply_op(reply_op&&) = default;
+		reply_op(const reply_op&) = delete;
+
+		template <class DeducedHandler, class... Args>
+		reply_op(DeducedHandler&& h,
+				 server_session<Stream>& s, Args&&... args)
+			: d_(std::forward<DeducedHandler>(h),
+				 s, std::forward<Args>(args)...)
+		{
+		}
+
+		using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+		allocator_type get_allocator() const noexcept
+		{
+			return boost::asio::get_associated_allocator(d_.handler());
+		}
+
+		using executor_type = boost::asio::associated_executor_t<
+			Handler, decltype(std::declval<server_session<Stream>&>().get_executor())>;
+
+		executor_type get_executor() const noexcept
+		{
+			return boost::asio::get_associated_executor(d_.handler(), d_->s.get_executor());
+		}
+
+		void operator()(boost::beast::error_code ec = {}, std::size_t bytes = 0);
+
+		friend bool asio_handler_is_continuation(reply_op* op)
+		{
+			using boost::asio::asio_handler_is_continuation;
+			return asio_handler_is_continuation(std::addressof(op->d_.handler()));
+		}
+	};
+	template <class Stream>
+	template <class Handler>
+	void server_session<Stream>::reply_op<Handler>::operator()(boost::beast::error_code ec, std::size_t bytes)
+	{
+		auto& d = *d_;
+		BOOST_ASIO_CORO_REENTER(*this) {
+			d.s.queue_reply(d.kind, d.code, d.text, ec);
+			if (ec == error::buffer_overflow && d.s.wr_buf_.size() != 0) {
+				// too many held-back replies, make room
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+				if (ec) {
+					goto upcall;
+				}
+				d.s.wr_buf_.consume(bytes);
+				d.s.queue_reply(d.kind, d.code, d.text, ec);
+			}
+			if (ec || d.kind != reply_kind::banner && d.s.has_pipelined_input()) {
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::post(d.s.get_executor(), boost::beast::bind_handler(std::move(*this), ec, 0));
+				goto upcall;
+			}
+			BOOST_ASIO_CORO_YIELD
+				boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+			if (ec) {
+				goto upcall;
+			}
+			d.s.wr_buf_.consume(bytes);
+		upcall:
+			d_.invoke(ec);
+		}
+	}
+
+	template <class Stream>
+	void server_session<Stream>::open()
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		open(ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	void server_session<Stream>::open(boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		write_reply(reply_kind::banner, reply_code::service_ready, {}, ec);
+	}
+	template <class Stream>
+	template <class OpenHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		OpenHandler, void(boost::beast::error_code)
+	) server_session<Stream>::async_open(OpenHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			OpenHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		reply_op<
+			BOOST_ASIO_HANDLER_TYPE(
+				OpenHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			reply_kind::banner,
+			reply_code::service_ready,
+			boost::beast::string_view{}
+		}();
+
+		return init.result.get();
+	}
+
+	template <class Stream>
+	void server_session<Stream>::reply(reply_code code, boost::beast::string_view text)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		reply(code, text, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	void server_session<Stream>::reply(reply_code code, boost::beast::string_view text,
+									   boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		write_reply(reply_kind::text, code, text, ec);
+	}
+	template <class Stream>
+	template <class ReplyHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		ReplyHandler, void(boost::beast::error_code)
+	) server_session<Stream>::async_reply(reply_code code, boost::beast::string_view text,
+										  ReplyHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			ReplyHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		reply_op<
+			BOOST_ASIO_HANDLER_TYPE(
+				ReplyHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			reply_kind::text,
+			code,
+			text
+		}();
+
+		return init.result.get();
+	}
+
+	template <class Stream>
+	void server_session<Stream>::reply_ehlo()
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		reply_ehlo(ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	void server_session<Stream>::reply_ehlo(boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		write_reply(reply_kind::ehlo, reply_code::completed, {}, ec);
+	}
+	template <class Stream>
+	template <class ReplyHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		ReplyHandler, void(boost::beast::error_code)
+	) server_session<Stream>::async_reply_ehlo(ReplyHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			ReplyHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		reply_op<
+			BOOST_ASIO_HANDLER_TYPE(
+				ReplyHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			reply_kind::ehlo,
+			reply_code::completed,
+			boost::beast::string_view{}
+		}();
+
+		return init.result.get();
+	}
+}
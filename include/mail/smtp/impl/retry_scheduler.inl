@@ -0,0 +1,123 @@
+#pragma once
+
+#include "../retry_scheduler.hpp"
+#include <boost/asio/post.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace mail::smtp {
+	template <class T>
+	retry_scheduler<T>::retry_scheduler(boost::asio::io_context& ioc,
+										retry_policy policy,
+										clock::duration tick)
+		: policy_(policy)
+		, tick_(tick)
+		, epoch_(clock::now())
+		, rng_(static_cast<std::minstd_rand::result_type>(epoch_.time_since_epoch().count()))
+		, timer_(ioc)
+	{
+	}
+
+	template <class T>
+	std::size_t retry_scheduler<T>::size() const
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		return wheel_.size();
+	}
+
+	template <class T>
+	auto retry_scheduler<T>::backoff(std::size_t attempt, delivery_status status) -> clock::duration
+	{
+		const auto first = status == delivery_status::connection
+			? policy_.connection_delay
+			: policy_.temporary_delay;
+		const auto max = static_cast<double>(policy_.max_delay.count());
+		const auto n = static_cast<double>(attempt == 0 ? 0 : attempt - 1);
+		auto seconds = (std::min)(static_cast<double>(first.count()) * std::pow(policy_.multiplier, n), max);
+		{
+			std::lock_guard<std::mutex> lock{ m_ };
+			seconds *= 1.0 - policy_.jitter * std::uniform_real_distribution<double>{}(rng_);
+		}
+		return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>{ seconds });
+	}
+
+	template <class T>
+	bool retry_scheduler<T>::defer(T value, std::size_t attempt, delivery_status status)
+	{
+		if (status == delivery_status::delivered ||
+			status == delivery_status::permanent ||
+			attempt >= policy_.max_attempts) {
+			return false;
+		}
+		defer_for(std::move(value), backoff(attempt, status));
+		return true;
+	}
+	template <class T>
+	void retry_scheduler<T>::defer_for(T value, clock::duration delay)
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		// round up, never early
+		wheel_.insert(ticks(clock::now() + delay + tick_ - clock::duration{ 1 }), std::move(value));
+		if (running_ && !armed_) {
+			armed_ = true;
+			boost::asio::post(timer_.get_executor(), [this] { arm(); });
+		}
+	}
+
+	template <class T>
+	void retry_scheduler<T>::start(std::function<void(T)> handler)
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		handler_ = std::move(handler);
+		running_ = true;
+		if (!armed_ && !wheel_.empty()) {
+			armed_ = true;
+			boost::asio::post(timer_.get_executor(), [this] { arm(); });
+		}
+	}
+	template <class T>
+	void retry_scheduler<T>::stop()
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		running_ = false;
+		boost::asio::post(timer_.get_executor(), [this] { timer_.cancel(); });
+	}
+
+	template <class T>
+	void retry_scheduler<T>::arm()
+	{
+		timer_.expires_after(tick_);
+		timer_.async_wait([this](boost::beast::error_code ec) { on_tick(ec); });
+	}
+	template <class T>
+	void retry_scheduler<T>::on_tick(boost::beast::error_code ec)
+	{
+		std::vector<T> due;
+		std::function<void(T)> handler;
+		bool rearm;
+		{
+			std::lock_guard<std::mutex> lock{ m_ };
+			if (ec || !running_) {
+				armed_ = false;
+				return;
+			}
+			due.swap(due_);
+			wheel_.advance(ticks(clock::now()), [&due](T&& v) {
+				due.push_back(std::move(v));
+			});
+			armed_ = rearm = !wheel_.empty();
+			handler = handler_;
+		}
+		if (rearm) {
+			arm();
+		}
+		for (auto& v : due) {
+			handler(std::move(v));
+		}
+		due.clear();
+		std::lock_guard<std::mutex> lock{ m_ };
+		if (due_.capacity() < due.capacity()) {
+			due_.swap(due);
+		}
+	}
+}
@@ -0,0 +1,573 @@
+#pragma once
+
+#include "../session.hpp"
+#include <boost/beast/core/bind_handler.hpp>
+#include <boost/beast/core/handler_ptr.hpp>
+#include <boost/beast/core/type_traits.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/optional/optional.hpp>
+#include <iterator>
+
+namespace mail::smtp {
+	// Queues the commands of a batch into the write buffer and keeps track of
+	// the replies still to be read. The replies come back in the order the
+	// commands were sent: the final reply of the previous message, RSET,
+	// MAIL, each RCPT and DATA.
+	template <class Stream>
+	template <class Iterator>
+	class session<Stream>::batch {
+	public:
+		using message_type = typename std::iterator_traits<Iterator>::value_type;
+		using serializer_type = mime::serializer<
+			typename message_type::body_type,
+			typename message_type::fields_type>;
+
+		enum class action {
+			write,	// flush the write buffer
+			read,	// flush, then read every pending reply
+			body,	// write the content of the current message
+			done,
+		};
+
+		batch(session<Stream>& s, Iterator first, Iterator last,
+			  std::vector<send_result>& results)
+			: s_(s)
+			, cur_(first)
+			, last_(last)
+			, results_(results)
+			, pipelining_(s.ext_.has(extension::pipelining))
+		{
+			results_.clear();
+			results_.resize(static_cast<std::size_t>(std::distance(first, last)));
+		}
+
+		bool pipelining() const
+		{
+			return pipelining_;
+		}
+		serializer_type& serializer()
+		{
+			return *sr_;
+		}
+		bool pending() const
+		{
+			return final_ != nullptr || reset_pending_ || mail_pending_ ||
+				rcpt_read_ != rcpt_sent_ || data_pending_;
+		}
+
+		action next(boost::beast::error_code& ec)
+		{
+			ec.assign(0, ec.category());
+			while (true) {
+				switch (state_) {
+					case state::message:
+						if (cur_ == last_) {
+							return pending() ? action::read : action::done;
+						}
+						r_ = &results_[i_];
+						r_->recipients.assign(cur_->envelope.recipients().size(), reply_code::unknown);
+						state_ = reset_ ? state::reset : state::mail;
+						break;
+					case state::reset:
+						if (!put(detail::reset_buffer(), ec)) {
+							return action::write;
+						}
+						reset_ = false;
+						reset_pending_ = true;
+						state_ = state::mail;
+						if (!pipelining_) {
+							return action::read;
+						}
+						break;
+					case state::mail:
+						if (!sr_) {
+							sr_.emplace(detail::entity_of(cur_->entity));
+							params_ = mail_parameters(ec);
+							if (ec) {
+								// refused before anything is sent, too large or binary
+								r_->ec = ec;
+								ec.assign(0, ec.category());
+								next_message();
+								break;
+							}
+						}
+						if (!put(detail::mail_from_buffer(cur_->envelope.from(), params_.buffer(), s_.dsn(cur_->envelope)), ec)) {
+							return action::write;
+						}
+						mail_pending_ = true;
+						mail_ok_ = false;
+						rcpt_sent_ = rcpt_read_ = 0;
+						accepted_ = 0;
+						state_ = state::rcpt;
+						if (!pipelining_) {
+							return action::read;
+						}
+						break;
+					case state::rcpt:
+						if (!pipelining_ && !mail_ok_) {
+							next_message();
+							break;
+						}
+						if (rcpt_sent_ == r_->recipients.size()) {
+							state_ = state::data;
+							break;
+						}
+						if (!put(detail::rcpt_to_buffer(cur_->envelope.recipients()[rcpt_sent_], s_.dsn(cur_->envelope), rcpt_sent_), ec)) {
+							return action::write;
+						}
+						++rcpt_sent_;
+						if (!pipelining_) {
+							return action::read;
+						}
+						break;
+					case state::data:
+						if (!pipelining_ && accepted_ == 0) {
+							refuse(r_->recipients.empty() ? reply_code::unknown : r_->recipients.back());
+							reset_ = true;
+							next_message();
+							break;
+						}
+						if (!put(detail::data_buffer(), ec)) {
+							return action::write;
+						}
+						data_pending_ = true;
+						state_ = state::start_data;
+						return action::read;
+					case state::start_data:
+						if (data_code_ != reply_code::start_mail_input) {
+							reset_ = mail_ok_;
+							next_message();
+							break;
+						}
+						if (accepted_ == 0) {
+							// 354 without recipients, nothing will be delivered
+							if (!put(detail::data_end_buffer(), ec)) {
+								return action::write;
+							}
+							state_ = state::end_data;
+							break;
+						}
+						sr_->split(false);
+						s_.stuffer_.reset();
+						state_ = state::end_data;
+						return action::body;
+					case state::end_data:
+						final_ = r_;
+						next_message();
+						if (!pipelining_) {
+							return action::read;
+						}
+						break;
+				}
+			}
+		}
+
+		// Replies are timed from the write that carried their command.
+		void on_reply(reply_code code)
+		{
+			if (final_ != nullptr) {
+				s_.on_reply(phase::final_reply);
+				if (!final_->ec) {
+					final_->code = code;
+					if (code != reply_code::completed) {
+						final_->ec = error::failed;
+					}
+				}
+				final_ = nullptr;
+			}
+			else if (reset_pending_) {
+				s_.on_reply();
+				reset_pending_ = false;
+			}
+			else if (mail_pending_) {
+				s_.on_reply(phase::mail);
+				mail_pending_ = false;
+				mail_ok_ = code == reply_code::completed;
+				if (!mail_ok_) {
+					refuse(code);
+				}
+			}
+			else if (rcpt_read_ != rcpt_sent_) {
+				s_.on_reply(phase::rcpt);
+				r_->recipients[rcpt_read_++] = code;
+				if (code == reply_code::completed || code == reply_code::forward_to) {
+					++accepted_;
+				}
+			}
+			else if (data_pending_) {
+				s_.on_reply(phase::data);
+				data_pending_ = false;
+				data_code_ = code;
+				if (code != reply_code::start_mail_input) {
+					refuse(code);
+				}
+				else if (accepted_ == 0) {
+					refuse(r_->recipients.empty() ? code : r_->recipients.back());
+				}
+			}
+		}
+
+		// the stream failed, every message not yet accepted gets the error
+		void fail(boost::beast::error_code ec)
+		{
+			for (auto& r : results_) {
+				if (!r.ec && r.code != reply_code::completed) {
+					r.ec = ec;
+				}
+			}
+		}
+	private:
+		enum class state {
+			message,
+			reset,
+			mail,
+			rcpt,
+			data,
+			start_data,
+			end_data,
+		};
+
+		template <class ConstBufferSequence>
+		bool put(const ConstBufferSequence& buffers, boost::beast::error_code& ec)
+		{
+			if (s_.try_queue(buffers)) {
+				return true;
+			}
+			if (s_.wr_buf_.size() == 0) {
+				ec = error::buffer_overflow;
+			}
+			return false;
+		}
+		void refuse(reply_code code)
+		{
+			if (!r_->ec) {
+				r_->ec = error::failed;
+				r_->code = code;
+			}
+		}
+		// Binary content is refused, BDAT being left to send_mail.
+		detail::mail_parameters mail_parameters(boost::beast::error_code& ec) const
+		{
+			const auto c = s_.inspect(*sr_, ec);
+			if (ec) {
+				return {};
+			}
+			const auto& env = cur_->envelope;
+			return s_.mail_parameters(c, false, !detail::is_ascii(env.from()) ||
+				std::any_of(env.recipients().begin(), env.recipients().end(), [](const auto& to) {
+					return !detail::is_ascii(to);
+				}), ec);
+		}
+		void next_message()
+		{
+			sr_ = boost::none;
+			++cur_;
+			++i_;
+			state_ = state::message;
+		}
+
+		session<Stream>& s_;
+		Iterator cur_;
+		Iterator last_;
+		std::vector<send_result>& results_;
+		std::size_t i_ = 0;
+		send_result* r_ = nullptr;
+		send_result* final_ = nullptr;
+		// the content of the current message, inspected when MAIL is queued
+		boost::optional<serializer_type> sr_;
+		detail::mail_parameters params_;
+		state state_ = state::message;
+		bool pipelining_;
+		bool reset_ = false;
+		bool reset_pending_ = false;
+		bool mail_pending_ = false;
+		bool mail_ok_ = false;
+		bool data_pending_ = false;
+		reply_code data_code_ = reply_code::unknown;
+		std::size_t rcpt_sent_ = 0;
+		std::size_t rcpt_read_ = 0;
+		std::size_t accepted_ = 0;
+	};
+
+	template <class Stream>
+	template <class Iterator, class Handler>
+	class session<Stream>::send_batch_op
+		: public boost::asio::coroutine {
+	private:
+		struct data
+		{
+			session<Stream>& s;
+			batch<Iterator> b;
+			typename batch<Iterator>::action a;
+			bool io = false;
+			bool in_place = false;
+			bool end_queued = false;
+
+			data(const Handler&, session<Stream>& s_,
+				 Iterator first, Iterator last,
+				 std::vector<send_result>& results)
+				: s(s_)
+				, b(s_, first, last, results)
+			{
+			}
+		};
+		boost::beast::handler_ptr<data, Handler> d_;
+	public:
+		send_batch_op(send_batch_op&&) = default;
+		send_batch_op(const send_batch_op&) = delete;
+
+		template <class DeducedHandler, class... Args>
+		send_batch_op(DeducedHandler&& h,
+					  session<Stream>& s, Args&&... args)
+			: d_(std::forward<DeducedHandler>(h),
+				 s, std::forward<Args>(args)...)
+		{
+		}
+
+		using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+		allocator_type get_allocator() const noexcept
+		{
+			return boost::asio::get_associated_allocator(d_.handler());
+		}
+
+		using executor_type = boost::asio::associated_executor_t<
+			Handler, decltype(std::declval<session<Stream>&>().get_executor())>;
+
+		executor_type get_executor() const noexcept
+		{
+			return boost::asio::get_associated_executor(d_.handler(), d_->s.get_executor());
+		}
+
+		void operator()(boost::beast::error_code ec = {}, std::size_t bytes = 0);
+
+		friend bool asio_handler_is_continuation(send_batch_op* op)
+		{
+			using boost::asio::asio_handler_is_continuation;
+			return asio_handler_is_continuation(std::addressof(op->d_.handler()));
+		}
+	};
+	template <class Stream>
+	template <class Iterator, class Handler>
+	void session<Stream>::send_batch_op<Iterator, Handler>::operator()(boost::beast::error_code ec, std::size_t bytes)
+	{
+		using action = typename batch<Iterator>::action;
+
+		auto& d = *d_;
+		BOOST_ASIO_CORO_REENTER(*this) {
+			while (true) {
+				d.a = d.b.next(ec);
+				if (ec || d.a == action::done) {
+					break;
+				}
+				if (d.a == action::body) {
+					d.s.probe_.start();
+					d.end_queued = false;
+					while (!d.end_queued) {
+						d.in_place = d.s.gather(d.b.serializer(), ec);
+						if (ec) {
+							goto fail;
+						}
+						if (d.b.serializer().is_done()) {
+							d.end_queued = d.s.try_queue(detail::data_end_buffer());
+						}
+						if (d.in_place) {
+							BOOST_ASIO_CORO_YIELD {
+								d.b.serializer().next(ec, [&d, this](boost::beast::error_code& ec, const auto& buffers) {
+									ec.assign(0, ec.category());
+									d.s.s_.async_write_some(
+										boost::beast::buffers_cat(d.s.wr_buf_.data(), buffers),
+										std::move(*this));
+								});
+								if (ec) {
+									// (lambda not invoked) *this is not moved
+									goto fail;
+								}
+							};
+							{
+								const auto n = (std::min)(bytes, d.s.wr_buf_.size());
+								d.s.wr_buf_.consume(n);
+								if (bytes != n) {
+									d.s.consume_in_place(d.b.serializer(), bytes - n);
+								}
+							}
+						}
+						else if (!d.end_queued || !d.b.pipelining()) {
+							// with pipelining the end of data leaves with the next commands
+							BOOST_ASIO_CORO_YIELD
+								boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+							d.s.wr_buf_.consume(bytes);
+						}
+						else {
+							bytes = 0;
+						}
+						d.s.probe_.body_bytes(bytes);
+						if (ec) {
+							goto fail;
+						}
+					}
+					d.s.probe_.stop(phase::body);
+					continue;
+				}
+				d.io = true;
+				if (d.s.wr_buf_.size() != 0) {
+					d.s.probe_.start();
+					BOOST_ASIO_CORO_YIELD
+						boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+					d.s.wr_buf_.consume(bytes);
+					if (ec) {
+						goto fail;
+					}
+				}
+				if (d.a == action::read) {
+					while (d.b.pending()) {
+						BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
+						if (ec) {
+							goto fail;
+						}
+						d.b.on_reply(d.s.resp_parser_.get().code());
+					}
+				}
+			}
+			if (ec) {
+			fail:
+				d.s.wr_buf_.consume(d.s.wr_buf_.size());
+				d.b.fail(ec);
+			}
+			if (!d.io) {
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::post(d.s.get_executor(), boost::beast::bind_handler(std::move(*this), ec, 0));
+			}
+			d_.invoke(ec);
+		}
+	}
+
+	template <class Stream>
+	template <class Iterator>
+	void session<Stream>::send_batch(Iterator first, Iterator last,
+									 std::vector<send_result>& results)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		send_batch(first, last, results, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	template <class Iterator>
+	void session<Stream>::send_batch(Iterator first, Iterator last,
+									 std::vector<send_result>& results,
+									 boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		using action = typename batch<Iterator>::action;
+
+		batch<Iterator> b{ *this, first, last, results };
+		while (true) {
+			const auto a = b.next(ec);
+			if (ec || a == action::done) {
+				break;
+			}
+			if (a == action::body) {
+				auto& sr = b.serializer();
+				bool end_queued = false;
+				probe_.start();
+				while (!end_queued) {
+					const auto in_place = gather(sr, ec);
+					if (ec) {
+						break;
+					}
+					if (sr.is_done()) {
+						end_queued = try_queue(detail::data_end_buffer());
+					}
+					if (in_place) {
+						std::size_t bytes = 0;
+						sr.next(ec, [this, &bytes](boost::beast::error_code& ec, const auto& buffers) {
+							bytes = s_.write_some(boost::beast::buffers_cat(wr_buf_.data(), buffers), ec);
+						});
+						const auto n = (std::min)(bytes, wr_buf_.size());
+						wr_buf_.consume(n);
+						if (bytes != n) {
+							consume_in_place(sr, bytes - n);
+						}
+						probe_.body_bytes(bytes);
+					}
+					else if (!end_queued || !b.pipelining()) {
+						probe_.body_bytes(wr_buf_.size());
+						flush(ec);
+					}
+					if (ec) {
+						break;
+					}
+				}
+				if (ec) {
+					break;
+				}
+				probe_.stop(phase::body);
+				continue;
+			}
+			if (wr_buf_.size() != 0) {
+				probe_.start();
+			}
+			flush(ec);
+			if (ec) {
+				break;
+			}
+			if (a == action::read) {
+				while (b.pending()) {
+					read_resp(ec);
+					if (ec) {
+						break;
+					}
+					b.on_reply(resp_parser_.get().code());
+				}
+				if (ec) {
+					break;
+				}
+			}
+		}
+		if (ec) {
+			wr_buf_.consume(wr_buf_.size());
+			b.fail(ec);
+		}
+	}
+	template <class Stream>
+	template <class Iterator, class SendHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		SendHandler, void(boost::beast::error_code)
+	) session<Stream>::async_send_batch(Iterator first, Iterator last,
+										std::vector<send_result>& results,
+										SendHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			SendHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		send_batch_op<
+			Iterator,
+			BOOST_ASIO_HANDLER_TYPE(
+				SendHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			first, last,
+			results
+		}();
+
+		return init.result.get();
+	}
+}
@@ -0,0 +1,889 @@
+#pragma once
+
+#include "../session.hpp"
+#if !defined(_WIN32)
+#include <boost/beast/core/bind_handler.hpp>
+#include <boost/beast/core/handler_ptr.hpp>
+#include <boost/beast/core/type_traits.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/coroutine.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <cerrno>
+#include <unistd.h>
+#include <vector>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+namespace mail::smtp {
+	namespace detail {
+		// a stream which may send files itself, like ktls_stream
+		template <class T, class = void>
+		struct has_sendfile : std::false_type {};
+		template <class T>
+		struct has_sendfile<T, std::void_t<
+			decltype(std::declval<const T&>().ktls_send()),
+			decltype(std::declval<T&>().sendfile(0, std::uint64_t{}, std::size_t{}, std::declval<boost::beast::error_code&>()))
+		>> : std::true_type {};
+
+		// a plain TCP socket, which files are sent to with sendfile(2)
+		template <class T>
+		struct is_tcp_socket : std::false_type {};
+#if defined(__linux__)
+		template <class Executor>
+		struct is_tcp_socket<boost::asio::basic_stream_socket<boost::asio::ip::tcp, Executor>> : std::true_type {};
+#endif
+
+		// File content is not read ahead, and is taken for 8bit.
+		inline content_info file_content(const file_region& content)
+		{
+			content_info c;
+			c.sized = true;
+			c.size = content.size;
+			c.body = mime::content_class::eight_bit;
+			return c;
+		}
+
+		// what one sendfile call is asked for
+		inline std::size_t sendfile_size(std::uint64_t left)
+		{
+			return static_cast<std::size_t>((std::min)(left, std::uint64_t{ 1 } << 30));
+		}
+
+#if defined(__linux__)
+		// One sendfile to a socket; would_block when the socket is full.
+		inline std::size_t try_sendfile(int socket, int fd, std::uint64_t offset, std::size_t n, boost::beast::error_code& ec)
+		{
+			auto off = static_cast<off_t>(offset);
+			ssize_t r;
+			do {
+				r = ::sendfile(socket, fd, &off, n);
+			} while (r < 0 && errno == EINTR);
+			if (r < 0) {
+				ec.assign(errno, boost::system::system_category());
+				return 0;
+			}
+			if (r == 0 && n != 0) {
+				// the file is shorter than the region
+				ec = boost::asio::error::eof;
+				return 0;
+			}
+			ec.assign(0, ec.category());
+			return static_cast<std::size_t>(r);
+		}
+		template <class Socket>
+		std::size_t tcp_sendfile(Socket& socket, int fd, std::uint64_t offset, std::size_t n, boost::beast::error_code& ec)
+		{
+			for (;;) {
+				const auto r = try_sendfile(socket.native_handle(), fd, offset, n, ec);
+				if (ec != boost::asio::error::would_block) {
+					return r;
+				}
+				socket.wait(boost::asio::socket_base::wait_write, ec);
+				if (ec) {
+					return 0;
+				}
+			}
+		}
+
+		// The socket is non-blocking here: asio makes it so for the
+		// asynchronous writes of the commands before.
+		template <class Socket, class Handler>
+		class tcp_sendfile_op
+			: public boost::asio::coroutine {
+		private:
+			struct data
+			{
+				Socket& socket;
+				int fd;
+				std::uint64_t offset;
+				std::size_t n;
+				std::size_t bytes = 0;
+				bool waited = false;
+
+				data(const Handler&, Socket& socket_, int fd_, std::uint64_t offset_, std::size_t n_)
+					: socket(socket_)
+					, fd(fd_)
+					, offset(offset_)
+					, n(n_)
+				{
+				}
+			};
+			boost::beast::handler_ptr<data, Handler> d_;
+		public:
+			tcp_sendfile_op(tcp_sendfile_op&&) = default;
+			tcp_sendfile_op(const tcp_sendfile_op&) = delete;
+
+			template <class DeducedHandler, class... Args>
+			tcp_sendfile_op(DeducedHandler&& h,
+							Socket& socket, Args&&... args)
+				: d_(std::forward<DeducedHandler>(h),
+					 socket, std::forward<Args>(args)...)
+			{
+			}
+
+			using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+			allocator_type get_allocator() const noexcept
+			{
+				return boost::asio::get_associated_allocator(d_.handler());
+			}
+
+			using executor_type = boost::asio::associated_executor_t<
+				Handler, decltype(std::declval<Socket&>().get_executor())>;
+
+			executor_type get_executor() const noexcept
+			{
+				return boost::asio::get_associated_executor(d_.handler(), d_->socket.get_executor());
+			}
+
+			void operator()(boost::beast::error_code ec = {})
+			{
+				auto& d = *d_;
+				BOOST_ASIO_CORO_REENTER(*this) {
+					for (;;) {
+						d.bytes = try_sendfile(d.socket.native_handle(), d.fd, d.offset, d.n, ec);
+						if (ec != boost::asio::error::would_block) {
+							break;
+						}
+						d.waited = true;
+						BOOST_ASIO_CORO_YIELD
+							d.socket.async_wait(boost::asio::socket_base::wait_write, std::move(*this));
+						if (ec) {
+							break;
+						}
+					}
+					if (!d.waited) {
+						BOOST_ASIO_CORO_YIELD
+							boost::asio::post(d.socket.get_executor(), boost::beast::bind_handler(std::move(*this), ec));
+					}
+					// the state is gone when the handler runs
+					const auto n = d.bytes;
+					d_.invoke(ec, n);
+				}
+			}
+
+			friend bool asio_handler_is_continuation(tcp_sendfile_op* op)
+			{
+				using boost::asio::asio_handler_is_continuation;
+				return asio_handler_is_continuation(std::addressof(op->d_.handler()));
+			}
+		};
+		template <class Socket, class Handler>
+		void async_tcp_sendfile(Socket& socket, int fd, std::uint64_t offset, std::size_t n, Handler&& handler)
+		{
+			tcp_sendfile_op<Socket, std::decay_t<Handler>>{
+				std::forward<Handler>(handler), socket, fd, offset, n
+			}();
+		}
+#endif
+	}
+
+	template <class Stream>
+	template <class Handler>
+	class session<Stream>::send_file_op
+		: public boost::asio::coroutine {
+	private:
+		struct data
+		{
+			session<Stream>& s;
+			detail::handler_string<Handler> from;
+			std::vector<detail::handler_string<Handler>,
+				detail::handler_alloc<Handler, detail::handler_string<Handler>>> to;
+			std::size_t i = 0;
+			file_region content;
+			detail::file_transfer how;
+			std::uint64_t done = 0;
+			boost::beast::error_code ec;
+
+			template <class Iterator>
+			data(const Handler& h, session<Stream>& s_,
+				 boost::beast::string_view from_,
+				 Iterator to_first, Iterator to_last,
+				 const file_region& content_,
+				 detail::file_transfer how_)
+				: s(s_)
+				, from(from_.data(), from_.size(), boost::asio::get_associated_allocator(h))
+				, to(boost::asio::get_associated_allocator(h))
+				, content(content_)
+				, how(how_)
+			{
+				detail::assign_strings(to, to_first, to_last);
+			}
+		};
+		boost::beast::handler_ptr<data, Handler> d_;
+	public:
+		send_file_op(send_file_op&&) = default;
+		send_file_op(const send_file_op&) = delete;
+
+		template <class DeducedHandler, class... Args>
+		send_file_op(DeducedHandler&& h,
+					 session<Stream>& s, Args&&... args)
+			: d_(std::forward<DeducedHandler>(h),
+				 s, std::forward<Args>(args)...)
+		{
+		}
+
+		using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+		allocator_type get_allocator() const noexcept
+		{
+			return boost::asio::get_associated_allocator(d_.handler());
+		}
+
+		using executor_type = boost::asio::associated_executor_t<
+			Handler, decltype(std::declval<session<Stream>&>().get_executor())>;
+
+		executor_type get_executor() const noexcept
+		{
+			return boost::asio::get_associated_executor(d_.handler(), d_->s.get_executor());
+		}
+
+		void operator()(boost::beast::error_code ec = {}, std::size_t bytes = 0);
+
+		friend bool asio_handler_is_continuation(send_file_op* op)
+		{
+			using boost::asio::asio_handler_is_continuation;
+			return asio_handler_is_continuation(std::addressof(op->d_.handler()));
+		}
+	};
+	template <class Stream>
+	template <class Handler>
+	void session<Stream>::send_file_op<Handler>::operator()(boost::beast::error_code ec, std::size_t bytes)
+	{
+		auto& d = *d_;
+		BOOST_ASIO_CORO_REENTER(*this) {
+			d.s.probe_.start();
+			{
+				const auto params = d.s.mail_parameters(detail::file_content(d.content), false, !detail::is_ascii(d.from) ||
+					std::any_of(d.to.begin(), d.to.end(), [](const auto& to) { return !detail::is_ascii(to); }), ec);
+				if (!ec) {
+					d.s.queue(detail::mail_from_buffer(d.from, params.buffer()), ec);
+				}
+			}
+			if (ec) {
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::post(d.s.get_executor(), boost::beast::bind_handler(std::move(*this), ec, 0));
+				goto upcall;
+			}
+			BOOST_ASIO_CORO_YIELD
+				boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+			d.s.wr_buf_.consume(bytes);
+			if (ec) {
+				goto upcall;
+			}
+			BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
+			if (ec) {
+				goto upcall;
+			}
+			d.s.on_reply(phase::mail);
+			if (d.s.resp_parser_.get().code() != reply_code::completed) {
+				ec = error::failed;
+				goto upcall;
+			}
+			for (; d.i != d.to.size(); ++d.i) {
+				d.s.probe_.start();
+				d.s.queue(detail::rcpt_to_buffer(d.to[d.i]), ec);
+				if (ec) {
+					goto send_reset;
+				}
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+				d.s.wr_buf_.consume(bytes);
+				if (ec) {
+					goto send_reset;
+				}
+				BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
+				if (ec) {
+					goto send_reset;
+				}
+				d.s.on_reply(phase::rcpt);
+				if (d.s.resp_parser_.get().code() != reply_code::completed) {
+					ec = error::failed;
+					goto send_reset;
+				}
+			}
+			if (d.how != detail::file_transfer::chunked) {
+				d.s.probe_.start();
+				d.s.queue(detail::data_buffer(), ec);
+				if (ec) {
+					goto send_reset;
+				}
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+				d.s.wr_buf_.consume(bytes);
+				if (ec) {
+					goto send_reset;
+				}
+				BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
+				if (ec) {
+					goto send_reset;
+				}
+				d.s.on_reply(phase::data);
+				if (d.s.resp_parser_.get().code() != reply_code::start_mail_input) {
+					ec = error::failed;
+					goto send_reset;
+				}
+			}
+
+			d.s.probe_.start();
+			if (d.how == detail::file_transfer::chunked) {
+				// goes out with the first part of the content
+				d.s.queue(detail::bdat_last_command{ d.content.size }.buffer(), ec);
+				if (ec) {
+					goto send_reset;
+				}
+			}
+			d.s.stuffer_.reset();
+			while (d.done != d.content.size) {
+				if (d.how != detail::file_transfer::stuffed && d.s.sends_file()) {
+					if (d.s.wr_buf_.size() != 0) {
+						BOOST_ASIO_CORO_YIELD
+							boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+						d.s.wr_buf_.consume(bytes);
+						if (ec) {
+							goto upcall;
+						}
+					}
+					BOOST_ASIO_CORO_YIELD d.s.async_write_file(d.content, d.done, std::move(*this));
+					d.done += bytes;
+				}
+				else {
+					d.done += d.s.read_file(d.content, d.done, d.how == detail::file_transfer::stuffed, ec);
+					if (ec) {
+						if (d.how != detail::file_transfer::chunked) {
+							goto send_data_end_and_reset;
+						}
+						// a chunk cannot be cut short, unless nothing of it was sent
+						if (d.done == 0) {
+							goto send_reset;
+						}
+						goto upcall;
+					}
+					BOOST_ASIO_CORO_YIELD
+						boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+					d.s.wr_buf_.consume(bytes);
+				}
+				d.s.probe_.body_bytes(bytes);
+				if (ec) {
+					goto upcall;
+				}
+			}
+			if (d.how == detail::file_transfer::wire) {
+				d.s.queue(detail::data_end_buffer(), ec);
+			}
+			else if (d.how == detail::file_transfer::stuffed) {
+				d.s.queue(d.s.stuffer_.at_line_start() ? detail::dot_line_buffer() : detail::data_end_buffer(), ec);
+			}
+			if (d.s.wr_buf_.size() != 0) {
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+				d.s.wr_buf_.consume(bytes);
+				if (ec) {
+					goto upcall;
+				}
+			}
+			d.s.probe_.stop(phase::body);
+
+			d.s.probe_.start();
+			BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
+			if (ec) {
+				goto upcall;
+			}
+			d.s.on_reply(phase::final_reply);
+			if (d.s.resp_parser_.get().code() != reply_code::completed) {
+				ec = error::failed;
+				goto upcall;
+			}
+		upcall:
+			d_.invoke(ec);
+			return;
+		send_data_end_and_reset:
+			d.ec = ec;
+			d.s.wr_buf_.consume(d.s.wr_buf_.size());
+			d.s.queue(detail::data_end_buffer(), ec);
+			BOOST_ASIO_CORO_YIELD
+				boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+			d.s.wr_buf_.consume(d.s.wr_buf_.size());
+			if (ec) {
+				goto reset_upcall;
+			}
+			BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
+			if (ec) {
+				goto reset_upcall;
+			}
+			d.s.on_reply();
+			ec = d.ec;
+		send_reset:
+			d.ec = ec;
+			d.s.wr_buf_.consume(d.s.wr_buf_.size());
+			d.s.transcribe(detail::reset_buffer());
+			BOOST_ASIO_CORO_YIELD
+				boost::asio::async_write(d.s.s_, detail::reset_buffer(), std::move(*this));
+			if (ec) {
+				goto reset_upcall;
+			}
+			BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
+			if (ec) {
+				goto reset_upcall;
+			}
+			d.s.on_reply();
+		reset_upcall:
+			ec = d.ec;
+			d_.invoke(ec);
+			return;
+		}
+	}
+
+	template <class Stream>
+	bool session<Stream>::sends_file() const
+	{
+		if constexpr (detail::has_sendfile<next_layer_type>::value) {
+			return s_.ktls_send();
+		}
+		else {
+			return detail::is_tcp_socket<next_layer_type>::value;
+		}
+	}
+	template <class Stream>
+	std::size_t session<Stream>::read_file(const file_region& content, std::uint64_t done, bool stuff, boost::beast::error_code& ec)
+	{
+		const auto room = wr_buf_.capacity() - wr_buf_.size();
+		const auto b = wr_buf_.prepare(room);
+		// Stuffing, the read lands in the back half and is copied to the
+		// front with its dots doubled, which never overtakes what it reads.
+		const auto want = static_cast<std::size_t>((std::min)(std::uint64_t{ stuff ? room / 2 : room }, content.size - done));
+		const auto p = static_cast<char*>(b.data()) + (stuff ? room - want : 0);
+		ssize_t n;
+		do {
+			n = ::pread(content.fd, p, want, static_cast<off_t>(content.offset + done));
+		} while (n < 0 && errno == EINTR);
+		if (n < 0) {
+			ec.assign(errno, boost::system::system_category());
+			return 0;
+		}
+		if (n == 0) {
+			// the file is shorter than content.size
+			ec = boost::asio::error::eof;
+			return 0;
+		}
+		ec.assign(0, ec.category());
+		if (!stuff) {
+			wr_buf_.commit(static_cast<std::size_t>(n));
+			return static_cast<std::size_t>(n);
+		}
+		std::size_t produced = 0;
+		const auto used = stuffer_.copy(boost::asio::const_buffer{ p, static_cast<std::size_t>(n) }, b, produced);
+		wr_buf_.commit(produced);
+		return used;
+	}
+	template <class Stream>
+	std::size_t session<Stream>::write_file(const file_region& content, std::uint64_t done, boost::beast::error_code& ec)
+	{
+		if constexpr (detail::has_sendfile<next_layer_type>::value) {
+			return s_.sendfile(content.fd, content.offset + done, detail::sendfile_size(content.size - done), ec);
+		}
+#if defined(__linux__)
+		else if constexpr (detail::is_tcp_socket<next_layer_type>::value) {
+			return detail::tcp_sendfile(s_, content.fd, content.offset + done, detail::sendfile_size(content.size - done), ec);
+		}
+#endif
+		else {
+			ec = boost::asio::error::operation_not_supported;
+			return 0;
+		}
+	}
+	template <class Stream>
+	template <class Handler>
+	void session<Stream>::async_write_file(const file_region& content, std::uint64_t done, Handler&& handler)
+	{
+		if constexpr (detail::has_sendfile<next_layer_type>::value) {
+			s_.async_sendfile(content.fd, content.offset + done, detail::sendfile_size(content.size - done),
+							  std::forward<Handler>(handler));
+		}
+#if defined(__linux__)
+		else if constexpr (detail::is_tcp_socket<next_layer_type>::value) {
+			detail::async_tcp_sendfile(s_, content.fd, content.offset + done, detail::sendfile_size(content.size - done),
+									   std::forward<Handler>(handler));
+		}
+#endif
+		else {
+			const boost::beast::error_code ec = boost::asio::error::operation_not_supported;
+			boost::asio::post(get_executor(), boost::beast::bind_handler(std::forward<Handler>(handler), ec, 0));
+		}
+	}
+
+	template <class Stream>
+	void session<Stream>::send_file(boost::beast::string_view from,
+									boost::beast::string_view to,
+									const file_region& content)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		send_file(from, to, content, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	void session<Stream>::send_file(boost::beast::string_view from,
+									boost::beast::string_view to,
+									const file_region& content,
+									boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		send_file(from, &to, &to + 1, content, ec);
+	}
+	template <class Stream>
+	template <class Iterator>
+	void session<Stream>::send_file(boost::beast::string_view from,
+									Iterator to_first, Iterator to_last,
+									const file_region& content)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		send_file(from, to_first, to_last, content, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	template <class Iterator>
+	void session<Stream>::send_file(boost::beast::string_view from,
+									Iterator to_first, Iterator to_last,
+									const file_region& content,
+									boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		transfer_file(from, to_first, to_last, content, detail::file_transfer::wire, ec);
+	}
+	template <class Stream>
+	template <class Iterator>
+	void session<Stream>::transfer_file(boost::beast::string_view from,
+										Iterator to_first, Iterator to_last,
+										const file_region& content,
+										detail::file_transfer how,
+										boost::beast::error_code& ec)
+	{
+		probe_.start();
+		const auto params = mail_parameters(detail::file_content(content), false, !detail::is_ascii(from) ||
+			std::any_of(to_first, to_last, [](const auto& to) { return !detail::is_ascii(to); }), ec);
+		if (ec) {
+			return;
+		}
+		queue(detail::mail_from_buffer(from, params.buffer()), ec);
+		if (ec) {
+			return;
+		}
+		flush(ec);
+		if (ec) {
+			return;
+		}
+		read_resp(ec);
+		if (ec) {
+			return;
+		}
+		on_reply(phase::mail);
+		if (resp_parser_.get().code() != reply_code::completed) {
+			ec = error::failed;
+			return;
+		}
+		{
+			for (auto iter = to_first; iter != to_last; ++iter) {
+				probe_.start();
+				queue(detail::rcpt_to_buffer(*iter), ec);
+				if (ec) {
+					goto send_reset;
+				}
+				flush(ec);
+				if (ec) {
+					goto send_reset;
+				}
+				read_resp(ec);
+				if (ec) {
+					goto send_reset;
+				}
+				on_reply(phase::rcpt);
+				if (resp_parser_.get().code() != reply_code::completed) {
+					ec = error::failed;
+					goto send_reset;
+				}
+			}
+
+			if (how != detail::file_transfer::chunked) {
+				probe_.start();
+				queue(detail::data_buffer(), ec);
+				if (ec) {
+					goto send_reset;
+				}
+				flush(ec);
+				if (ec) {
+					goto send_reset;
+				}
+				read_resp(ec);
+				if (ec) {
+					goto send_reset;
+				}
+				on_reply(phase::data);
+				if (resp_parser_.get().code() != reply_code::start_mail_input) {
+					ec = error::failed;
+					goto send_reset;
+				}
+			}
+
+			probe_.start();
+			if (how == detail::file_transfer::chunked) {
+				// goes out with the first part of the content
+				queue(detail::bdat_last_command{ content.size }.buffer(), ec);
+				if (ec) {
+					goto send_reset;
+				}
+			}
+			stuffer_.reset();
+			for (std::uint64_t done = 0; done != content.size;) {
+				std::size_t n;
+				if (how != detail::file_transfer::stuffed && sends_file()) {
+					if (wr_buf_.size() != 0) {
+						flush(ec);
+						if (ec) {
+							return;
+						}
+					}
+					n = write_file(content, done, ec);
+					done += n;
+				}
+				else {
+					done += read_file(content, done, how == detail::file_transfer::stuffed, ec);
+					if (ec) {
+						if (how != detail::file_transfer::chunked) {
+							goto send_data_end_and_reset;
+						}
+						// a chunk cannot be cut short, unless nothing of it was sent
+						if (done == 0) {
+							goto send_reset;
+						}
+						return;
+					}
+					n = boost::asio::write(s_, wr_buf_.data(), ec);
+					wr_buf_.consume(n);
+				}
+				probe_.body_bytes(n);
+				if (ec) {
+					return;
+				}
+			}
+			if (how == detail::file_transfer::wire) {
+				queue(detail::data_end_buffer(), ec);
+			}
+			else if (how == detail::file_transfer::stuffed) {
+				queue(stuffer_.at_line_start() ? detail::dot_line_buffer() : detail::data_end_buffer(), ec);
+			}
+			if (wr_buf_.size() != 0) {
+				flush(ec);
+				if (ec) {
+					return;
+				}
+			}
+			probe_.stop(phase::body);
+
+			probe_.start();
+			read_resp(ec);
+			if (ec) {
+				return;
+			}
+			on_reply(phase::final_reply);
+			if (resp_parser_.get().code() != reply_code::completed) {
+				ec = error::failed;
+				return;
+			}
+		}
+		return;
+	send_data_end_and_reset:
+		{
+			boost::beast::error_code ec_send_end;
+			wr_buf_.consume(wr_buf_.size());
+			queue(detail::data_end_buffer(), ec_send_end);
+			flush(ec_send_end);
+			wr_buf_.consume(wr_buf_.size());
+			if (ec_send_end) {
+				return;
+			}
+			read_resp(ec_send_end);
+			if (ec_send_end) {
+				return;
+			}
+			on_reply();
+		}
+	send_reset:
+		wr_buf_.consume(wr_buf_.size());
+		boost::beast::error_code ec_reset;
+		transcribe(detail::reset_buffer());
+		boost::asio::write(s_, detail::reset_buffer(), ec_reset);
+		if (ec_reset) {
+			return;
+		}
+		read_resp(ec_reset);
+		if (ec_reset) {
+			return;
+		}
+		on_reply();
+	}
+
+	template <class Stream>
+	template <class SendHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		SendHandler, void(boost::beast::error_code)
+	) session<Stream>::async_send_file(boost::beast::string_view from,
+									   boost::beast::string_view to,
+									   const file_region& content,
+									   SendHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		return async_send_file(from, &to, &to + 1, content, std::forward<SendHandler>(handler));
+	}
+	template <class Stream>
+	template <class Iterator, class SendHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		SendHandler, void(boost::beast::error_code)
+	) session<Stream>::async_send_file(boost::beast::string_view from,
+									   Iterator to_first, Iterator to_last,
+									   const file_region& content,
+									   SendHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			SendHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		send_file_op<
+			BOOST_ASIO_HANDLER_TYPE(
+				SendHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			from,
+			to_first, to_last,
+			content,
+			detail::file_transfer::wire
+		}();
+
+		return init.result.get();
+	}
+
+	template <class Stream>
+	void session<Stream>::send_raw(boost::beast::string_view from,
+								   boost::beast::string_view to,
+								   const file_region& content)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		send_raw(from, to, content, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	void session<Stream>::send_raw(boost::beast::string_view from,
+								   boost::beast::string_view to,
+								   const file_region& content,
+								   boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		send_raw(from, &to, &to + 1, content, ec);
+	}
+	template <class Stream>
+	template <class Iterator>
+	void session<Stream>::send_raw(boost::beast::string_view from,
+								   Iterator to_first, Iterator to_last,
+								   const file_region& content)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		send_raw(from, to_first, to_last, content, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	template <class Iterator>
+	void session<Stream>::send_raw(boost::beast::string_view from,
+								   Iterator to_first, Iterator to_last,
+								   const file_region& content,
+								   boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		transfer_file(from, to_first, to_last, content,
+					  ext_.has(extension::chunking) ? detail::file_transfer::chunked : detail::file_transfer::stuffed,
+					  ec);
+	}
+
+	template <class Stream>
+	template <class SendHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		SendHandler, void(boost::beast::error_code)
+	) session<Stream>::async_send_raw(boost::beast::string_view from,
+									  boost::beast::string_view to,
+									  const file_region& content,
+									  SendHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		return async_send_raw(from, &to, &to + 1, content, std::forward<SendHandler>(handler));
+	}
+	template <class Stream>
+	template <class Iterator, class SendHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		SendHandler, void(boost::beast::error_code)
+	) session<Stream>::async_send_raw(boost::beast::string_view from,
+									  Iterator to_first, Iterator to_last,
+									  const file_region& content,
+									  SendHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			SendHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		send_file_op<
+			BOOST_ASIO_HANDLER_TYPE(
+				SendHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			from,
+			to_first, to_last,
+			content,
+			ext_.has(extension::chunking) ? detail::file_transfer::chunked : detail::file_transfer::stuffed
+		}();
+
+		return init.result.get();
+	}
+}
+#endif
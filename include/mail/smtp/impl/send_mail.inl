@@ -1,32 +1,87 @@
 #pragma once
 
 #include "../session.hpp"
+#include <boost/beast/core/bind_handler.hpp>
 #include <boost/beast/core/handler_ptr.hpp>
 #include <boost/beast/core/type_traits.hpp>
+#include <boost/beast/http/error.hpp>
 #include <boost/asio/associated_allocator.hpp>
 #include <boost/asio/associated_executor.hpp>
 #include <boost/asio/coroutine.hpp>
 #include <boost/asio/handler_continuation_hook.hpp>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/optional/optional.hpp>
 #include <vector>
 
 namespace mail::smtp {
 	namespace detail {
-		inline auto mail_from_buffer(boost::beast::string_view from)
+		// " RET=FULL" or " RET=HDRS"
+		inline boost::asio::const_buffer ret_buffer(dsn_return ret)
 		{
+			switch (ret) {
+				case dsn_return::full:
+					return { " RET=FULL", 9 };
+				case dsn_return::headers:
+					return { " RET=HDRS", 9 };
+				default:
+					return {};
+			}
+		}
+		// " NOTIFY=" and the list of notify
+		inline boost::asio::const_buffer notify_buffer(dsn_notify notify)
+		{
+			static constexpr boost::beast::string_view lists[] = {
+				{},
+				" NOTIFY=SUCCESS",
+				" NOTIFY=FAILURE",
+				" NOTIFY=SUCCESS,FAILURE",
+				" NOTIFY=DELAY",
+				" NOTIFY=SUCCESS,DELAY",
+				" NOTIFY=FAILURE,DELAY",
+				" NOTIFY=SUCCESS,FAILURE,DELAY",
+			};
+			const auto v = static_cast<unsigned>(notify);
+			const auto list = v & static_cast<unsigned>(dsn_notify::never)
+				? boost::beast::string_view{ " NOTIFY=NEVER" }
+				: lists[(v >> 1) & 7];
+			return { list.data(), list.size() };
+		}
+
+		// params, each with its leading space, follow the path, then the
+		// DSN parameters of dsn when not null
+		inline auto mail_from_buffer(boost::beast::string_view from,
+									 boost::asio::const_buffer params = {},
+									 const envelope* dsn = nullptr)
+		{
+			const auto envid = dsn ? dsn->envid() : boost::beast::string_view{};
 			return boost::beast::buffers_cat(
 				boost::asio::const_buffer{ "MAIL FROM:<", 11 },
 				boost::asio::buffer(from.data(), from.size()),
-				boost::asio::const_buffer{ ">\r\n", 3 }
+				boost::asio::const_buffer{ ">", 1 },
+				params,
+				dsn ? ret_buffer(dsn->ret()) : boost::asio::const_buffer{},
+				boost::asio::const_buffer{ " ENVID=", envid.empty() ? 0u : 7u },
+				boost::asio::buffer(envid.data(), envid.size()),
+				boost::asio::const_buffer{ "\r\n", 2 }
 			);
 		}
-		inline auto rcpt_to_buffer(boost::beast::string_view to)
+		// the DSN parameters of recipient n of dsn follow the path when
+		// dsn is not null
+		inline auto rcpt_to_buffer(boost::beast::string_view to,
+								   const envelope* dsn = nullptr, std::size_t n = 0)
 		{
+			const auto orcpt = dsn ? dsn->orcpt(n) : boost::beast::string_view{};
 			return boost::beast::buffers_cat(
 				boost::asio::const_buffer{ "RCPT TO:<", 9 },
 				boost::asio::buffer(to.data(), to.size()),
-				boost::asio::const_buffer{ ">\r\n", 3 }
+				boost::asio::const_buffer{ ">", 1 },
+				dsn ? notify_buffer(dsn->notify(n)) : boost::asio::const_buffer{},
+				boost::asio::const_buffer{ " ORCPT=rfc822;", orcpt.empty() ? 0u : 14u },
+				boost::asio::buffer(orcpt.data(), orcpt.size()),
+				boost::asio::const_buffer{ "\r\n", 2 }
 			);
 		}
 		inline auto reset_buffer()
@@ -41,6 +96,76 @@ namespace mail::smtp {
 		{
 			return boost::asio::const_buffer{ "\r\n.\r\n", 5 };//////// ".\r\n" 3
 		}
+
+		// "BDAT <size> LAST" CRLF
+		class bdat_last_command
+		{
+		public:
+			explicit bdat_last_command(std::uint64_t size)
+			{
+				std::memcpy(buf_, "BDAT ", 5);
+				auto p = std::to_chars(buf_ + 5, buf_ + sizeof(buf_), size).ptr;
+				std::memcpy(p, " LAST\r\n", 7);
+				size_ = static_cast<std::size_t>(p + 7 - buf_);
+			}
+			boost::asio::const_buffer buffer() const
+			{
+				return { buf_, size_ };
+			}
+		private:
+			char buf_[32];
+			std::size_t size_;
+		};
+
+		// a body writer which may have no content yet, see mime::channel_body
+		template <class Writer, class = void>
+		struct is_async_body_writer : std::false_type {};
+		template <class Writer>
+		struct is_async_body_writer<Writer, std::void_t<
+			decltype(std::declval<Writer&>().async_wait(std::declval<void(*)(boost::beast::error_code)>()))
+		>> : std::true_type {};
+
+		// Waits until the writer has content again; with a writer that
+		// cannot be waited for, need_more is an error.
+		template <class Writer, class Executor, class Handler>
+		void async_wait_body(Writer& wr, const Executor& ex, Handler&& handler)
+		{
+			if constexpr (is_async_body_writer<Writer>::value) {
+				wr.async_wait(std::forward<Handler>(handler));
+			}
+			else {
+				const boost::beast::error_code ec = boost::beast::http::error::need_more;
+				boost::asio::post(ex, boost::beast::bind_handler(std::forward<Handler>(handler), ec, 0));
+			}
+		}
+
+		// Copies the strings of [first, last) into to, in its memory.
+		template <class Strings, class Iterator>
+		void assign_strings(Strings& to, Iterator first, Iterator last)
+		{
+			using string_type = typename Strings::value_type;
+			for (; first != last; ++first) {
+				const boost::beast::string_view v = *first;
+				to.push_back(string_type(v.data(), v.size(), typename string_type::allocator_type(to.get_allocator())));
+			}
+		}
+		// the end of data after content which ends with CRLF
+		inline auto dot_line_buffer()
+		{
+			return boost::asio::const_buffer{ ".\r\n", 3 };
+		}
+
+		// timers take an executor only from Asio 1.70 (Boost 1.70) on
+		template <class Executor>
+		void emplace_timer(boost::optional<boost::asio::steady_timer>& timer, const Executor& ex)
+		{
+			if constexpr (std::is_constructible<boost::asio::steady_timer, const Executor&>::value) {
+				timer.emplace(ex);
+			}
+			else {
+				timer.emplace(ex.context());
+			}
+		}
 	}
 	template <class Stream>
 	template <class Body, class Fields, class Handler>
@@ -50,38 +175,158 @@ namespace mail::smtp {
 		struct data
 		{
 			session<Stream>& s;
-			std::string from;
-			std::vector<std::string> to;
+			detail::handler_string<Handler> from;
+			std::vector<detail::handler_string<Handler>,
+				detail::handler_alloc<Handler, detail::handler_string<Handler>>> to;
+			// the envelope given instead, taken over or the caller's
+			boost::optional<smtp::envelope> owned;
+			const smtp::envelope* env = nullptr;
 			std::size_t i = 0;
 			boost::optional<mime::serializer<Body, Fields>> osr;
 			mime::serializer<Body, Fields>* sr;
 			boost::beast::error_code ec;
+			bool in_place = false;
+			bool end_queued = false;
+			// binary content, sent in one BDAT
+			bool chunked = false;
+			std::uint64_t size = 0;
+			// early_abort
+			boost::optional<boost::asio::steady_timer> wait;
+			boost::beast::error_code reply_ec;
+			bool reading = false;
+			bool writing = false;
+			// encode_ahead
+			detail::encode_pipeline* pipe = nullptr;
+			std::size_t front = 0;
+			bool last = false;
+			bool prepared = false;
+			bool awaiting = false;
+			boost::beast::error_code prepare_ec;
+			std::chrono::steady_clock::time_point started;
 
-			template <class Iterator>
-			data(const Handler&, session<Stream>& s_,
+			template <class Iterator, class Content>
+			data(const Handler& h, session<Stream>& s_,
 				 boost::beast::string_view from_,
 				 Iterator to_first, Iterator to_last,
-				 mime::serializer<Body, Fields>& sr_)
+				 Content& c)
 				: s(s_)
-				, from(from_)
-				, to(to_first, to_last)
-				, sr(&sr_)
+				, from(from_.data(), from_.size(), boost::asio::get_associated_allocator(h))
+				, to(boost::asio::get_associated_allocator(h))
 			{
+				detail::assign_strings(to, to_first, to_last);
+				set_content(c);
 			}
-			template <class Iterator>
-			data(const Handler&, session<Stream>& s_,
-				 boost::beast::string_view from_,
-				 Iterator to_first, Iterator to_last,
-				 const mime::entity<Body, Fields>& e)
+			template <class Content>
+			data(const Handler& h, session<Stream>& s_,
+				 const smtp::envelope& e,
+				 Content& c)
+				: s(s_)
+				, from(boost::asio::get_associated_allocator(h))
+				, to(boost::asio::get_associated_allocator(h))
+				, env(&e)
+			{
+				set_content(c);
+			}
+			template <class Content>
+			data(const Handler& h, session<Stream>& s_,
+				 smtp::envelope&& e,
+				 Content& c)
 				: s(s_)
-				, from(from_)
-				, to(to_first, to_last)
+				, from(boost::asio::get_associated_allocator(h))
+				, to(boost::asio::get_associated_allocator(h))
+				, owned(std::move(e))
+				, env(&*owned)
+			{
+				set_content(c);
+			}
+
+			void set_content(mime::serializer<Body, Fields>& sr_)
+			{
+				sr = &sr_;
+			}
+			void set_content(const mime::entity<Body, Fields>& e)
 			{
 				osr.emplace(e);
 				sr = &osr.get();
 			}
+
+			boost::beast::string_view sender() const
+			{
+				return env ? env->from() : boost::beast::string_view{ from };
+			}
+			std::size_t recipients() const
+			{
+				return env ? env->recipients().size() : to.size();
+			}
+			boost::beast::string_view recipient(std::size_t n) const
+			{
+				return env ? boost::beast::string_view{ env->recipients()[n] } : boost::beast::string_view{ to[n] };
+			}
+			// the envelope, for its DSN parameters, when there is one and
+			// the server advertised DSN
+			const smtp::envelope* dsn() const
+			{
+				return env ? s.dsn(*env) : nullptr;
+			}
+			// whether an address needs SMTPUTF8
+			bool utf8() const
+			{
+				if (!detail::is_ascii(sender())) {
+					return true;
+				}
+				for (std::size_t n = 0; n != recipients(); ++n) {
+					if (!detail::is_ascii(recipient(n))) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			// Prepares the part after the front one, on the pipeline's
+			// executor if it has one; the op, on ex, is told when it is done.
+			template <class Executor>
+			void prepare_next(const Executor& ex)
+			{
+				auto& part = pipe->parts[1 - front];
+				const auto n = pipe->next;
+				if (!pipe->ex) {
+					s.prepare_part(*sr, part, n, prepare_ec);
+					prepared = true;
+					return;
+				}
+				boost::asio::post(pipe->ex, [this, ex, &part, n] {
+					s.prepare_part(*sr, part, n, prepare_ec);
+					boost::asio::post(ex, [this] {
+						prepared = true;
+						if (awaiting) {
+							wait->cancel();
+						}
+					});
+				});
+			}
 		};
 		boost::beast::handler_ptr<data, Handler> d_;
+
+		// completion of the read kept pending during the data phase
+		class reply_handler {
+		public:
+			explicit reply_handler(data& d)
+				: d_(d)
+			{
+			}
+			void operator()(boost::beast::error_code ec)
+			{
+				d_.reading = false;
+				d_.reply_ec = ec;
+				if (d_.writing) {
+					boost::beast::error_code ignored;
+					d_.s.lowest_layer().cancel(ignored);
+				}
+				d_.wait->cancel();
+			}
+		private:
+			data& d_;
+		};
 	public:
 		send_mail_op(send_mail_op&&) = default;
 		send_mail_op(const send_mail_op&) = delete;
@@ -123,8 +368,24 @@ namespace mail::smtp {
 	{
 		auto& d = *d_;
 		BOOST_ASIO_CORO_REENTER(*this) {
+			d.s.probe_.start();
+			{
+				const auto c = d.s.inspect(*d.sr, ec);
+				d.chunked = d.s.chunked(c);
+				d.size = c.size;
+				const auto params = ec ? detail::mail_parameters{} : d.s.mail_parameters(c, d.chunked, d.utf8(), ec);
+				if (!ec) {
+					d.s.queue(detail::mail_from_buffer(d.sender(), params.buffer(), d.dsn()), ec);
+				}
+			}
+			if (ec) {
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::post(d.s.get_executor(), boost::beast::bind_handler(std::move(*this), ec, 0));
+				goto upcall;
+			}
 			BOOST_ASIO_CORO_YIELD
-				boost::asio::async_write(d.s.s_, detail::mail_from_buffer(d.from), std::move(*this));
+				boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+			d.s.wr_buf_.consume(bytes);
 			if (ec) {
 				goto upcall;
 			}
@@ -132,13 +393,20 @@ namespace mail::smtp {
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply(phase::mail);
 			if (d.s.resp_parser_.get().code() != reply_code::completed) {
 				ec = error::failed;
 				goto upcall;
 			}
-			for (; d.i != d.to.size(); ++d.i) {
+			for (; d.i != d.recipients(); ++d.i) {
+				d.s.probe_.start();
+				d.s.queue(detail::rcpt_to_buffer(d.recipient(d.i), d.dsn(), d.i), ec);
+				if (ec) {
+					goto send_reset;
+				}
 				BOOST_ASIO_CORO_YIELD
-					boost::asio::async_write(d.s.s_, detail::rcpt_to_buffer(d.to[d.i]), std::move(*this));
+					boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+				d.s.wr_buf_.consume(bytes);
 				if (ec) {
 					goto send_reset;
 				}
@@ -146,55 +414,142 @@ namespace mail::smtp {
 				if (ec) {
 					goto send_reset;
 				}
+				d.s.on_reply(phase::rcpt);
 				if (d.s.resp_parser_.get().code() != reply_code::completed) {
 					ec = error::failed;
 					goto send_reset;
 				}
 			}
-			BOOST_ASIO_CORO_YIELD
-				boost::asio::async_write(d.s.s_, detail::data_buffer(), std::move(*this));
-			if (ec) {
-				goto send_reset;
-			}
-			BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
-			if (ec) {
-				goto send_reset;
+			if (d.chunked) {
+				// the content follows the command in the same write, and
+				// nothing ends it
+				d.s.probe_.start();
+				d.s.queue(detail::bdat_last_command(d.size).buffer(), ec);
+				if (ec) {
+					goto send_reset;
+				}
+				d.end_queued = true;
 			}
-			if (d.s.resp_parser_.get().code() != reply_code::start_mail_input) {
-				ec = error::failed;
-				goto send_reset;
+			else {
+				d.s.probe_.start();
+				d.s.queue(detail::data_buffer(), ec);
+				if (ec) {
+					goto send_reset;
+				}
+				BOOST_ASIO_CORO_YIELD
+					boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+				d.s.wr_buf_.consume(bytes);
+				if (ec) {
+					goto send_reset;
+				}
+				BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
+				if (ec) {
+					goto send_reset;
+				}
+				d.s.on_reply(phase::data);
+				if (d.s.resp_parser_.get().code() != reply_code::start_mail_input) {
+					ec = error::failed;
+					goto send_reset;
+				}
+				d.s.probe_.start();
 			}
 
 			d.sr->split(false);
-			while (!d.sr->is_done()) {
-				BOOST_ASIO_CORO_YIELD {
-					d.sr->next(ec, [&d, this](boost::beast::error_code& ec, const auto& buffers) {
-						ec.assign(0, ec.category());
-						d.s.s_.async_write_some(buffers, std::move(*this));
-					});
-					if (ec) {
-						// (lambda not invoked) *this is not moved
-						goto send_data_end_and_reset;
+			d.s.stuffer_.reset(!d.chunked);
+			if (d.s.early_abort_) {
+				detail::emplace_timer(d.wait, d.s.get_executor());
+				d.wait->expires_at((boost::asio::steady_timer::time_point::max)());
+				d.reading = true;
+				d.writing = true;
+				async_read_response(d.s.s_, d.s.rd_buf_, d.s.resp_parser_,
+									boost::asio::bind_executor(get_executor(), reply_handler{ d }));
+			}
+			if (d.s.pipe_ && !d.chunked && !detail::is_async_body_writer<std::decay_t<decltype(d.sr->writer_impl())>>::value) {
+				goto send_parts;
+			}
+			while (!d.sr->is_done() || !d.end_queued || d.s.wr_buf_.size() != 0) {
+				d.in_place = d.s.gather(*d.sr, ec);
+				if (ec == boost::beast::http::error::need_more) {
+					// the body is still being produced: send what there is,
+					// or wait for more
+					if (d.s.wr_buf_.size() == 0) {
+						BOOST_ASIO_CORO_YIELD
+							detail::async_wait_body(d.sr->writer_impl(), d.s.get_executor(), std::move(*this));
+						if (ec) {
+							goto send_data_end_and_reset;
+						}
+						continue;
 					}
-				};
-
+					ec.assign(0, ec.category());
+				}
 				if (ec) {
 					goto send_data_end_and_reset;
 				}
-				if (bytes) {
-					d.sr->consume(bytes);
+				if (d.sr->is_done() && !d.end_queued) {
+					d.end_queued = d.s.try_queue(detail::data_end_buffer());
+				}
+				if (d.in_place) {
+					// a chunk too large to copy goes out behind the queued bytes
+					BOOST_ASIO_CORO_YIELD {
+						d.sr->next(ec, [&d, this](boost::beast::error_code& ec, const auto& buffers) {
+							ec.assign(0, ec.category());
+							d.s.s_.async_write_some(
+								boost::beast::buffers_cat(d.s.wr_buf_.data(), buffers),
+								std::move(*this));
+						});
+						if (ec) {
+							// (lambda not invoked) *this is not moved
+							goto send_data_end_and_reset;
+						}
+					};
+					{
+						const auto n = (std::min)(bytes, d.s.wr_buf_.size());
+						d.s.wr_buf_.consume(n);
+						if (bytes != n) {
+							d.s.consume_in_place(*d.sr, bytes - n);
+						}
+					}
+				}
+				else {
+					BOOST_ASIO_CORO_YIELD
+						boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+					d.s.wr_buf_.consume(bytes);
+				}
+				d.s.probe_.body_bytes(bytes);
+				if (d.s.early_abort_) {
+					if (!d.reading) {
+						// a reply after the end of data is the final one
+						if (!ec && d.sr->is_done() && d.end_queued && d.s.wr_buf_.size() == 0) {
+							goto data_sent;
+						}
+						goto premature_reply;
+					}
+					if (ec) {
+						goto cancel_reply_upcall;
+					}
+				}
+				if (ec) {
+					goto send_data_end_and_reset;
 				}
 			}
+		data_sent:
+			d.writing = false;
+			d.s.probe_.stop(phase::body);
 
-			BOOST_ASIO_CORO_YIELD
-				boost::asio::async_write(d.s.s_, detail::data_end_buffer(), std::move(*this));
-			if (ec) {
-				goto upcall;
+			d.s.probe_.start();
+			if (d.s.early_abort_) {
+				if (d.reading) {
+					BOOST_ASIO_CORO_YIELD d.wait->async_wait(std::move(*this));
+				}
+				ec = d.reply_ec;
+			}
+			else {
+				BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
 			}
-			BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
 			if (ec) {
 				goto upcall;
 			}
+			d.s.on_reply(phase::final_reply);
 			if (d.s.resp_parser_.get().code() != reply_code::completed) {
 				ec = error::failed;
 				goto upcall;
@@ -203,21 +558,49 @@ namespace mail::smtp {
 			d_.invoke(ec);
 			return;
 		send_data_end_and_reset:
+			if (d.chunked) {
+				// a BDAT cut short cannot be ended
+				goto cancel_reply_upcall;
+			}
 			d.ec = ec;
-			BOOST_ASIO_CORO_YIELD
-				boost::asio::async_write(d.s.s_, detail::data_end_buffer(), std::move(*this));
+			BOOST_ASIO_CORO_YIELD {
+				if (d.end_queued) {
+					boost::asio::async_write(d.s.s_, d.s.wr_buf_.data(), std::move(*this));
+				}
+				else {
+					boost::asio::async_write(d.s.s_,
+											 boost::beast::buffers_cat(d.s.wr_buf_.data(), detail::data_end_buffer()),
+											 std::move(*this));
+				}
+			};
+			d.s.wr_buf_.consume(d.s.wr_buf_.size());
+			d.writing = false;
 			if (ec) {
 				//d.ec = error::critical_error;
+				if (d.s.early_abort_) {
+					goto cancel_reply_upcall;
+				}
 				goto reset_upcall;
 			}
-			BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
+			if (d.s.early_abort_) {
+				if (d.reading) {
+					BOOST_ASIO_CORO_YIELD d.wait->async_wait(std::move(*this));
+				}
+				ec = d.reply_ec;
+			}
+			else {
+				BOOST_ASIO_CORO_YIELD d.s.async_read_resp(std::move(*this));
+			}
 			if (ec) {
 				//d.ec = error::critical_error;
 				goto reset_upcall;
 			}
+			d.s.on_reply();
 			ec = d.ec;
 		send_reset:
 			d.ec = ec;
+			d.s.wr_buf_.consume(d.s.wr_buf_.size());
+			d.s.transcribe(detail::reset_buffer());
 			BOOST_ASIO_CORO_YIELD
 				boost::asio::async_write(d.s.s_, detail::reset_buffer(), std::move(*this));
 			if (ec) {
@@ -229,13 +612,260 @@ namespace mail::smtp {
 				//d.ec = error::critical_error;
 				goto reset_upcall;
 			}
+			d.s.on_reply();
 			if (d.s.resp_parser_.get().code() != reply_code::completed) {
 				//d.ec = error::critical_error;
 				goto reset_upcall;
 			}
 		reset_upcall:
-			d_.invoke(d.ec);
+			ec = d.ec;
+			d_.invoke(ec);
+			return;
+		premature_reply:
+			ec = d.reply_ec ? d.reply_ec : make_error_code(error::premature_reply);
+			goto upcall;
+		cancel_reply_upcall:
+			d.writing = false;
+			d.ec = ec;
+			if (d.reading) {
+				{
+					boost::beast::error_code ignored;
+					d.s.lowest_layer().cancel(ignored);
+				}
+				BOOST_ASIO_CORO_YIELD d.wait->async_wait(std::move(*this));
+			}
+			ec = d.ec;
+			goto upcall;
+		send_parts:
+			// encode_ahead: the next part is prepared while one is written
+			d.pipe = d.s.pipe_.get();
+			if (d.pipe->next == 0) {
+				d.pipe->next = write_buffer_size;
+			}
+			if (d.pipe->ex && !d.wait) {
+				detail::emplace_timer(d.wait, d.s.get_executor());
+				d.wait->expires_at((boost::asio::steady_timer::time_point::max)());
+			}
+			d.s.prepare_part(*d.sr, d.pipe->parts[0], d.pipe->next, ec);
+			if (ec) {
+				goto send_data_end_and_reset;
+			}
+			for (;;) {
+				d.last = d.sr->is_done();
+				d.prepared = d.last;
+				d.started = std::chrono::steady_clock::now();
+				BOOST_ASIO_CORO_YIELD {
+					const auto ex = get_executor();
+					boost::asio::async_write(d.s.s_, d.pipe->parts[d.front].data(), std::move(*this));
+					if (!d.prepared) {
+						d.prepare_next(ex);
+					}
+				};
+				d.pipe->measure(bytes, std::chrono::steady_clock::now() - d.started, write_buffer_size);
+				d.s.probe_.body_bytes(bytes);
+				d.ec = ec;
+				while (!d.prepared) {
+					d.awaiting = true;
+					BOOST_ASIO_CORO_YIELD d.wait->async_wait(std::move(*this));
+					d.awaiting = false;
+				}
+				ec = d.ec;
+				if (d.s.early_abort_) {
+					if (!d.reading) {
+						// the last part carries the end of data
+						if (!ec && d.last) {
+							break;
+						}
+						goto premature_reply;
+					}
+					if (ec) {
+						goto cancel_reply_upcall;
+					}
+				}
+				if (ec) {
+					goto send_data_end_and_reset;
+				}
+				if (d.last) {
+					break;
+				}
+				if (d.prepare_ec) {
+					ec = d.prepare_ec;
+					goto send_data_end_and_reset;
+				}
+				d.front = 1 - d.front;
+			}
+			d.end_queued = true;
+			d.s.transcribe(detail::data_end_buffer());
+			goto data_sent;
+		}
+	}
+
+	template <class Stream>
+	template <class ConstBufferSequence>
+	void session<Stream>::queue(const ConstBufferSequence& buffers, boost::beast::error_code& ec)
+	{
+		if (!try_queue(buffers)) {
+			ec = error::buffer_overflow;
+			return;
+		}
+		ec.assign(0, ec.category());
+	}
+	template <class Stream>
+	template <class ConstBufferSequence>
+	bool session<Stream>::try_queue(const ConstBufferSequence& buffers)
+	{
+		const auto n = boost::asio::buffer_size(buffers);
+		if (n > wr_buf_.capacity() - wr_buf_.size()) {
+			return false;
+		}
+		wr_buf_.commit(boost::asio::buffer_copy(wr_buf_.prepare(n), buffers));
+		transcribe(buffers);
+		return true;
+	}
+	template <class Stream>
+	template <class Body, class Fields, class DynamicBuffer>
+	bool session<Stream>::gather(mime::serializer<Body, Fields>& sr, DynamicBuffer& buffer,
+								 std::size_t limit, bool in_place, boost::beast::error_code& ec)
+	{
+		while (!sr.is_done()) {
+			const auto room = limit - (std::min)(limit, buffer.size());
+			if (room == 0) {
+				return false;
+			}
+			std::size_t n = 0;
+			bool large = false;
+			sr.next(ec, [this, &buffer, room, in_place, &n, &large](boost::beast::error_code& ec, const auto& buffers) {
+				ec.assign(0, ec.category());
+				const auto size = boost::asio::buffer_size(buffers);
+				if (in_place && size > room && !detail::is_ssl_stream<next_layer_type>::value && stuffer_.clean(buffers)) {
+					large = true;
+					return;
+				}
+				// over TLS every write is a record, so fill it completely
+				std::size_t produced;
+				n = stuffer_.copy(buffers, buffer.prepare(room), produced);
+				buffer.commit(produced);
+			});
+			if (ec) {
+				return false;
+			}
+			if (large) {
+				return true;
+			}
+			if (n == 0) {
+				// no room left for a doubled dot
+				return false;
+			}
+			sr.consume(n);
+		}
+		return false;
+	}
+	template <class Stream>
+	template <class Body, class Fields>
+	void session<Stream>::prepare_part(mime::serializer<Body, Fields>& sr, boost::beast::flat_buffer& part,
+									   std::size_t n, boost::beast::error_code& ec)
+	{
+		part.clear();
+		part.reserve(n + detail::data_end_buffer().size());
+		gather(sr, part, n, false, ec);
+		if (!ec && sr.is_done()) {
+			part.commit(boost::asio::buffer_copy(part.prepare(detail::data_end_buffer().size()), detail::data_end_buffer()));
+		}
+	}
+	template <class Stream>
+	template <class Body, class Fields>
+	void session<Stream>::consume_in_place(mime::serializer<Body, Fields>& sr, std::size_t n)
+	{
+		boost::beast::error_code ec;
+		sr.next(ec, [this, n](boost::beast::error_code& ec, const auto& buffers) {
+			ec.assign(0, ec.category());
+			stuffer_.skip(buffers, n);
+		});
+		sr.consume(n);
+	}
+	template <class Stream>
+	template <class ConstBufferSequence>
+	void session<Stream>::transcribe(const ConstBufferSequence& command)
+	{
+		if (transcript_ == nullptr) {
+			return;
+		}
+		char line[transcript::max_line];
+		boost::beast::string_view v{ line, boost::asio::buffer_copy(boost::asio::buffer(line), command) };
+		// the end of data is sent as "\r\n.\r\n"
+		while (!v.empty() && (v.front() == '\r' || v.front() == '\n')) {
+			v.remove_prefix(1);
+		}
+		while (!v.empty() && (v.back() == '\r' || v.back() == '\n')) {
+			v.remove_suffix(1);
+		}
+		transcript_->sent(v);
+	}
+	template <class Stream>
+	void session<Stream>::flush(boost::beast::error_code& ec)
+	{
+		const auto n = boost::asio::write(s_, wr_buf_.data(), ec);
+		wr_buf_.consume(n);
+	}
+	template <class Stream>
+	template <class Body, class Fields>
+	detail::content_info session<Stream>::inspect(const mime::serializer<Body, Fields>& sr, boost::beast::error_code& ec) const
+	{
+		detail::content_info c;
+		const auto bdat = ext_.has(extension::binarymime) && ext_.has(extension::chunking);
+		if (ext_.has(extension::size) || bdat) {
+			c.size = sr.size(ec);
+			c.sized = !ec;
+		}
+		c.header = sr.header_class();
+		c.body = sr.body_class();
+		if (ec == boost::beast::http::error::need_more) {
+			ec.assign(0, ec.category());
+			c.size = 0;
+			c.body = mime::content_class::eight_bit;
+		}
+		return c;
+	}
+	template <class Stream>
+	detail::mail_parameters session<Stream>::mail_parameters(const detail::content_info& c, bool chunked, bool utf8,
+															 boost::beast::error_code& ec) const
+	{
+		ec.assign(0, ec.category());
+		detail::mail_parameters r;
+		if (ext_.has(extension::size) && c.sized) {
+			if (ext_.max_size() != 0 && c.size > ext_.max_size()) {
+				ec = error::size_exceeded;
+				return r;
+			}
+			r.size(c.size);
+		}
+		const auto cls = (std::max)(c.header, c.body);
+		if (chunked) {
+			r.body("BINARYMIME");
+		}
+		else if (cls == mime::content_class::binary) {
+			// neither 8BITMIME nor DATA allows it, the caller re-encodes it
+			ec = error::binary_not_supported;
+			return r;
+		}
+		else if (cls != mime::content_class::seven_bit && ext_.has(extension::eightbitmime)) {
+			r.body("8BITMIME");
+		}
+		if (ext_.has(extension::smtputf8) && (utf8 || c.header != mime::content_class::seven_bit)) {
+			r.smtputf8();
 		}
+		return r;
+	}
+
+	template <class Body, class Fields>
+	std::uint64_t data_size(const mime::serializer<Body, Fields>& sr, boost::beast::error_code& ec)
+	{
+		detail::dot_stuffer stuffer;
+		std::uint64_t n = 0;
+		sr.walk(ec, [&stuffer, &n](const auto& buffers) {
+			n += boost::asio::buffer_size(buffers) + stuffer.count(buffers);
+		});
+		return ec ? 0 : n + detail::data_end_buffer().size();
 	}
 
 	template <class Stream>
@@ -288,7 +918,33 @@ namespace mail::smtp {
 		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
 					  "SyncStream requirements not met");
 
-		boost::asio::write(s_, detail::mail_from_buffer(from), ec);
+		transfer_mail(from, to_first, to_last, nullptr, serializer, ec);
+	}
+	template <class Stream>
+	template <class Iterator, class Body, class Fields>
+	void session<Stream>::transfer_mail(boost::beast::string_view from,
+										Iterator to_first, Iterator to_last,
+										const envelope* env,
+										mime::serializer<Body, Fields>& serializer,
+										boost::beast::error_code& ec)
+	{
+		bool end_queued = false;
+		probe_.start();
+		const auto c = inspect(serializer, ec);
+		if (ec) {
+			return;
+		}
+		const auto chunked = this->chunked(c);
+		const auto params = mail_parameters(c, chunked, !detail::is_ascii(from) ||
+			std::any_of(to_first, to_last, [](const auto& to) { return !detail::is_ascii(to); }), ec);
+		if (ec) {
+			return;
+		}
+		queue(detail::mail_from_buffer(from, params.buffer(), env), ec);
+		if (ec) {
+			return;
+		}
+		flush(ec);
 		if (ec) {
 			return;
 		}
@@ -296,13 +952,20 @@ namespace mail::smtp {
 		if (ec) {
 			return;
 		}
+		on_reply(phase::mail);
 		if (resp_parser_.get().code() != reply_code::completed) {
 			ec = error::failed;
 			return;
 		}
 		{
-			for (auto iter = to_first; iter != to_last; ++iter) {
-				boost::asio::write(s_, detail::rcpt_to_buffer(*iter), ec);
+			std::size_t n = 0;
+			for (auto iter = to_first; iter != to_last; ++iter, ++n) {
+				probe_.start();
+				queue(detail::rcpt_to_buffer(*iter, env, n), ec);
+				if (ec) {
+					goto send_reset;
+				}
+				flush(ec);
 				if (ec) {
 					goto send_reset;
 				}
@@ -310,47 +973,84 @@ namespace mail::smtp {
 				if (ec) {
 					goto send_reset;
 				}
+				on_reply(phase::rcpt);
 				if (resp_parser_.get().code() != reply_code::completed) {
 					ec = error::failed;
 					goto send_reset;
 				}
 			}
 
-			boost::asio::write(s_, detail::data_buffer(), ec);
-			if (ec) {
-				goto send_reset;
-			}
-			read_resp(ec);
-			if (ec) {
-				goto send_reset;
+			probe_.start();
+			if (chunked) {
+				// the content follows the command in the same write, and
+				// nothing ends it
+				queue(detail::bdat_last_command(c.size).buffer(), ec);
+				if (ec) {
+					goto send_reset;
+				}
+				end_queued = true;
 			}
-			if (resp_parser_.get().code() != reply_code::start_mail_input) {
-				ec = error::failed;
-				goto send_reset;
+			else {
+				queue(detail::data_buffer(), ec);
+				if (ec) {
+					goto send_reset;
+				}
+				flush(ec);
+				if (ec) {
+					goto send_reset;
+				}
+				read_resp(ec);
+				if (ec) {
+					goto send_reset;
+				}
+				on_reply(phase::data);
+				if (resp_parser_.get().code() != reply_code::start_mail_input) {
+					ec = error::failed;
+					goto send_reset;
+				}
+				probe_.start();
 			}
 
 			serializer.split(false);
-			while (!serializer.is_done()) {
+			stuffer_.reset(!chunked);
+			while (!serializer.is_done() || !end_queued || wr_buf_.size() != 0) {
+				const auto in_place = gather(serializer, ec);
+				if (ec) {
+					goto send_data_end_and_reset;
+				}
+				if (serializer.is_done() && !end_queued) {
+					end_queued = try_queue(detail::data_end_buffer());
+				}
+				if (!in_place) {
+					probe_.body_bytes(wr_buf_.size());
+					flush(ec);
+					if (ec) {
+						return;
+					}
+					continue;
+				}
 				std::size_t bytes = 0;
-				serializer.next(ec, [&s = s_, &bytes](boost::beast::error_code& ec, const auto& buffers) {
-					bytes = s.write_some(buffers, ec);
+				serializer.next(ec, [this, &bytes](boost::beast::error_code& ec, const auto& buffers) {
+					bytes = s_.write_some(boost::beast::buffers_cat(wr_buf_.data(), buffers), ec);
 				});
+				const auto n = (std::min)(bytes, wr_buf_.size());
+				wr_buf_.consume(n);
+				if (bytes != n) {
+					consume_in_place(serializer, bytes - n);
+				}
+				probe_.body_bytes(bytes);
 				if (ec) {
 					goto send_data_end_and_reset;
 				}
-				if (bytes) {
-					serializer.consume(bytes);
-				}
 			}
+			probe_.stop(phase::body);
 
-			boost::asio::write(s_, detail::data_end_buffer(), ec);
-			if (ec) {
-				return;
-			}
+			probe_.start();
 			read_resp(ec);
 			if (ec) {
 				return;
 			}
+			on_reply(phase::final_reply);
 			if (resp_parser_.get().code() != reply_code::completed) {
 				ec = error::failed;
 				return;
@@ -358,9 +1058,19 @@ namespace mail::smtp {
 		}
 		return;
 	send_data_end_and_reset:
+		if (chunked) {
+			// a BDAT cut short cannot be ended
+			return;
+		}
 		{
 			boost::beast::error_code ec_send_end;
-			boost::asio::write(s_, detail::data_end_buffer(), ec_send_end);
+			if (end_queued) {
+				boost::asio::write(s_, wr_buf_.data(), ec_send_end);
+			}
+			else {
+				boost::asio::write(s_, boost::beast::buffers_cat(wr_buf_.data(), detail::data_end_buffer()), ec_send_end);
+			}
+			wr_buf_.consume(wr_buf_.size());
 			if (ec_send_end) {
 				//ec = error::critical_error;
 				return;
@@ -370,9 +1080,12 @@ namespace mail::smtp {
 				//ec = error::critical_error;
 				return;
 			}
+			on_reply();
 		}
 	send_reset:
+		wr_buf_.consume(wr_buf_.size());
 		boost::beast::error_code ec_reset;
+		transcribe(detail::reset_buffer());
 		boost::asio::write(s_, detail::reset_buffer(), ec_reset);
 		if (ec_reset) {
 			//ec = error::critical_error;
@@ -383,6 +1096,7 @@ namespace mail::smtp {
 			//ec = error::critical_error;
 			return;
 		}
+		on_reply();
 		if (resp_parser_.get().code() != reply_code::completed) {
 			//ec = error::critical_error;
 			return;
@@ -536,4 +1250,179 @@ namespace mail::smtp {
 
 		return init.result.get();
 	}
+
+	template <class Stream>
+	template <class Body, class Fields>
+	void session<Stream>::send_mail(const envelope& env,
+									mime::serializer<Body, Fields>& serializer)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		send_mail(env, serializer, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	template <class Body, class Fields>
+	void session<Stream>::send_mail(const envelope& env,
+									mime::serializer<Body, Fields>& serializer,
+									boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		transfer_mail(env.from(), env.recipients().begin(), env.recipients().end(), dsn(env), serializer, ec);
+	}
+
+	template <class Stream>
+	template <class Body, class Fields>
+	void session<Stream>::send_mail(const envelope& env,
+									const mime::entity<Body, Fields>& entity)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		boost::beast::error_code ec;
+		send_mail(env, entity, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+	}
+	template <class Stream>
+	template <class Body, class Fields>
+	void session<Stream>::send_mail(const envelope& env,
+									const mime::entity<Body, Fields>& entity,
+									boost::beast::error_code& ec)
+	{
+		static_assert(boost::beast::is_sync_stream<next_layer_type>::value,
+					  "SyncStream requirements not met");
+
+		mime::serializer<Body, Fields> sr{ entity };
+		transfer_mail(env.from(), env.recipients().begin(), env.recipients().end(), dsn(env), sr, ec);
+	}
+
+	template <class Stream>
+	template <class Body, class Fields, class SendHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		SendHandler, void(boost::beast::error_code)
+	) session<Stream>::async_send_mail(const envelope& env,
+									   mime::serializer<Body, Fields>& serializer,
+									   SendHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			SendHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		send_mail_op<
+			Body, Fields,
+			BOOST_ASIO_HANDLER_TYPE(
+				SendHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			env,
+			serializer
+		}();
+
+		return init.result.get();
+	}
+
+	template <class Stream>
+	template <class Body, class Fields, class SendHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		SendHandler, void(boost::beast::error_code)
+	) session<Stream>::async_send_mail(envelope&& env,
+									   mime::serializer<Body, Fields>& serializer,
+									   SendHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			SendHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		send_mail_op<
+			Body, Fields,
+			BOOST_ASIO_HANDLER_TYPE(
+				SendHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			std::move(env),
+			serializer
+		}();
+
+		return init.result.get();
+	}
+
+	template <class Stream>
+	template <class Body, class Fields, class SendHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		SendHandler, void(boost::beast::error_code)
+	) session<Stream>::async_send_mail(const envelope& env,
+									   const mime::entity<Body, Fields>& entity,
+									   SendHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			SendHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		send_mail_op<
+			Body, Fields,
+			BOOST_ASIO_HANDLER_TYPE(
+				SendHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			env,
+			entity
+		}();
+
+		return init.result.get();
+	}
+
+	template <class Stream>
+	template <class Body, class Fields, class SendHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		SendHandler, void(boost::beast::error_code)
+	) session<Stream>::async_send_mail(envelope&& env,
+									   const mime::entity<Body, Fields>& entity,
+									   SendHandler&& handler)
+	{
+		static_assert(boost::beast::is_async_stream<next_layer_type>::value,
+					  "AsyncStream requirements not met");
+
+		boost::asio::async_completion<
+			SendHandler,
+			void(boost::beast::error_code)> init{ handler };
+
+		send_mail_op<
+			Body, Fields,
+			BOOST_ASIO_HANDLER_TYPE(
+				SendHandler,
+				void(boost::beast::error_code)
+			)
+		>{
+			std::move(init.completion_handler),
+			*this,
+			std::move(env),
+			entity
+		}();
+
+		return init.result.get();
+	}
 }
@@ -0,0 +1,686 @@
+#pragma once
+
+#include "../spool.hpp"
+#include <boost/asio/buffer.hpp>
+#include <boost/crc.hpp>
+#include <boost/system/error_code.hpp>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mail::smtp {
+	namespace detail {
+		// positional reads and writes, safe to call from several threads
+		class spool_file {
+		public:
+			spool_file() = default;
+			spool_file(const spool_file&) = delete;
+			spool_file& operator=(const spool_file&) = delete;
+#ifdef _WIN32
+			~spool_file()
+			{
+				if (h_ != INVALID_HANDLE_VALUE) {
+					::CloseHandle(h_);
+				}
+			}
+			void open(const char* path, boost::beast::error_code& ec)
+			{
+				h_ = ::CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+								   OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if (h_ == INVALID_HANDLE_VALUE) {
+					return last_error(ec);
+				}
+				ec.assign(0, ec.category());
+			}
+			std::uint64_t size(boost::beast::error_code& ec) const
+			{
+				LARGE_INTEGER n;
+				if (!::GetFileSizeEx(h_, &n)) {
+					last_error(ec);
+					return 0;
+				}
+				ec.assign(0, ec.category());
+				return static_cast<std::uint64_t>(n.QuadPart);
+			}
+			std::size_t read(std::uint64_t offset, void* p, std::size_t n, boost::beast::error_code& ec) const
+			{
+				std::size_t total = 0;
+				while (total < n) {
+					OVERLAPPED ov{};
+					ov.Offset = static_cast<DWORD>(offset + total);
+					ov.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+					DWORD done = 0;
+					const auto chunk = static_cast<DWORD>((std::min<std::size_t>)(n - total, 1u << 30));
+					if (!::ReadFile(h_, static_cast<char*>(p) + total, chunk, &done, &ov)) {
+						if (::GetLastError() == ERROR_HANDLE_EOF) {
+							break;
+						}
+						last_error(ec);
+						return total;
+					}
+					if (done == 0) {
+						break;
+					}
+					total += done;
+				}
+				ec.assign(0, ec.category());
+				return total;
+			}
+			void write(std::uint64_t offset, const void* p, std::size_t n, boost::beast::error_code& ec)
+			{
+				std::size_t total = 0;
+				while (total < n) {
+					OVERLAPPED ov{};
+					ov.Offset = static_cast<DWORD>(offset + total);
+					ov.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+					DWORD done = 0;
+					const auto chunk = static_cast<DWORD>((std::min<std::size_t>)(n - total, 1u << 30));
+					if (!::WriteFile(h_, static_cast<const char*>(p) + total, chunk, &done, &ov)) {
+						return last_error(ec);
+					}
+					total += done;
+				}
+				ec.assign(0, ec.category());
+			}
+			void sync(boost::beast::error_code& ec)
+			{
+				if (!::FlushFileBuffers(h_)) {
+					return last_error(ec);
+				}
+				ec.assign(0, ec.category());
+			}
+			void truncate(std::uint64_t n, boost::beast::error_code& ec)
+			{
+				LARGE_INTEGER pos;
+				pos.QuadPart = static_cast<LONGLONG>(n);
+				if (!::SetFilePointerEx(h_, pos, nullptr, FILE_BEGIN) || !::SetEndOfFile(h_)) {
+					return last_error(ec);
+				}
+				ec.assign(0, ec.category());
+			}
+		private:
+			static void last_error(boost::beast::error_code& ec)
+			{
+				ec.assign(static_cast<int>(::GetLastError()), boost::system::system_category());
+			}
+
+			HANDLE h_ = INVALID_HANDLE_VALUE;
+#else
+			~spool_file()
+			{
+				if (fd_ != -1) {
+					::close(fd_);
+				}
+			}
+			void open(const char* path, boost::beast::error_code& ec)
+			{
+				fd_ = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+				if (fd_ == -1) {
+					return last_error(ec);
+				}
+				ec.assign(0, ec.category());
+			}
+			std::uint64_t size(boost::beast::error_code& ec) const
+			{
+				struct stat st;
+				if (::fstat(fd_, &st) != 0) {
+					last_error(ec);
+					return 0;
+				}
+				ec.assign(0, ec.category());
+				return static_cast<std::uint64_t>(st.st_size);
+			}
+			std::size_t read(std::uint64_t offset, void* p, std::size_t n, boost::beast::error_code& ec) const
+			{
+				std::size_t total = 0;
+				while (total < n) {
+					const auto r = ::pread(fd_, static_cast<char*>(p) + total, n - total,
+										   static_cast<off_t>(offset + total));
+					if (r < 0) {
+						if (errno == EINTR) {
+							continue;
+						}
+						last_error(ec);
+						return total;
+					}
+					if (r == 0) {
+						break;
+					}
+					total += static_cast<std::size_t>(r);
+				}
+				ec.assign(0, ec.category());
+				return total;
+			}
+			void write(std::uint64_t offset, const void* p, std::size_t n, boost::beast::error_code& ec)
+			{
+				std::size_t total = 0;
+				while (total < n) {
+					const auto r = ::pwrite(fd_, static_cast<const char*>(p) + total, n - total,
+											static_cast<off_t>(offset + total));
+					if (r < 0) {
+						if (errno == EINTR) {
+							continue;
+						}
+						return last_error(ec);
+					}
+					total += static_cast<std::size_t>(r);
+				}
+				ec.assign(0, ec.category());
+			}
+			void sync(boost::beast::error_code& ec)
+			{
+#if defined(__APPLE__)
+				// fsync does not reach the platter on macOS
+				if (::fcntl(fd_, F_FULLFSYNC) == 0) {
+					ec.assign(0, ec.category());
+					return;
+				}
+				if (::fsync(fd_) != 0) {
+#else
+				if (::fdatasync(fd_) != 0) {
+#endif
+					return last_error(ec);
+				}
+				ec.assign(0, ec.category());
+			}
+			void truncate(std::uint64_t n, boost::beast::error_code& ec)
+			{
+				if (::ftruncate(fd_, static_cast<off_t>(n)) != 0) {
+					return last_error(ec);
+				}
+				ec.assign(0, ec.category());
+			}
+		private:
+			static void last_error(boost::beast::error_code& ec)
+			{
+				ec.assign(errno, boost::system::generic_category());
+			}
+
+			int fd_ = -1;
+#endif
+		};
+
+		// Record layout, in host byte order:
+		//	u32 size, u32 crc32 of the payload, payload
+		// message payload:
+		//	u8 1, u64 id, u32 n + from, u32 count, (u32 n + recipient)..., u64 n + entity
+		// state payload:
+		//	u8 2, u64 id, u32 recipient, u8 state
+		// message with DSN parameters, ENVID and ORCPT as xtext:
+		//	u8 3, u64 id, u32 n + from, u8 ret, u32 n + envid, u32 count,
+		//	(u32 n + recipient, u8 notify, u32 n + orcpt)..., u64 n + entity
+		enum class spool_record : std::uint8_t {
+			message = 1,
+			state = 2,
+			message_dsn = 3,
+		};
+		std::size_t constexpr spool_record_header = 8;
+
+		template <class T>
+		void spool_put(std::vector<char>& v, T t)
+		{
+			const auto n = v.size();
+			v.resize(n + sizeof(t));
+			std::memcpy(&v[n], &t, sizeof(t));
+		}
+		inline void spool_put(std::vector<char>& v, boost::beast::string_view s)
+		{
+			spool_put(v, static_cast<std::uint32_t>(s.size()));
+			v.insert(v.end(), s.begin(), s.end());
+		}
+		inline std::size_t spool_begin(std::vector<char>& v, spool_record type)
+		{
+			const auto start = v.size();
+			v.resize(start + spool_record_header);
+			spool_put(v, static_cast<std::uint8_t>(type));
+			return start;
+		}
+		inline void spool_end(std::vector<char>& v, std::size_t start)
+		{
+			const auto payload = start + spool_record_header;
+			const auto size = static_cast<std::uint32_t>(v.size() - payload);
+			boost::crc_32_type crc;
+			crc.process_bytes(v.data() + payload, size);
+			const auto sum = static_cast<std::uint32_t>(crc.checksum());
+			std::memcpy(&v[start], &size, 4);
+			std::memcpy(&v[start + 4], &sum, 4);
+		}
+
+		// bounds checked reads from a record payload
+		class spool_reader {
+		public:
+			spool_reader(const char* p, std::size_t n)
+				: p_(p)
+				, n_(n)
+			{
+			}
+			template <class T>
+			bool get(T& t)
+			{
+				if (n_ - i_ < sizeof(t)) {
+					return false;
+				}
+				std::memcpy(&t, p_ + i_, sizeof(t));
+				i_ += sizeof(t);
+				return true;
+			}
+			bool get(boost::beast::string_view& s)
+			{
+				std::uint32_t n;
+				if (!get(n) || n_ - i_ < n) {
+					return false;
+				}
+				s = { p_ + i_, n };
+				i_ += n;
+				return true;
+			}
+			std::size_t position() const
+			{
+				return i_;
+			}
+			std::size_t remaining() const
+			{
+				return n_ - i_;
+			}
+		private:
+			const char* p_;
+			std::size_t n_;
+			std::size_t i_ = 0;
+		};
+	}
+
+	inline spool::spool() = default;
+	inline spool::~spool() = default;
+
+	inline bool spool::is_open() const
+	{
+		return file_ != nullptr;
+	}
+	inline void spool::open(const char* path, boost::beast::error_code& ec)
+	{
+		std::unique_ptr<detail::spool_file> f{ new detail::spool_file };
+		f->open(path, ec);
+		if (ec) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock{ m_ };
+		file_ = std::move(f);
+		entries_.clear();
+		buf_.clear();
+		appended_ = synced_ = 0;
+		closing_ = false;
+		sync_ec_ = {};
+		recover(ec);
+		if (ec) {
+			file_.reset();
+		}
+	}
+	inline void spool::close(boost::beast::error_code& ec)
+	{
+		commit(ec);
+		std::unique_lock<std::mutex> lock{ m_ };
+		if (!file_) {
+			// nothing to close
+			ec.assign(0, ec.category());
+		}
+		// a commit which led a sync after ours still uses the file
+		closing_ = true;
+		cv_.wait(lock, [this] {
+			return !syncing_;
+		});
+		file_.reset();
+		entries_.clear();
+	}
+
+	inline void spool::recover(boost::beast::error_code& ec)
+	{
+		const auto size = file_->size(ec);
+		if (ec) {
+			return;
+		}
+		std::uint64_t max_id = 0;
+		std::uint64_t offset = 0;
+		// read in large blocks, a record never straddles the end of the window
+		std::vector<char> window;
+		std::uint64_t window_offset = 0;
+		const auto load = [&](std::uint64_t at, std::size_t n) {
+			if (at >= window_offset && at + n <= window_offset + window.size()) {
+				return true;
+			}
+			window.resize((std::max)(n, std::size_t{ 1 } << 20));
+			window_offset = at;
+			const auto got = file_->read(at, window.data(), window.size(), ec);
+			window.resize(got);
+			return !ec && got >= n;
+		};
+		// a record that does not parse changes nothing
+		const auto apply = [&](const char* p, std::uint32_t n, std::uint64_t at) {
+			detail::spool_reader r{ p, n };
+			std::uint8_t type = 0;
+			std::uint64_t id = 0;
+			if (!r.get(type) || !r.get(id)) {
+				return;
+			}
+			if (type == static_cast<std::uint8_t>(detail::spool_record::message) ||
+				type == static_cast<std::uint8_t>(detail::spool_record::message_dsn)) {
+				const auto dsn = type == static_cast<std::uint8_t>(detail::spool_record::message_dsn);
+				entry e;
+				e.id = id;
+				boost::beast::string_view s;
+				std::uint32_t count = 0;
+				if (!r.get(s)) {
+					return;
+				}
+				e.envelope.from(s);
+				if (dsn) {
+					std::uint8_t ret = 0;
+					if (!r.get(ret) || !r.get(s)) {
+						return;
+					}
+					e.envelope.ret(static_cast<dsn_return>(ret));
+					e.envelope.envid(detail::decode_xtext(s));
+				}
+				if (!r.get(count)) {
+					return;
+				}
+				bool ok = true;
+				for (std::uint32_t i = 0; ok && i < count; ++i) {
+					ok = r.get(s);
+					if (ok && dsn) {
+						std::uint8_t notify = 0;
+						boost::beast::string_view orcpt;
+						ok = r.get(notify) && r.get(orcpt);
+						if (ok) {
+							e.envelope.add_recipient(s, static_cast<dsn_notify>(notify), detail::decode_xtext(orcpt));
+						}
+					}
+					else if (ok) {
+						e.envelope.add_recipient(s);
+					}
+				}
+				if (!ok || !r.get(e.size) || r.remaining() != e.size) {
+					return;
+				}
+				e.offset = at + r.position();
+				e.states.assign(count, spool_state::queued);
+				max_id = (std::max)(max_id, id);
+				entries_[id] = std::move(e);
+			}
+			else if (type == static_cast<std::uint8_t>(detail::spool_record::state)) {
+				std::uint32_t recipient;
+				std::uint8_t state;
+				if (!r.get(recipient) || !r.get(state)) {
+					return;
+				}
+				apply_state(id, recipient, static_cast<spool_state>(state));
+			}
+		};
+		while (offset + detail::spool_record_header <= size) {
+			if (!load(offset, detail::spool_record_header)) {
+				break;
+			}
+			const char* h = window.data() + (offset - window_offset);
+			std::uint32_t n, sum;
+			std::memcpy(&n, h, 4);
+			std::memcpy(&sum, h + 4, 4);
+			if (offset + detail::spool_record_header + n > size ||
+				!load(offset, detail::spool_record_header + n)) {
+				break;
+			}
+			const char* p = window.data() + (offset - window_offset) + detail::spool_record_header;
+			boost::crc_32_type crc;
+			crc.process_bytes(p, n);
+			// a record damaged in place is skipped by its length, the ones
+			// after it are still good
+			if (crc.checksum() == sum) {
+				apply(p, n, offset + detail::spool_record_header);
+			}
+			offset += detail::spool_record_header + n;
+		}
+		if (ec) {
+			return;
+		}
+		if (offset != size) {
+			// torn write at the end of the segment
+			file_->truncate(offset, ec);
+			if (ec) {
+				return;
+			}
+		}
+		// the process died while these were being sent
+		for (auto& e : entries_) {
+			std::replace(e.second.states.begin(), e.second.states.end(),
+						 spool_state::in_flight, spool_state::queued);
+		}
+		next_id_ = max_id + 1;
+		written_ = end_ = offset;
+	}
+
+	inline void spool::append(std::vector<char>& record, entry&& e)
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		e.offset += end_;
+		buf_.insert(buf_.end(), record.begin(), record.end());
+		end_ += record.size();
+		appended_ += record.size();
+		const auto id = e.id;
+		entries_[id] = std::move(e);
+	}
+	template <class Body, class Fields>
+	std::uint64_t spool::enqueue(const envelope& env,
+								 const mime::entity<Body, Fields>& entity,
+								 boost::beast::error_code& ec)
+	{
+		entry e;
+		e.id = next_id_++;
+		e.envelope = env;
+		e.states.assign(env.recipients().size(), spool_state::queued);
+
+		// built outside the lock, producers only contend for the copy
+		std::vector<char> record;
+		const auto dsn = env.has_dsn();
+		const auto start = detail::spool_begin(record, dsn ? detail::spool_record::message_dsn : detail::spool_record::message);
+		detail::spool_put(record, e.id);
+		detail::spool_put(record, env.from());
+		if (dsn) {
+			detail::spool_put(record, static_cast<std::uint8_t>(env.ret()));
+			detail::spool_put(record, env.envid());
+		}
+		detail::spool_put(record, static_cast<std::uint32_t>(env.recipients().size()));
+		for (std::size_t i = 0; i != env.recipients().size(); ++i) {
+			detail::spool_put(record, boost::beast::string_view{ env.recipients()[i] });
+			if (dsn) {
+				detail::spool_put(record, static_cast<std::uint8_t>(env.notify(i)));
+				detail::spool_put(record, env.orcpt(i));
+			}
+		}
+		const auto size_pos = record.size();
+		detail::spool_put(record, std::uint64_t{ 0 });
+		e.offset = record.size();
+
+		mime::serializer<Body, Fields> sr{ entity };
+		while (!sr.is_done()) {
+			std::size_t n = 0;
+			sr.next(ec, [&record, &n](boost::beast::error_code& ec, const auto& buffers) {
+				ec.assign(0, ec.category());
+				n = boost::asio::buffer_size(buffers);
+				const auto pos = record.size();
+				record.resize(pos + n);
+				boost::asio::buffer_copy(boost::asio::buffer(&record[pos], n), buffers);
+			});
+			if (ec) {
+				return 0;
+			}
+			sr.consume(n);
+		}
+		e.size = record.size() - e.offset;
+		std::memcpy(&record[size_pos], &e.size, sizeof(e.size));
+		detail::spool_end(record, start);
+
+		const auto id = e.id;
+		append(record, std::move(e));
+		return id;
+	}
+	inline void spool::apply_state(std::uint64_t id, std::uint32_t recipient, spool_state state)
+	{
+		const auto it = entries_.find(id);
+		if (it == entries_.end()) {
+			return;
+		}
+		auto& states = it->second.states;
+		if (recipient == static_cast<std::uint32_t>(all_recipients)) {
+			std::fill(states.begin(), states.end(), state);
+		}
+		else if (recipient < states.size()) {
+			states[recipient] = state;
+		}
+		const auto done = std::all_of(states.begin(), states.end(), [](spool_state s) {
+			return s == spool_state::delivered || s == spool_state::failed;
+		});
+		if (done) {
+			entries_.erase(it);
+		}
+	}
+	inline void spool::mark(std::uint64_t id, std::size_t recipient, spool_state state,
+							boost::beast::error_code& ec)
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		const auto it = entries_.find(id);
+		if (it == entries_.end() ||
+			(recipient != all_recipients && recipient >= it->second.states.size())) {
+			ec = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+			return;
+		}
+		const auto start = detail::spool_begin(buf_, detail::spool_record::state);
+		detail::spool_put(buf_, id);
+		detail::spool_put(buf_, static_cast<std::uint32_t>(recipient));
+		detail::spool_put(buf_, static_cast<std::uint8_t>(state));
+		detail::spool_end(buf_, start);
+		end_ += buf_.size() - start;
+		appended_ += buf_.size() - start;
+		apply_state(id, static_cast<std::uint32_t>(recipient), state);
+		ec.assign(0, ec.category());
+	}
+	inline void spool::commit(boost::beast::error_code& ec)
+	{
+		std::unique_lock<std::mutex> lock{ m_ };
+		if (!file_) {
+			ec = boost::system::errc::make_error_code(boost::system::errc::bad_file_descriptor);
+			return;
+		}
+		const auto target = appended_;
+		while (syncing_ && synced_ < target && !sync_ec_) {
+			// a sync is running, it may already cover our records
+			cv_.wait(lock);
+		}
+		if (sync_ec_) {
+			ec = sync_ec_;
+			return;
+		}
+		if (synced_ >= target) {
+			ec.assign(0, ec.category());
+			return;
+		}
+		if (closing_) {
+			ec = boost::system::errc::make_error_code(boost::system::errc::bad_file_descriptor);
+			return;
+		}
+		// lead a sync of everything buffered so far
+		syncing_ = true;
+		std::vector<char> data;
+		data.swap(buf_);
+		const auto offset = end_ - data.size();
+		const auto upto = appended_;
+		lock.unlock();
+
+		file_->write(offset, data.data(), data.size(), ec);
+		if (!ec) {
+			file_->sync(ec);
+		}
+
+		lock.lock();
+		syncing_ = false;
+		if (ec) {
+			// the segment has a hole now, stop accepting commits
+			sync_ec_ = ec;
+		}
+		else {
+			written_ = offset + data.size();
+			synced_ = upto;
+			if (buf_.empty()) {
+				// keep the capacity for the next batch
+				data.clear();
+				buf_.swap(data);
+			}
+		}
+		cv_.notify_all();
+	}
+
+	inline bool spool::find(std::uint64_t id, entry& out) const
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		const auto it = entries_.find(id);
+		if (it == entries_.end()) {
+			return false;
+		}
+		out = it->second;
+		return true;
+	}
+	inline void spool::pending(std::vector<std::uint64_t>& out) const
+	{
+		out.clear();
+		std::lock_guard<std::mutex> lock{ m_ };
+		for (const auto& e : entries_) {
+			const auto& states = e.second.states;
+			const auto any = std::any_of(states.begin(), states.end(), [](spool_state s) {
+				return s == spool_state::queued || s == spool_state::deferred;
+			});
+			if (any) {
+				out.push_back(e.first);
+			}
+		}
+		std::sort(out.begin(), out.end());
+	}
+	inline void spool::read_body(std::uint64_t id, std::string& out, boost::beast::error_code& ec) const
+	{
+		std::uint64_t offset, size;
+		{
+			std::unique_lock<std::mutex> lock{ m_ };
+			const auto it = entries_.find(id);
+			if (it == entries_.end()) {
+				ec = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+				return;
+			}
+			offset = it->second.offset;
+			size = it->second.size;
+			const auto buffered = end_ - buf_.size();
+			if (offset >= buffered) {
+				// not written yet
+				out.assign(buf_.data() + (offset - buffered), static_cast<std::size_t>(size));
+				ec.assign(0, ec.category());
+				return;
+			}
+			// being written by a commit
+			cv_.wait(lock, [&] {
+				return offset + size <= written_ || sync_ec_;
+			});
+			if (sync_ec_) {
+				ec = sync_ec_;
+				return;
+			}
+		}
+		out.resize(static_cast<std::size_t>(size));
+		const auto n = file_->read(offset, &out[0], out.size(), ec);
+		if (!ec && n != out.size()) {
+			ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+		}
+	}
+}
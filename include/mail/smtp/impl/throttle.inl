@@ -0,0 +1,167 @@
+#pragma once
+
+#include "../throttle.hpp"
+#include <algorithm>
+#include <mutex>
+
+namespace mail::smtp {
+	namespace detail {
+		inline std::int64_t interval_ns(double rate)
+		{
+			return rate > 0 ? static_cast<std::int64_t>(1e9 / rate) : 0;
+		}
+	}
+
+	inline token_bucket::token_bucket(double rate, double burst)
+		: interval_(detail::interval_ns(rate))
+		, burst_((std::max)(burst, 1.0))
+	{
+	}
+	inline double token_bucket::rate() const
+	{
+		const auto i = interval_.load(std::memory_order_relaxed);
+		return i == 0 ? 0 : 1e9 / static_cast<double>(i);
+	}
+	inline void token_bucket::rate(double v)
+	{
+		interval_.store(detail::interval_ns(v), std::memory_order_relaxed);
+	}
+	inline token_bucket::clock::duration token_bucket::wait(double n, clock::time_point now) const
+	{
+		const auto interval = interval_.load(std::memory_order_relaxed);
+		const auto t = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+		const auto tolerance = static_cast<std::int64_t>(burst_ * static_cast<double>(interval));
+		const auto next = (std::max)(tat_.load(std::memory_order_relaxed), t) +
+			(std::min)(static_cast<std::int64_t>(n * static_cast<double>(interval)), tolerance);
+		return next - t > tolerance
+			? std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds{ next - t - tolerance })
+			: clock::duration::zero();
+	}
+	inline token_bucket::clock::duration token_bucket::try_acquire(double n, clock::time_point now)
+	{
+		const auto interval = interval_.load(std::memory_order_relaxed);
+		if (interval == 0) {
+			return clock::duration::zero();
+		}
+		const auto t = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+		const auto cost = static_cast<std::int64_t>(n * static_cast<double>(interval));
+		const auto tolerance = static_cast<std::int64_t>(burst_ * static_cast<double>(interval));
+		auto tat = tat_.load(std::memory_order_relaxed);
+		while (true) {
+			// more than burst tokens are taken from a full bucket, which
+			// stays in debt for the rest
+			const auto start = (std::max)(tat, t);
+			if (start + (std::min)(cost, tolerance) - t > tolerance) {
+				return std::chrono::duration_cast<clock::duration>(
+					std::chrono::nanoseconds{ start + (std::min)(cost, tolerance) - t - tolerance });
+			}
+			if (tat_.compare_exchange_weak(tat, start + cost, std::memory_order_relaxed)) {
+				return clock::duration::zero();
+			}
+		}
+	}
+	inline void token_bucket::release(double n)
+	{
+		const auto interval = interval_.load(std::memory_order_relaxed);
+		tat_.fetch_sub(static_cast<std::int64_t>(n * static_cast<double>(interval)), std::memory_order_relaxed);
+	}
+
+	inline destination_throttle::destination_throttle(const destination_limits& limits)
+		: limits_(limits)
+		, messages_(limits.messages_per_second, limits.burst)
+		, recipients_(limits.recipients_per_second, limits.burst)
+	{
+	}
+	inline bool destination_throttle::try_connect()
+	{
+		if (limits_.max_connections == 0) {
+			connections_.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+		const auto max = (std::max)(1u, limits_.max_connections * scale() / 1000);
+		auto n = connections_.load(std::memory_order_relaxed);
+		do {
+			if (n >= max) {
+				return false;
+			}
+		} while (!connections_.compare_exchange_weak(n, n + 1, std::memory_order_relaxed));
+		return true;
+	}
+	inline void destination_throttle::disconnect()
+	{
+		connections_.fetch_sub(1, std::memory_order_relaxed);
+	}
+	inline destination_throttle::clock::duration destination_throttle::try_send(std::size_t recipients, clock::time_point now)
+	{
+		const auto n = static_cast<double>(recipients);
+		const auto wait = (std::max)(messages_.wait(1, now), recipients_.wait(n, now));
+		if (wait != clock::duration::zero()) {
+			return wait;
+		}
+		auto taken = recipients_.try_acquire(n, now);
+		if (taken != clock::duration::zero()) {
+			return taken;
+		}
+		taken = messages_.try_acquire(1, now);
+		if (taken != clock::duration::zero()) {
+			// lost a race for the message token
+			recipients_.release(n);
+		}
+		return taken;
+	}
+	inline void destination_throttle::on_reply(reply_code code)
+	{
+		auto s = scale();
+		unsigned next;
+		do {
+			if (code == reply_code::service_not_available ||
+				code == reply_code::local_error_in_processing) {
+				// back off hard, but never stop
+				next = (std::max)(50u, s * 7 / 10);
+			}
+			else if (classify(code) == delivery_status::delivered) {
+				next = (std::min)(1000u, s + 1);
+			}
+			else {
+				return;
+			}
+			if (next == s) {
+				return;
+			}
+		} while (!scale_.compare_exchange_weak(s, next, std::memory_order_relaxed));
+		apply(next);
+	}
+	inline void destination_throttle::apply(unsigned scale)
+	{
+		const auto f = static_cast<double>(scale) / 1000;
+		messages_.rate(limits_.messages_per_second * f);
+		recipients_.rate(limits_.recipients_per_second * f);
+	}
+
+	inline bool throttle::set_limits(boost::beast::string_view destination, const destination_limits& limits)
+	{
+		std::unique_lock<std::shared_mutex> lock{ m_ };
+		auto& p = map_[std::string{ destination.data(), destination.size() }];
+		if (p) {
+			return false;
+		}
+		p.reset(new destination_throttle{ limits });
+		return true;
+	}
+	inline destination_throttle& throttle::get(boost::beast::string_view destination)
+	{
+		{
+			std::shared_lock<std::shared_mutex> lock{ m_ };
+			const auto it = map_.find(destination);
+			if (it != map_.end()) {
+				return *it->second;
+			}
+		}
+		std::unique_lock<std::shared_mutex> lock{ m_ };
+		auto& p = map_[std::string{ destination.data(), destination.size() }];
+		if (!p) {
+			p.reset(new destination_throttle{ defaults_ });
+		}
+		return *p;
+	}
+}
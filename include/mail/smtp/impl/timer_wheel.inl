@@ -0,0 +1,147 @@
+#pragma once
+
+#include "../timer_wheel.hpp"
+#include <utility>
+
+namespace mail::smtp {
+	template <class T>
+	timer_wheel<T>::timer_wheel(std::uint64_t now)
+		: now_(now)
+	{
+		heads_.fill(nil);
+	}
+
+	template <class T>
+	std::uint32_t timer_wheel<T>::allocate()
+	{
+		if (free_ != nil) {
+			const auto i = free_;
+			free_ = nodes_[i].next;
+			return i;
+		}
+		nodes_.emplace_back();
+		return static_cast<std::uint32_t>(nodes_.size() - 1);
+	}
+	template <class T>
+	void timer_wheel<T>::release(std::uint32_t i)
+	{
+		auto& n = nodes_[i];
+		n.value = boost::none;
+		++n.generation;
+		n.next = free_;
+		free_ = i;
+		--size_;
+	}
+	template <class T>
+	void timer_wheel<T>::link(std::uint32_t i, bool cascading)
+	{
+		auto& n = nodes_[i];
+		if (n.expiry <= now_) {
+			// moved down on the tick it expires, it fires with that tick's slot
+			n.expiry = cascading ? now_ : now_ + 1;
+		}
+		// the level of the highest bit in which it differs from the current time
+		const auto diff = n.expiry ^ now_;
+		unsigned level = 0;
+		while (level + 1 < levels && (diff >> (bits * (level + 1))) != 0) {
+			++level;
+		}
+		std::uint64_t index = n.expiry >> (bits * level);
+		if (n.expiry - now_ >= (std::uint64_t{ 1 } << (bits * levels))) {
+			// too far out, park in the last slot of the top level and place it again then
+			index = (now_ >> (bits * level)) - 1;
+		}
+		n.slot = static_cast<std::uint16_t>(level * slots + (index & (slots - 1)));
+		n.prev = nil;
+		n.next = heads_[n.slot];
+		if (n.next != nil) {
+			nodes_[n.next].prev = i;
+		}
+		heads_[n.slot] = i;
+		n.linked = true;
+	}
+	template <class T>
+	void timer_wheel<T>::unlink(std::uint32_t i)
+	{
+		auto& n = nodes_[i];
+		if (n.prev != nil) {
+			nodes_[n.prev].next = n.next;
+		}
+		else {
+			heads_[n.slot] = n.next;
+		}
+		if (n.next != nil) {
+			nodes_[n.next].prev = n.prev;
+		}
+		n.linked = false;
+	}
+	template <class T>
+	void timer_wheel<T>::cascade(unsigned level)
+	{
+		const auto slot = level * slots + ((now_ >> (bits * level)) & (slots - 1));
+		auto i = heads_[slot];
+		heads_[slot] = nil;
+		while (i != nil) {
+			const auto next = nodes_[i].next;
+			link(i, true);
+			i = next;
+		}
+	}
+
+	template <class T>
+	auto timer_wheel<T>::insert(std::uint64_t expiry, T value) -> handle
+	{
+		const auto i = allocate();
+		auto& n = nodes_[i];
+		n.value.emplace(std::move(value));
+		n.expiry = expiry;
+		++size_;
+		link(i);
+		return static_cast<handle>(n.generation) << 32 | i;
+	}
+	template <class T>
+	bool timer_wheel<T>::cancel(handle h)
+	{
+		const auto i = static_cast<std::uint32_t>(h);
+		if (i >= nodes_.size() ||
+			nodes_[i].generation != static_cast<std::uint32_t>(h >> 32) ||
+			!nodes_[i].linked) {
+			return false;
+		}
+		unlink(i);
+		release(i);
+		return true;
+	}
+	template <class T>
+	template <class F>
+	void timer_wheel<T>::advance(std::uint64_t now, F&& f)
+	{
+		while (now_ < now) {
+			if (size_ == 0) {
+				now_ = now;
+				return;
+			}
+			++now_;
+			for (unsigned level = levels - 1; level != 0; --level) {
+				if ((now_ & ((std::uint64_t{ 1 } << (bits * level)) - 1)) == 0) {
+					cascade(level);
+				}
+			}
+			const auto slot = now_ & (slots - 1);
+			auto i = heads_[slot];
+			heads_[slot] = nil;
+			// detached before f runs, so it can neither cancel nor reach them
+			for (auto j = i; j != nil; j = nodes_[j].next) {
+				nodes_[j].linked = false;
+			}
+			while (i != nil) {
+				auto& n = nodes_[i];
+				const auto next = n.next;
+				T value = std::move(*n.value);
+				release(i);
+				f(std::move(value));
+				i = next;
+			}
+		}
+	}
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "../tls_session_cache.hpp"
+
+namespace mail::smtp {
+	inline tls_session_cache::~tls_session_cache()
+	{
+		for (const auto ctx : contexts_) {
+			SSL_CTX_sess_set_new_cb(ctx, nullptr);
+			SSL_CTX_set_info_callback(ctx, nullptr);
+			SSL_CTX_set_ex_data(ctx, context_index(), nullptr);
+			SSL_CTX_free(ctx);
+		}
+		for (const auto& p : sessions_) {
+			if (p.second != nullptr) {
+				SSL_SESSION_free(p.second);
+			}
+		}
+	}
+
+	inline int tls_session_cache::context_index()
+	{
+		static const int i = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+		return i;
+	}
+	inline int tls_session_cache::destination_index()
+	{
+		static const int i = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+		return i;
+	}
+	inline int tls_session_cache::counted_index()
+	{
+		static const int i = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+		return i;
+	}
+
+	inline void tls_session_cache::attach(boost::asio::ssl::context& ctx)
+	{
+		const auto h = ctx.native_handle();
+		{
+			std::lock_guard<std::mutex> lock{ m_ };
+			SSL_CTX_up_ref(h);
+			contexts_.push_back(h);
+		}
+		SSL_CTX_set_ex_data(h, context_index(), this);
+		// the cache is ours, OpenSSL only hands out new sessions
+		SSL_CTX_set_session_cache_mode(h, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(h, &tls_session_cache::on_new_session);
+		SSL_CTX_set_info_callback(h, &tls_session_cache::on_info);
+	}
+
+	inline void tls_session_cache::prepare(SSL* ssl, boost::beast::string_view destination)
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		auto it = sessions_.find(destination);
+		if (it == sessions_.end()) {
+			it = sessions_.emplace(std::string{ destination.data(), destination.size() }, nullptr).first;
+		}
+		SSL_set_ex_data(ssl, destination_index(), const_cast<std::string*>(&it->first));
+		if (it->second != nullptr && SSL_SESSION_is_resumable(it->second)) {
+			SSL_set_session(ssl, it->second);
+		}
+	}
+	inline void tls_session_cache::erase(boost::beast::string_view destination)
+	{
+		std::lock_guard<std::mutex> lock{ m_ };
+		const auto it = sessions_.find(destination);
+		if (it != sessions_.end() && it->second != nullptr) {
+			SSL_SESSION_free(it->second);
+			it->second = nullptr;
+		}
+	}
+
+	inline int tls_session_cache::on_new_session(SSL* ssl, SSL_SESSION* session)
+	{
+		const auto c = static_cast<tls_session_cache*>(
+			SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), context_index()));
+		const auto destination = static_cast<const std::string*>(SSL_get_ex_data(ssl, destination_index()));
+		if (c == nullptr || destination == nullptr) {
+			return 0;
+		}
+		std::lock_guard<std::mutex> lock{ c->m_ };
+		auto& p = c->sessions_.find(*destination)->second;
+		if (p != nullptr) {
+			SSL_SESSION_free(p);
+		}
+		// returning 1 keeps the reference OpenSSL passed in
+		p = session;
+		return 1;
+	}
+	inline void tls_session_cache::on_info(const SSL* ssl, int where, int)
+	{
+		if ((where & SSL_CB_HANDSHAKE_DONE) == 0) {
+			return;
+		}
+		const auto c = static_cast<tls_session_cache*>(
+			SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), context_index()));
+		// TLS 1.3 reports every ticket received after the handshake as one
+		const auto s = const_cast<SSL*>(ssl);
+		if (c == nullptr || SSL_get_ex_data(s, counted_index()) != nullptr) {
+			return;
+		}
+		SSL_set_ex_data(s, counted_index(), c);
+		if (SSL_session_reused(s)) {
+			c->resumed_.fetch_add(1, std::memory_order_relaxed);
+		}
+		else {
+			c->full_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "../transcript.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+namespace mail::smtp {
+	inline transcript::transcript(std::size_t capacity)
+		: capacity_((std::max)(capacity, std::size_t{ 1 }))
+		, slots_(new slot[capacity_])
+	{
+	}
+
+	inline void transcript::sent(boost::beast::string_view line)
+	{
+		record(direction::sent, reply_code::unknown, false, line);
+	}
+	inline void transcript::received(reply_code code, bool more, boost::beast::string_view line)
+	{
+		record(direction::received, code, more, line);
+	}
+	inline void transcript::record(direction dir, reply_code code, bool more, boost::beast::string_view line)
+	{
+		const auto size = (std::min)(line.size(), max_line);
+		std::array<std::uint64_t, max_line / 8> words;
+		const auto used = (size + 7) / 8;
+		if (used != 0) {
+			words[used - 1] = 0;
+			std::memcpy(words.data(), line.data(), size);
+		}
+
+		const auto n = head_.load(std::memory_order_relaxed);
+		auto& s = slots_[n % capacity_];
+		const auto seq = s.seq.load(std::memory_order_relaxed);
+		s.seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		s.time.store(std::chrono::duration_cast<std::chrono::microseconds>(
+			clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+		s.info.store(static_cast<std::uint32_t>(dir) |
+					 static_cast<std::uint32_t>(more) << 1 |
+					 static_cast<std::uint32_t>(code) << 2 |
+					 static_cast<std::uint32_t>(size) << 16, std::memory_order_relaxed);
+		for (std::size_t i = 0; i < used; ++i) {
+			s.text[i].store(words[i], std::memory_order_relaxed);
+		}
+		s.seq.store(seq + 2, std::memory_order_release);
+		head_.store(n + 1, std::memory_order_release);
+	}
+
+	inline std::vector<transcript::entry> transcript::entries() const
+	{
+		std::vector<entry> r;
+		const auto head = head_.load(std::memory_order_acquire);
+		const auto first = head > capacity_ ? head - capacity_ : 0;
+		r.reserve(static_cast<std::size_t>(head - first));
+		std::array<std::uint64_t, max_line / 8> words;
+		for (auto n = first; n != head; ++n) {
+			const auto& s = slots_[n % capacity_];
+			// the write of entry n leaves the slot at this count
+			const auto seq = 2 * (n / capacity_ + 1);
+			if (s.seq.load(std::memory_order_acquire) != seq) {
+				continue;
+			}
+			const auto time = s.time.load(std::memory_order_relaxed);
+			const auto info = s.info.load(std::memory_order_relaxed);
+			const auto size = info >> 16;
+			for (std::size_t i = 0; i < (size + 7) / 8; ++i) {
+				words[i] = s.text[i].load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (s.seq.load(std::memory_order_relaxed) != seq) {
+				continue;
+			}
+			entry e;
+			e.time = clock::time_point{ std::chrono::duration_cast<clock::duration>(std::chrono::microseconds{ time }) };
+			e.dir = static_cast<direction>(info & 1);
+			e.more = (info & 2) != 0;
+			e.code = static_cast<reply_code>((info >> 2) & 0x3fff);
+			e.text.assign(reinterpret_cast<const char*>(words.data()), size);
+			r.push_back(std::move(e));
+		}
+		return r;
+	}
+	inline void transcript::dump(std::ostream& os) const
+	{
+		const auto fill = os.fill('0');
+		for (const auto& e : entries()) {
+			const auto us = std::chrono::duration_cast<std::chrono::microseconds>(e.time.time_since_epoch()).count();
+			const auto s = us / 1000000 % 86400;
+			os << std::setw(2) << s / 3600 << ':' << std::setw(2) << s / 60 % 60 << ':' << std::setw(2) << s % 60
+				<< '.' << std::setw(6) << us % 1000000;
+			if (e.dir == direction::sent) {
+				os << " >> " << e.text << '\n';
+			}
+			else {
+				os << " << " << std::setw(3) << static_cast<unsigned>(e.code) << (e.more ? '-' : ' ') << e.text << '\n';
+			}
+		}
+		os.fill(fill);
+	}
+}
@@ -0,0 +1,820 @@
+#pragma once
+
+#include "../uring_stream.hpp"
+#include <boost/beast/core/bind_handler.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/throw_exception.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace mail::smtp {
+	namespace detail {
+		[[noreturn]] inline void throw_errno()
+		{
+			const boost::beast::error_code ec{ errno, boost::system::system_category() };
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+		}
+
+		inline int uring_enter(int fd, unsigned to_submit, unsigned flags)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, 0, flags, nullptr, 0));
+		}
+
+		template <class Op, class Handler>
+		using uring_op_allocator = typename std::allocator_traits<
+			boost::asio::associated_allocator_t<Handler>>::template rebind_alloc<Op>;
+
+		// Allocates an operation with the allocator of its handler.
+		template <class Op, class Handler, class... Args>
+		Op* make_uring_op(Handler&& handler, Args&&... args)
+		{
+			uring_op_allocator<Op, std::decay_t<Handler>> a{ boost::asio::get_associated_allocator(handler) };
+			using traits = std::allocator_traits<decltype(a)>;
+			const auto p = traits::allocate(a, 1);
+			try {
+				return new (p) Op(std::forward<Handler>(handler), std::forward<Args>(args)...);
+			}
+			catch (...) {
+				traits::deallocate(a, p, 1);
+				throw;
+			}
+		}
+		// Frees op, then invokes its handler.
+		template <class Op, class Handler, class Work, class... Args>
+		void complete_uring_op(Op* op, Handler& handler, Work& work, Args... args)
+		{
+			uring_op_allocator<Op, Handler> a{ boost::asio::get_associated_allocator(handler) };
+			auto h = std::move(handler);
+			auto w = std::move(work);
+			op->~Op();
+			std::allocator_traits<decltype(a)>::deallocate(a, op, 1);
+			boost::asio::dispatch(w.get_executor(), boost::beast::bind_handler(std::move(h), args...));
+		}
+	}
+
+	inline uring_context::uring_context(boost::asio::io_context& ioc,
+										unsigned entries,
+										unsigned buffer_count,
+										std::size_t buffer_size)
+		: ioc_(ioc)
+		, event_(ioc)
+	{
+		io_uring_params p;
+		std::memset(&p, 0, sizeof(p));
+		// multishot receives complete many times per submission
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = entries * 4;
+		fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+		if (fd_ < 0) {
+			detail::throw_errno();
+		}
+
+		sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single_mmap) {
+			sq_ring_size_ = cq_ring_size_ = (std::max)(sq_ring_size_, cq_ring_size_);
+		}
+		sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+		if (sq_ring_ == MAP_FAILED) {
+			sq_ring_ = nullptr;
+			const auto e = errno;
+			release();
+			errno = e;
+			detail::throw_errno();
+		}
+		cq_ring_ = single_mmap ? sq_ring_ :
+			::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+		sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+		const auto sqes = cq_ring_ == MAP_FAILED ? MAP_FAILED :
+			::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) {
+			const auto e = errno;
+			if (cq_ring_ == MAP_FAILED) {
+				cq_ring_ = nullptr;
+			}
+			release();
+			errno = e;
+			detail::throw_errno();
+		}
+		sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+		const auto sq = static_cast<char*>(sq_ring_);
+		sq_head_ = reinterpret_cast<const unsigned*>(sq + p.sq_off.head);
+		sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+		sq_flags_ = reinterpret_cast<const unsigned*>(sq + p.sq_off.flags);
+		sq_mask_ = *reinterpret_cast<const unsigned*>(sq + p.sq_off.ring_mask);
+		sq_entries_ = p.sq_entries;
+		// entry i always sits in slot i
+		const auto array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+		for (unsigned i = 0; i < sq_entries_; ++i) {
+			array[i] = i;
+		}
+		tail_ = *sq_tail_;
+		const auto cq = static_cast<char*>(cq_ring_);
+		cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+		cq_tail_ = reinterpret_cast<const unsigned*>(cq + p.cq_off.tail);
+		cq_mask_ = *reinterpret_cast<const unsigned*>(cq + p.cq_off.ring_mask);
+		cqes_ = reinterpret_cast<const io_uring_cqe*>(cq + p.cq_off.cqes);
+
+		int efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (efd < 0 || ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_EVENTFD, &efd, 1) < 0) {
+			const auto e = errno;
+			if (efd >= 0) {
+				::close(efd);
+			}
+			release();
+			errno = e;
+			detail::throw_errno();
+		}
+		event_.assign(efd);
+
+		if (buffer_count == 0 || buffer_count > 32768 || (buffer_count & (buffer_count - 1)) != 0) {
+			return;
+		}
+		const auto ring = ::mmap(nullptr, buffer_count * sizeof(io_uring_buf),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		const auto buffers = ring == MAP_FAILED ? MAP_FAILED : ::mmap(nullptr, buffer_count * buffer_size,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		io_uring_buf_reg reg;
+		std::memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = reinterpret_cast<std::uintptr_t>(ring);
+		reg.ring_entries = buffer_count;
+		reg.bgid = 0;
+		if (buffers == MAP_FAILED || ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+			// before Linux 5.19
+			if (buffers != MAP_FAILED) {
+				::munmap(buffers, buffer_count * buffer_size);
+			}
+			if (ring != MAP_FAILED) {
+				::munmap(ring, buffer_count * sizeof(io_uring_buf));
+			}
+			return;
+		}
+		buf_ring_ = static_cast<io_uring_buf_ring*>(ring);
+		buffers_ = static_cast<char*>(buffers);
+		buffer_count_ = buffer_count;
+		buffer_size_ = buffer_size;
+		for (unsigned i = 0; i < buffer_count_; ++i) {
+			recycle(i);
+		}
+	}
+	inline uring_context::~uring_context()
+	{
+		release();
+	}
+	inline void uring_context::release()
+	{
+		boost::beast::error_code ignored;
+		event_.close(ignored);
+		if (buf_ring_ != nullptr) {
+			::munmap(buffers_, buffer_count_ * buffer_size_);
+			::munmap(buf_ring_, buffer_count_ * sizeof(io_uring_buf));
+		}
+		if (sqes_ != nullptr) {
+			::munmap(sqes_, sqes_size_);
+		}
+		if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+			::munmap(cq_ring_, cq_ring_size_);
+		}
+		if (sq_ring_ != nullptr) {
+			::munmap(sq_ring_, sq_ring_size_);
+		}
+		if (fd_ >= 0) {
+			::close(fd_);
+		}
+	}
+
+	inline io_uring_sqe* uring_context::get_sqe()
+	{
+		if (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+			submit();
+			if (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+				errno = EBUSY;
+				detail::throw_errno();
+			}
+		}
+		const auto sqe = &sqes_[tail_ & sq_mask_];
+		++tail_;
+		++pending_;
+		std::memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+	inline void uring_context::schedule_submit()
+	{
+		if (submit_scheduled_) {
+			return;
+		}
+		submit_scheduled_ = true;
+		boost::asio::post(ioc_, [this] {
+			submit();
+		});
+	}
+	inline void uring_context::submit()
+	{
+		submit_scheduled_ = false;
+		if (pending_ == 0) {
+			return;
+		}
+		__atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+		while (pending_ != 0) {
+			const auto n = detail::uring_enter(fd_, pending_, 0);
+			++stats_.enters;
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno == EAGAIN || errno == EBUSY) {
+					// the completion queue is full, retried after the next reap
+					schedule_submit();
+					return;
+				}
+				detail::throw_errno();
+			}
+			pending_ -= static_cast<unsigned>(n);
+			stats_.submitted += static_cast<unsigned>(n);
+		}
+	}
+	inline void uring_context::reap()
+	{
+		for (;;) {
+			const auto head = *cq_head_;
+			if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+				if ((__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) == 0) {
+					return;
+				}
+				// completions the kernel kept back for lack of room
+				detail::uring_enter(fd_, 0, IORING_ENTER_GETEVENTS);
+				++stats_.enters;
+				continue;
+			}
+			const auto& cqe = cqes_[head & cq_mask_];
+			const auto data = cqe.user_data;
+			const auto res = cqe.res;
+			const auto flags = cqe.flags;
+			__atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+			++stats_.completed;
+			if (data != 0) {
+				reinterpret_cast<detail::uring_op*>(static_cast<std::uintptr_t>(data))->complete(res, flags);
+			}
+		}
+	}
+	inline void uring_context::started()
+	{
+		++outstanding_;
+		wait();
+	}
+	inline void uring_context::finished()
+	{
+		--outstanding_;
+	}
+	inline void uring_context::wait()
+	{
+		if (waiting_) {
+			return;
+		}
+		waiting_ = true;
+		event_.async_wait(boost::asio::posix::descriptor_base::wait_read, [this](boost::beast::error_code ec) {
+			waiting_ = false;
+			if (ec) {
+				return;
+			}
+			std::uint64_t count;
+			(void)!::read(event_.native_handle(), &count, sizeof(count));
+			++stats_.wakeups;
+			reap();
+			// what the handlers just started
+			submit();
+			if (outstanding_ != 0) {
+				wait();
+			}
+		});
+	}
+	inline void uring_context::recycle(unsigned id)
+	{
+		auto& b = buf_ring_->bufs[buf_tail_ & (buffer_count_ - 1)];
+		b.addr = reinterpret_cast<std::uintptr_t>(buffer(id));
+		b.len = static_cast<std::uint32_t>(buffer_size_);
+		b.bid = static_cast<std::uint16_t>(id);
+		++buf_tail_;
+		__atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+	}
+
+	struct uring_stream::impl final
+		: detail::uring_op
+	{
+		// completion of a cancellation by file descriptor
+		struct canceller final
+			: detail::uring_op
+		{
+			impl& s;
+
+			explicit canceller(impl& i)
+				: s(i)
+			{
+			}
+			void complete(int res, std::uint32_t) override
+			{
+				s.cancelled(res);
+			}
+		};
+
+		// received into a provided buffer and not read yet
+		struct chunk
+		{
+			unsigned id;
+			std::uint32_t offset;
+			std::uint32_t size;
+		};
+
+		uring_context& ctx;
+		boost::asio::ip::tcp::socket socket;
+		std::deque<chunk> received;
+		// end of stream or error, after the received data
+		boost::beast::error_code recv_ec;
+		read_base* reader = nullptr;
+		// submissions with completions to come
+		std::size_t in_flight = 0;
+		// a multishot receive is pending
+		bool armed = false;
+		// the provided buffers ran out
+		bool starved = false;
+		// cancel() was called for the pending read
+		bool aborting = false;
+		bool closed = false;
+		canceller cancel_op{ *this };
+
+		explicit impl(uring_context& c)
+			: ctx(c)
+			, socket(c.context())
+		{
+		}
+
+		// multishot receive
+		void complete(int res, std::uint32_t flags) override;
+
+		template <class MutableBufferSequence>
+		std::size_t take(const MutableBufferSequence& buffers);
+		void read();
+		void serve(boost::beast::error_code ec);
+		void cancel();
+		void cancelled(int res);
+		void cancel_each();
+		void done_one()
+		{
+			if (--in_flight == 0 && closed) {
+				ctx.finished();
+				delete this;
+			}
+		}
+	};
+
+	class uring_stream::read_base
+		: public detail::uring_op {
+	public:
+		explicit read_base(impl& s)
+			: s_(s)
+		{
+		}
+		// single receive into the reader's buffer
+		void complete(int res, std::uint32_t) override
+		{
+			auto& s = s_;
+			s.reader = nullptr;
+			boost::beast::error_code ec;
+			std::size_t n = 0;
+			if (res > 0) {
+				n = static_cast<std::size_t>(res);
+			}
+			else if (res == -ECANCELED || s.closed) {
+				// a closed stream may have been shut down instead
+				ec = boost::asio::error::operation_aborted;
+			}
+			else if (res == 0) {
+				ec = s.recv_ec = boost::asio::error::eof;
+			}
+			else {
+				ec = s.recv_ec = { -res, boost::system::system_category() };
+			}
+			finish(ec, n);
+			s.done_one();
+		}
+		virtual std::size_t take() = 0;
+		virtual boost::asio::mutable_buffer first() const = 0;
+		// Frees the operation and invokes the handler.
+		virtual void finish(boost::beast::error_code ec, std::size_t n) = 0;
+
+		bool receiving = false;
+	protected:
+		~read_base() = default;
+
+		impl& s_;
+	};
+
+	template <class MutableBufferSequence, class Handler>
+	class uring_stream::read_op final
+		: public read_base {
+	public:
+		template <class DeducedHandler>
+		read_op(DeducedHandler&& h, impl& s, const MutableBufferSequence& buffers)
+			: read_base(s)
+			, h_(std::forward<DeducedHandler>(h))
+			, work_(boost::asio::get_associated_executor(h_, s.ctx.get_executor()))
+			, buffers_(buffers)
+		{
+		}
+		std::size_t take() override
+		{
+			return s_.take(buffers_);
+		}
+		boost::asio::mutable_buffer first() const override
+		{
+			for (auto it = boost::asio::buffer_sequence_begin(buffers_);
+				 it != boost::asio::buffer_sequence_end(buffers_); ++it) {
+				const boost::asio::mutable_buffer b = *it;
+				if (b.size() != 0) {
+					return b;
+				}
+			}
+			return {};
+		}
+		void finish(boost::beast::error_code ec, std::size_t n) override
+		{
+			s_.ctx.finished();
+			detail::complete_uring_op(this, h_, work_, ec, n);
+		}
+	private:
+		Handler h_;
+		boost::asio::executor_work_guard<
+			boost::asio::associated_executor_t<Handler, uring_context::executor_type>> work_;
+		MutableBufferSequence buffers_;
+	};
+
+	template <class Handler>
+	class uring_stream::write_op final
+		: public detail::uring_op {
+	public:
+		static std::size_t constexpr max_buffers = 16;
+
+		template <class DeducedHandler, class ConstBufferSequence>
+		write_op(DeducedHandler&& h, impl& s, const ConstBufferSequence& buffers)
+			: s_(s)
+			, h_(std::forward<DeducedHandler>(h))
+			, work_(boost::asio::get_associated_executor(h_, s.ctx.get_executor()))
+		{
+			std::memset(&msg_, 0, sizeof(msg_));
+			std::size_t n = 0;
+			for (auto it = boost::asio::buffer_sequence_begin(buffers);
+				 it != boost::asio::buffer_sequence_end(buffers) && n != max_buffers; ++it) {
+				const boost::asio::const_buffer b = *it;
+				if (b.size() != 0) {
+					iov_[n].iov_base = const_cast<void*>(b.data());
+					iov_[n].iov_len = b.size();
+					++n;
+				}
+			}
+			msg_.msg_iov = iov_;
+			msg_.msg_iovlen = n;
+		}
+		const msghdr* message() const
+		{
+			return &msg_;
+		}
+		void complete(int res, std::uint32_t) override
+		{
+			auto& s = s_;
+			boost::beast::error_code ec;
+			std::size_t n = 0;
+			if (res >= 0) {
+				n = static_cast<std::size_t>(res);
+			}
+			else if (res == -ECANCELED || s.closed) {
+				ec = boost::asio::error::operation_aborted;
+			}
+			else {
+				ec = { -res, boost::system::system_category() };
+			}
+			s.ctx.finished();
+			detail::complete_uring_op(this, h_, work_, ec, n);
+			s.done_one();
+		}
+	private:
+		impl& s_;
+		Handler h_;
+		boost::asio::executor_work_guard<
+			boost::asio::associated_executor_t<Handler, uring_context::executor_type>> work_;
+		msghdr msg_;
+		iovec iov_[max_buffers];
+	};
+
+	inline void uring_stream::impl::complete(int res, std::uint32_t flags)
+	{
+		// this completion holds the stream until it is handled
+		const bool last = (flags & IORING_CQE_F_MORE) == 0;
+		if (last) {
+			armed = false;
+		}
+		boost::beast::error_code ec;
+		if (res > 0 && (flags & IORING_CQE_F_BUFFER) != 0) {
+			const auto id = flags >> IORING_CQE_BUFFER_SHIFT;
+			if (closed) {
+				ctx.recycle(id);
+			}
+			else {
+				received.push_back({ id, 0, static_cast<std::uint32_t>(res) });
+			}
+		}
+		else if (res == -ECANCELED || closed) {
+			ec = boost::asio::error::operation_aborted;
+		}
+		else if (res == 0) {
+			recv_ec = boost::asio::error::eof;
+		}
+		else if (res == -ENOBUFS) {
+			starved = true;
+		}
+		else if (res < 0) {
+			recv_ec = { -res, boost::system::system_category() };
+		}
+		serve(ec);
+		if (reader != nullptr && !armed && !closed) {
+			if (aborting) {
+				// the receive ended before the cancellation reached it
+				serve(boost::asio::error::operation_aborted);
+			}
+			else {
+				read();
+			}
+		}
+		if (last) {
+			done_one();
+		}
+	}
+	template <class MutableBufferSequence>
+	std::size_t uring_stream::impl::take(const MutableBufferSequence& buffers)
+	{
+		std::size_t n = 0;
+		for (auto it = boost::asio::buffer_sequence_begin(buffers);
+			 it != boost::asio::buffer_sequence_end(buffers) && !received.empty(); ++it) {
+			boost::asio::mutable_buffer b = *it;
+			while (b.size() != 0 && !received.empty()) {
+				auto& c = received.front();
+				const auto k = (std::min)(b.size(), std::size_t{ c.size });
+				std::memcpy(b.data(), ctx.buffer(c.id) + c.offset, k);
+				b += k;
+				n += k;
+				c.offset += static_cast<std::uint32_t>(k);
+				c.size -= static_cast<std::uint32_t>(k);
+				if (c.size == 0) {
+					ctx.recycle(c.id);
+					received.pop_front();
+				}
+			}
+		}
+		return n;
+	}
+	inline void uring_stream::impl::read()
+	{
+		const auto sqe = ctx.get_sqe();
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = socket.native_handle();
+		if (ctx.multishot() && !starved) {
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = 0;
+			sqe->user_data = reinterpret_cast<std::uintptr_t>(static_cast<detail::uring_op*>(this));
+			armed = true;
+		}
+		else {
+			const auto b = reader->first();
+			sqe->addr = reinterpret_cast<std::uintptr_t>(b.data());
+			sqe->len = static_cast<std::uint32_t>(b.size());
+			sqe->user_data = reinterpret_cast<std::uintptr_t>(static_cast<detail::uring_op*>(reader));
+			reader->receiving = true;
+			starved = false;
+		}
+		++in_flight;
+		ctx.schedule_submit();
+	}
+	inline void uring_stream::impl::serve(boost::beast::error_code ec)
+	{
+		if (reader == nullptr || reader->receiving) {
+			return;
+		}
+		if (!ec) {
+			if (received.empty() && !recv_ec) {
+				return;
+			}
+			ec = recv_ec;
+		}
+		const auto r = reader;
+		reader = nullptr;
+		const auto n = r->take();
+		r->finish(n != 0 ? boost::beast::error_code{} : ec, n);
+	}
+	inline void uring_stream::impl::cancel()
+	{
+		if (in_flight == 0) {
+			return;
+		}
+		aborting = reader != nullptr;
+		if (!ctx.cancel_fd_) {
+			cancel_each();
+			return;
+		}
+		const auto sqe = ctx.get_sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = socket.native_handle();
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		sqe->user_data = reinterpret_cast<std::uintptr_t>(static_cast<detail::uring_op*>(&cancel_op));
+		++in_flight;
+		ctx.submit();
+	}
+	inline void uring_stream::impl::cancelled(int res)
+	{
+		// ENOENT: nothing left to cancel
+		if (res < 0 && res != -ENOENT) {
+			if (res == -EINVAL) {
+				// before Linux 5.19
+				ctx.cancel_fd_ = false;
+			}
+			cancel_each();
+		}
+		done_one();
+	}
+	inline void uring_stream::impl::cancel_each()
+	{
+		// the receives are known by their user_data, the writes are not
+		const auto cancel_data = [&](detail::uring_op* op) {
+			const auto sqe = ctx.get_sqe();
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = reinterpret_cast<std::uintptr_t>(op);
+			sqe->user_data = 0;
+		};
+		if (armed) {
+			cancel_data(this);
+		}
+		if (reader != nullptr && reader->receiving) {
+			cancel_data(reader);
+		}
+		if (closed) {
+			// the writes fail once the socket is shut down, and nothing
+			// waits for the peer any more
+			boost::beast::error_code ignored;
+			socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+		}
+		ctx.submit();
+	}
+
+	inline uring_stream::uring_stream(uring_context& ctx)
+		: impl_(new impl{ ctx })
+	{
+	}
+	inline uring_stream::~uring_stream()
+	{
+		if (impl_ == nullptr) {
+			return;
+		}
+		auto& s = *impl_;
+		s.closed = true;
+		for (const auto& c : s.received) {
+			s.ctx.recycle(c.id);
+		}
+		s.received.clear();
+		if (s.in_flight == 0) {
+			delete impl_;
+			return;
+		}
+		// freed once the cancelled operations complete, the socket with it
+		s.cancel();
+		s.ctx.started();
+	}
+
+	inline uring_stream::executor_type uring_stream::get_executor() noexcept
+	{
+		return impl_->ctx.get_executor();
+	}
+	inline uring_stream::next_layer_type& uring_stream::next_layer()
+	{
+		return impl_->socket;
+	}
+	inline const uring_stream::next_layer_type& uring_stream::next_layer() const
+	{
+		return impl_->socket;
+	}
+	inline void uring_stream::cancel()
+	{
+		impl_->cancel();
+	}
+
+	template <class MutableBufferSequence>
+	std::size_t uring_stream::read_some(const MutableBufferSequence& buffers)
+	{
+		boost::beast::error_code ec;
+		const auto n = read_some(buffers, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+		return n;
+	}
+	template <class MutableBufferSequence>
+	std::size_t uring_stream::read_some(const MutableBufferSequence& buffers, boost::beast::error_code& ec)
+	{
+		auto& s = *impl_;
+		if (!s.received.empty()) {
+			ec.assign(0, ec.category());
+			return s.take(buffers);
+		}
+		if (s.recv_ec) {
+			ec = s.recv_ec;
+			return 0;
+		}
+		return s.socket.read_some(buffers, ec);
+	}
+	template <class MutableBufferSequence, class ReadHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		ReadHandler, void(boost::beast::error_code, std::size_t)
+	) uring_stream::async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler)
+	{
+		boost::asio::async_completion<
+			ReadHandler,
+			void(boost::beast::error_code, std::size_t)> init{ handler };
+
+		auto& s = *impl_;
+		if (boost::asio::buffer_size(buffers) == 0 || !s.received.empty() || s.recv_ec) {
+			const auto n = s.take(buffers);
+			const auto ec = n == 0 && boost::asio::buffer_size(buffers) != 0 ? s.recv_ec : boost::beast::error_code{};
+			boost::asio::post(get_executor(), boost::beast::bind_handler(std::move(init.completion_handler), ec, n));
+		}
+		else {
+			s.reader = detail::make_uring_op<read_op<MutableBufferSequence,
+				BOOST_ASIO_HANDLER_TYPE(ReadHandler, void(boost::beast::error_code, std::size_t))>>(
+					std::move(init.completion_handler), s, buffers);
+			s.aborting = false;
+			s.ctx.started();
+			if (!s.armed) {
+				s.read();
+			}
+		}
+
+		return init.result.get();
+	}
+
+	template <class ConstBufferSequence>
+	std::size_t uring_stream::write_some(const ConstBufferSequence& buffers)
+	{
+		boost::beast::error_code ec;
+		const auto n = write_some(buffers, ec);
+		if (ec)
+			BOOST_THROW_EXCEPTION(boost::beast::system_error{ ec });
+		return n;
+	}
+	template <class ConstBufferSequence>
+	std::size_t uring_stream::write_some(const ConstBufferSequence& buffers, boost::beast::error_code& ec)
+	{
+		return impl_->socket.write_some(buffers, ec);
+	}
+	template <class ConstBufferSequence, class WriteHandler>
+	BOOST_ASIO_INITFN_RESULT_TYPE(
+		WriteHandler, void(boost::beast::error_code, std::size_t)
+	) uring_stream::async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+	{
+		boost::asio::async_completion<
+			WriteHandler,
+			void(boost::beast::error_code, std::size_t)> init{ handler };
+
+		auto& s = *impl_;
+		if (boost::asio::buffer_size(buffers) == 0) {
+			boost::asio::post(get_executor(), boost::beast::bind_handler(std::move(init.completion_handler),
+																		 boost::beast::error_code{}, 0));
+		}
+		else {
+			const auto op = detail::make_uring_op<write_op<
+				BOOST_ASIO_HANDLER_TYPE(WriteHandler, void(boost::beast::error_code, std::size_t))>>(
+					std::move(init.completion_handler), s, buffers);
+			const auto sqe = s.ctx.get_sqe();
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = s.socket.native_handle();
+			sqe->addr = reinterpret_cast<std::uintptr_t>(op->message());
+			sqe->len = 1;
+			sqe->msg_flags = MSG_NOSIGNAL;
+			sqe->user_data = reinterpret_cast<std::uintptr_t>(static_cast<detail::uring_op*>(op));
+			++s.in_flight;
+			s.ctx.started();
+			s.ctx.schedule_submit();
+		}
+
+		return init.result.get();
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "session.hpp"
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/stream_base.hpp>
+#include <boost/beast/core/error.hpp>
+#include <cstdint>
+
+namespace mail::smtp {
+	// TLS stream that lets OpenSSL do its I/O on the socket itself, so that
+	// it can hand the record layer to the kernel after the handshake (kTLS,
+	// Linux and OpenSSL 3). asio's ssl::stream runs OpenSSL over a memory
+	// BIO pair, which rules that out. With the kernel encrypting, file
+	// content goes from the page cache to the socket with sendfile, see
+	// session::send_file. Without kTLS support it works as a plain TLS
+	// stream.
+	//
+	// Usable as the Stream of a session, including with open_starttls.
+	class ktls_stream
+		: public boost::asio::ssl::stream_base {
+	public:
+		using next_layer_type = boost::asio::ip::tcp::socket;
+		using lowest_layer_type = next_layer_type::lowest_layer_type;
+		using executor_type = next_layer_type::executor_type;
+
+		template <class Arg>
+		ktls_stream(Arg&& arg, boost::asio::ssl::context& ctx);
+		ktls_stream(ktls_stream&& other) noexcept;
+		ktls_stream(const ktls_stream&) = delete;
+		ktls_stream& operator=(const ktls_stream&) = delete;
+		~ktls_stream();
+
+		executor_type get_executor() noexcept
+		{
+			return next_layer_.get_executor();
+		}
+		next_layer_type& next_layer()
+		{
+			return next_layer_;
+		}
+		const next_layer_type& next_layer() const
+		{
+			return next_layer_;
+		}
+		lowest_layer_type& lowest_layer()
+		{
+			return next_layer_.lowest_layer();
+		}
+		const lowest_layer_type& lowest_layer() const
+		{
+			return next_layer_.lowest_layer();
+		}
+		SSL* native_handle()
+		{
+			return ssl_;
+		}
+
+		// Whether the kernel encrypts what is sent, known after the handshake.
+		bool ktls_send() const;
+		bool ktls_recv() const;
+
+		void handshake(handshake_type type);
+		void handshake(handshake_type type, boost::beast::error_code& ec);
+		template <class HandshakeHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			HandshakeHandler, void(boost::beast::error_code)
+		) async_handshake(handshake_type type, HandshakeHandler&& handler);
+
+		void shutdown(boost::beast::error_code& ec);
+		template <class ShutdownHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			ShutdownHandler, void(boost::beast::error_code)
+		) async_shutdown(ShutdownHandler&& handler);
+
+		template <class MutableBufferSequence>
+		std::size_t read_some(const MutableBufferSequence& buffers);
+		template <class MutableBufferSequence>
+		std::size_t read_some(const MutableBufferSequence& buffers, boost::beast::error_code& ec);
+		template <class MutableBufferSequence, class ReadHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			ReadHandler, void(boost::beast::error_code, std::size_t)
+		) async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler);
+
+		template <class ConstBufferSequence>
+		std::size_t write_some(const ConstBufferSequence& buffers);
+		template <class ConstBufferSequence>
+		std::size_t write_some(const ConstBufferSequence& buffers, boost::beast::error_code& ec);
+		template <class ConstBufferSequence, class WriteHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			WriteHandler, void(boost::beast::error_code, std::size_t)
+		) async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler);
+
+		// Sends up to n bytes of file fd from offset without copying them to
+		// user space. Requires ktls_send().
+		std::size_t sendfile(int fd, std::uint64_t offset, std::size_t n, boost::beast::error_code& ec);
+		template <class WriteHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			WriteHandler, void(boost::beast::error_code, std::size_t)
+		) async_sendfile(int fd, std::uint64_t offset, std::size_t n, WriteHandler&& handler);
+	private:
+		template <class, class> class io_op;
+
+		void start(handshake_type type, boost::beast::error_code& ec);
+		// Runs op once. Returns 0 when it is done (ec set on failure), or
+		// the wait_type to wait for before running it again plus one.
+		template <class Operation>
+		int step(Operation& op, std::size_t& bytes, boost::beast::error_code& ec);
+		template <class Operation>
+		std::size_t run(Operation op, boost::beast::error_code& ec);
+		template <class Operation, class Handler>
+		void async_run(Operation&& op, Handler&& handler);
+
+		next_layer_type next_layer_;
+		SSL* ssl_;
+	};
+
+	namespace detail {
+		template <>
+		struct is_ssl_stream<ktls_stream> : std::true_type {};
+	}
+}
+
+#include "impl/ktls_stream.inl"
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "envelope.hpp"
+#include "response.hpp"
+#include "../mime/entity.hpp"
+#include <boost/beast/core/error.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace mail::smtp {
+	template <class Body, class Fields = mime::fields>
+	struct message
+	{
+		using body_type = Body;
+		using fields_type = Fields;
+
+		smtp::envelope envelope;
+		mime::entity<Body, Fields> entity;
+	};
+
+	// Refers to an entity shared by several transactions, which must outlive
+	// the send.
+	template <class Body, class Fields = mime::fields>
+	struct message_ref
+	{
+		using body_type = Body;
+		using fields_type = Fields;
+
+		smtp::envelope envelope;
+		const mime::entity<Body, Fields>* entity = nullptr;
+	};
+
+	// Content of a message stored in a file, already in the form it is sent
+	// in: CRLF line endings and leading dots doubled. fd is a POSIX
+	// descriptor, which must stay open during the send.
+	struct file_region
+	{
+		int fd = -1;
+		std::uint64_t offset = 0;
+		std::uint64_t size = 0;
+	};
+
+	namespace detail {
+		template <class Body, class Fields>
+		const mime::entity<Body, Fields>& entity_of(const mime::entity<Body, Fields>& e)
+		{
+			return e;
+		}
+		template <class Body, class Fields>
+		const mime::entity<Body, Fields>& entity_of(const mime::entity<Body, Fields>* e)
+		{
+			return *e;
+		}
+	}
+
+	// Outcome of one message of a batch.
+	struct send_result
+	{
+		// error::failed when the server refused the message
+		boost::beast::error_code ec;
+		// the reply which accepted or refused the message
+		reply_code code = reply_code::unknown;
+		// the RCPT TO reply of each recipient
+		std::vector<reply_code> recipients;
+	};
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "response.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mail::smtp {
+	// The phases of a delivery that are timed. connect is not seen by the
+	// session, the caller times it and records it itself.
+	enum class phase
+	{
+		connect,
+		banner,
+		ehlo,
+		starttls,
+		auth,
+		mail,
+		rcpt,
+		data,
+		body,
+		final_reply,
+	};
+	std::size_t constexpr phase_count = 10;
+
+	namespace detail {
+		struct atomic_histogram;
+	}
+
+	// Log-linear histogram of durations in nanoseconds, in the manner of
+	// HdrHistogram: 16 buckets per power of two, so any value is known to
+	// within 1/16, up to about 18 minutes.
+	class histogram
+	{
+	public:
+		static unsigned constexpr sub_bucket_bits = 4;
+		static unsigned constexpr max_exponent = 40;
+		static std::size_t constexpr bucket_count =
+			std::size_t{ max_exponent - sub_bucket_bits + 2 } << sub_bucket_bits;
+
+		static std::size_t bucket(std::uint64_t v);
+		// the highest value counted in bucket i
+		static std::uint64_t highest_equivalent(std::size_t i);
+
+		void record(std::uint64_t v, std::uint64_t n = 1);
+		void merge(const histogram& other);
+
+		std::uint64_t count() const
+		{
+			return count_;
+		}
+		std::uint64_t sum() const
+		{
+			return sum_;
+		}
+		std::uint64_t min() const
+		{
+			return count_ == 0 ? 0 : min_;
+		}
+		std::uint64_t max() const
+		{
+			return max_;
+		}
+		double mean() const
+		{
+			return count_ == 0 ? 0 : static_cast<double>(sum_) / static_cast<double>(count_);
+		}
+		// The value that a fraction q (0 to 1) of the recorded values are
+		// at or below, value_at(0.99) for the 99th percentile.
+		std::uint64_t value_at(double q) const;
+	private:
+		friend struct detail::atomic_histogram;
+
+		std::array<std::uint64_t, bucket_count> counts_{};
+		std::uint64_t count_ = 0;
+		std::uint64_t sum_ = 0;
+		std::uint64_t min_ = (std::numeric_limits<std::uint64_t>::max)();
+		std::uint64_t max_ = 0;
+	};
+
+	struct metrics_snapshot
+	{
+		std::array<histogram, phase_count> phases;
+		// by reply code, 0 for replies that had none
+		std::array<std::uint64_t, 600> replies{};
+		std::uint64_t body_bytes = 0;
+
+		const histogram& operator[](phase p) const
+		{
+			return phases[static_cast<std::size_t>(p)];
+		}
+		std::uint64_t replies_of(reply_code code) const
+		{
+			const auto i = static_cast<std::size_t>(code);
+			return i < replies.size() ? replies[i] : 0;
+		}
+	};
+
+	namespace detail {
+		// written by one thread, read by snapshot from any other
+		struct atomic_histogram
+		{
+			std::array<std::atomic<std::uint64_t>, histogram::bucket_count> counts{};
+			std::atomic<std::uint64_t> count{ 0 };
+			std::atomic<std::uint64_t> sum{ 0 };
+			std::atomic<std::uint64_t> min{ (std::numeric_limits<std::uint64_t>::max)() };
+			std::atomic<std::uint64_t> max{ 0 };
+
+			void record(std::uint64_t v);
+			void load(histogram& h) const;
+		};
+	}
+
+	// Collects phase latencies, reply codes and byte counts from any number
+	// of sessions and threads. Every thread records into its own set of
+	// histograms without locking or contended writes; snapshot() merges
+	// them. Sessions report to it when MAIL_SMTP_ENABLE_METRICS is defined
+	// and session::metrics() is set, otherwise the calls compile to nothing.
+	class metrics
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		metrics();
+		metrics(const metrics&) = delete;
+		metrics& operator=(const metrics&) = delete;
+
+		void record(phase p, clock::duration d);
+		void count_reply(reply_code code);
+		void count_body_bytes(std::size_t n);
+
+		// Values recorded while it runs may or may not be included.
+		metrics_snapshot snapshot() const;
+	private:
+		struct local
+		{
+			std::thread::id thread;
+			std::array<detail::atomic_histogram, phase_count> phases;
+			std::array<std::atomic<std::uint64_t>, 600> replies{};
+			std::atomic<std::uint64_t> body_bytes{ 0 };
+		};
+
+		local& get();
+
+		std::uint64_t id_;
+		mutable std::mutex m_;
+		std::vector<std::unique_ptr<local>> locals_;
+	};
+
+	namespace detail {
+		// What the session calls at phase boundaries: start() when a phase
+		// begins, stop() when it ends. An empty type unless metrics are
+		// enabled.
+		class probe
+		{
+		public:
+#if defined(MAIL_SMTP_ENABLE_METRICS)
+			smtp::metrics* get() const
+			{
+				return m_;
+			}
+			void set(smtp::metrics* m)
+			{
+				m_ = m;
+			}
+			void start()
+			{
+				if (m_ != nullptr) {
+					t_ = metrics::clock::now();
+				}
+			}
+			void stop(phase p)
+			{
+				if (m_ != nullptr) {
+					m_->record(p, metrics::clock::now() - t_);
+				}
+			}
+			void stop(phase p, reply_code code)
+			{
+				if (m_ != nullptr) {
+					m_->record(p, metrics::clock::now() - t_);
+					m_->count_reply(code);
+				}
+			}
+			void reply(reply_code code)
+			{
+				if (m_ != nullptr) {
+					m_->count_reply(code);
+				}
+			}
+			void body_bytes(std::size_t n)
+			{
+				if (m_ != nullptr) {
+					m_->count_body_bytes(n);
+				}
+			}
+		private:
+			smtp::metrics* m_ = nullptr;
+			metrics::clock::time_point t_;
+#else
+			void start()
+			{
+			}
+			void stop(phase)
+			{
+			}
+			void stop(phase, reply_code)
+			{
+			}
+			void reply(reply_code)
+			{
+			}
+			void body_bytes(std::size_t)
+			{
+			}
+#endif
+		};
+	}
+}
+
+#include "impl/metrics.inl"
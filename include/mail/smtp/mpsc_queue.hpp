@@ -0,0 +1,88 @@
+#pragma once
+
+#include <boost/optional/optional.hpp>
+#include <atomic>
+#include <utility>
+
+namespace mail::smtp {
+	// Unbounded multi-producer single-consumer queue (D. Vyukov's intrusive
+	// node queue). push is wait-free, a single exchange; pop is lock-free
+	// and may return nothing while a push is halfway through, in which case
+	// that push is visible to the next pop.
+	template <class T>
+	class mpsc_queue
+	{
+	public:
+		mpsc_queue()
+			: head_(&stub_)
+			, tail_(&stub_)
+		{
+		}
+		mpsc_queue(const mpsc_queue&) = delete;
+		mpsc_queue& operator=(const mpsc_queue&) = delete;
+		~mpsc_queue()
+		{
+			while (pop()) {
+			}
+		}
+
+		void push(T value)
+		{
+			push_node(new node{ std::move(value) });
+		}
+
+		// consumer only
+		boost::optional<T> pop()
+		{
+			auto tail = tail_;
+			auto next = tail->next.load(std::memory_order_acquire);
+			if (tail == &stub_) {
+				if (next == nullptr) {
+					return boost::none;
+				}
+				tail_ = tail = next;
+				next = next->next.load(std::memory_order_acquire);
+			}
+			if (next == nullptr) {
+				if (tail != head_.load(std::memory_order_acquire)) {
+					// a producer is between its exchange and its link
+					return boost::none;
+				}
+				stub_.next.store(nullptr, std::memory_order_relaxed);
+				push_node(&stub_);
+				next = tail->next.load(std::memory_order_acquire);
+				if (next == nullptr) {
+					return boost::none;
+				}
+			}
+			tail_ = next;
+			boost::optional<T> v{ std::move(*static_cast<node*>(tail)->value) };
+			delete static_cast<node*>(tail);
+			return v;
+		}
+	private:
+		struct link
+		{
+			std::atomic<link*> next{ nullptr };
+		};
+		struct node : link
+		{
+			explicit node(T&& v)
+				: value(std::move(v))
+			{
+			}
+			boost::optional<T> value;
+		};
+
+		void push_node(link* n)
+		{
+			n->next.store(nullptr, std::memory_order_relaxed);
+			const auto prev = head_.exchange(n, std::memory_order_acq_rel);
+			prev->next.store(n, std::memory_order_release);
+		}
+
+		std::atomic<link*> head_;
+		link* tail_;
+		link stub_;
+	};
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "envelope.hpp"
+#include "message.hpp"
+#include <boost/beast/core/string.hpp>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mail::smtp {
+	// Maximum number of RCPT per transaction of each server, learned from
+	// 452 replies. Shared by the sessions to the same servers.
+	class recipient_limits
+	{
+	public:
+		// RFC 5321 4.5.3.1.8 requires servers to accept at least 100
+		explicit recipient_limits(std::size_t default_limit = 100)
+			: default_(default_limit)
+		{
+		}
+		recipient_limits(const recipient_limits&) = delete;
+		recipient_limits& operator=(const recipient_limits&) = delete;
+
+		std::size_t get(boost::beast::string_view server) const;
+		// lowers the limit of server to n
+		void learn(boost::beast::string_view server, std::size_t n);
+	private:
+		mutable std::mutex m_;
+		std::map<std::string, std::size_t, std::less<>> limits_;
+		std::size_t default_;
+	};
+
+	// Splits a recipient list into transactions. Recipients are deduplicated
+	// case-insensitively and sorted by domain, so each transaction holds as
+	// few domains as possible and the list goes out in the minimum number of
+	// transactions the server's limit allows.
+	//
+	//	planner.add(first, last);
+	//	while (!planner.empty()) {
+	//		planner.plan(host, from, entity, messages);
+	//		session.send_batch(messages.begin(), messages.end(), results);
+	//		planner.update(host, messages, results);
+	//	}
+	class recipient_planner
+	{
+	public:
+		explicit recipient_planner(recipient_limits& limits)
+			: limits_(limits)
+		{
+		}
+
+		bool empty() const
+		{
+			return pending_.empty();
+		}
+		void clear()
+		{
+			pending_.clear();
+		}
+		void add(boost::beast::string_view address)
+		{
+			pending_.emplace_back(address.data(), address.size());
+		}
+		template <class Iterator>
+		void add(Iterator first, Iterator last)
+		{
+			for (; first != last; ++first) {
+				add(*first);
+			}
+		}
+
+		// Moves the pending recipients into envelopes for server.
+		void plan(boost::beast::string_view server,
+				  boost::beast::string_view from,
+				  std::vector<envelope>& out);
+		template <class Body, class Fields>
+		void plan(boost::beast::string_view server,
+				  boost::beast::string_view from,
+				  const mime::entity<Body, Fields>& entity,
+				  std::vector<message_ref<Body, Fields>>& out);
+
+		// Reads the results of the planned transactions. Recipients refused
+		// with 452 after others were accepted hit the server's limit: the
+		// limit is learned and they are added back to be planned again.
+		// Returns the number of recipients added back.
+		template <class Iterator>
+		std::size_t update(boost::beast::string_view server,
+						   Iterator first, Iterator last,
+						   const std::vector<send_result>& results);
+		template <class Message>
+		std::size_t update(boost::beast::string_view server,
+						   const std::vector<Message>& sent,
+						   const std::vector<send_result>& results)
+		{
+			return update(server, sent.begin(), sent.end(), results);
+		}
+	private:
+		void normalize();
+
+		recipient_limits& limits_;
+		std::vector<std::string> pending_;
+	};
+}
+
+#include "impl/recipient_planner.inl"
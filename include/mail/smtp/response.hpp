@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+#include <memory_resource>
 #include <vector>
 #include <string>
 
@@ -45,14 +47,43 @@ namespace mail::smtp {
 		mail_from_or_rcpt_to_param			=	555,
 	};
 
-	class response
+	template <class Allocator>
+	class basic_response
 	{
+		template <class T>
+		using rebind_alloc = typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
 	public:
-		response() = default;
-		response(response&&) = default;
-		response(const response&) = default;
-		response& operator=(response&&) = default;
-		response& operator=(const response&) = default;
+		using allocator_type = Allocator;
+		using string_type = std::basic_string<char, std::char_traits<char>, rebind_alloc<char>>;
+		using lines_type = std::vector<string_type, rebind_alloc<string_type>>;
+
+		basic_response() = default;
+		basic_response(basic_response&&) = default;
+		basic_response(const basic_response&) = default;
+		basic_response& operator=(basic_response&&) = default;
+		basic_response& operator=(const basic_response&) = default;
+
+		explicit basic_response(const Allocator& alloc)
+			: lines_(alloc)
+		{
+		}
+		// A copy of other in the memory of alloc, like the reply of a
+		// session kept in a pmr::response.
+		template <class OtherAllocator>
+		basic_response(const basic_response<OtherAllocator>& other, const Allocator& alloc)
+			: code_(other.code())
+			, lines_(alloc)
+		{
+			lines_.reserve(other.lines().size());
+			for (const auto& line : other.lines()) {
+				lines_.push_back(string_type(line.data(), line.size(), rebind_alloc<char>(alloc)));
+			}
+		}
+
+		allocator_type get_allocator() const
+		{
+			return allocator_type(lines_.get_allocator());
+		}
 
 		reply_code code() const
 		{
@@ -71,15 +102,15 @@ namespace mail::smtp {
 			return static_cast<unsigned>(code_);
 		}
 
-		const std::vector<std::string>& lines() const
+		const lines_type& lines() const
 		{
 			return lines_;
 		}
-		void push_line(const std::string& line)
+		void push_line(const string_type& line)
 		{
 			lines_.push_back(line);
 		}
-		void push_line(std::string&& line)
+		void push_line(string_type&& line)
 		{
 			lines_.push_back(std::move(line));
 		}
@@ -89,6 +120,12 @@ namespace mail::smtp {
 		}
 	private:
 		reply_code code_ = reply_code::completed;
-		std::vector<std::string> lines_;
+		lines_type lines_;
 	};
+
+	using response = basic_response<std::allocator<char>>;
+
+	namespace pmr {
+		using response = basic_response<std::pmr::polymorphic_allocator<char>>;
+	}
 }
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "delivery_status.hpp"
+#include "timer_wheel.hpp"
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+
+namespace mail::smtp {
+	struct retry_policy
+	{
+		// first delay after a temporary failure
+		std::chrono::seconds temporary_delay{ 60 };
+		// first delay after a connection failure
+		std::chrono::seconds connection_delay{ 10 };
+		std::chrono::seconds max_delay{ 4 * 3600 };
+		double multiplier = 2.0;
+		// each delay is shortened by up to this fraction at random, so that
+		// entries deferred together do not come back together
+		double jitter = 0.25;
+		std::size_t max_attempts = 12;
+	};
+
+	// Holds deferred deliveries in a timer wheel and hands them back to
+	// handler on the io_context when their retry is due. Thread safe.
+	// Stop the scheduler and let the io_context finish before destroying it.
+	template <class T>
+	class retry_scheduler
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		explicit retry_scheduler(boost::asio::io_context& ioc,
+								 retry_policy policy = {},
+								 clock::duration tick = std::chrono::seconds{ 1 });
+		retry_scheduler(const retry_scheduler&) = delete;
+		retry_scheduler& operator=(const retry_scheduler&) = delete;
+
+		const retry_policy& policy() const
+		{
+			return policy_;
+		}
+		std::size_t size() const;
+
+		// Delay before attempt + 1 after a failure of the given status.
+		clock::duration backoff(std::size_t attempt, delivery_status status);
+
+		// Schedules another attempt of value, whose attempt-th try failed
+		// with status. Returns false, leaving value alone, when it must not
+		// be retried: delivered, permanent or out of attempts.
+		bool defer(T value, std::size_t attempt, delivery_status status);
+		// Schedules value after delay regardless of the policy.
+		void defer_for(T value, clock::duration delay);
+
+		void start(std::function<void(T)> handler);
+		void stop();
+	private:
+		void arm();
+		void on_tick(boost::beast::error_code ec);
+		std::uint64_t ticks(clock::time_point t) const
+		{
+			return static_cast<std::uint64_t>((t - epoch_) / tick_);
+		}
+
+		mutable std::mutex m_;
+		retry_policy policy_;
+		clock::duration tick_;
+		clock::time_point epoch_;
+		timer_wheel<T> wheel_;
+		std::minstd_rand rng_;
+		boost::asio::steady_timer timer_;
+		std::function<void(T)> handler_;
+		std::vector<T> due_;
+		bool armed_ = false;
+		bool running_ = false;
+	};
+}
+
+#include "impl/retry_scheduler.inl"
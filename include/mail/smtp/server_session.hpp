@@ -0,0 +1,199 @@
+#pragma once
+
+#include "command.hpp"
+#include "command_parser.hpp"
+#include "extensions.hpp"
+#include "response.hpp"
+#include "error.hpp"
+#include <boost/beast/core/type_traits.hpp>
+#include <boost/beast/core/string.hpp>
+#include <boost/beast/core/flat_static_buffer.hpp>
+#include <boost/asio/async_result.hpp>
+#include <cstring>
+#include <string>
+
+namespace mail::smtp {
+	template <class Stream>
+	class server_session {
+	public:
+		using next_layer_type = std::remove_reference_t<Stream>;
+		using executor_type = typename next_layer_type::executor_type;
+		using lowest_layer_type = boost::beast::get_lowest_layer<next_layer_type>;
+
+		server_session(server_session&& other) = default;
+		template <class... Args>
+		explicit server_session(Args&&... args)
+			: s_(std::forward<Args>(args)...)
+		{
+		}
+		~server_session() = default;
+		server_session& operator=(server_session&&) = default;
+
+		executor_type get_executor() noexcept
+		{
+			return s_.get_executor();
+		}
+		next_layer_type& next_layer()
+		{
+			return s_;
+		}
+		const next_layer_type& next_layer() const
+		{
+			return s_;
+		}
+		lowest_layer_type& lowest_layer()
+		{
+			return s_.lowest_layer();
+		}
+		const lowest_layer_type& lowest_layer() const
+		{
+			return s_.lowest_layer();
+		}
+
+		boost::beast::string_view domain() const
+		{
+			return domain_;
+		}
+		void domain(boost::beast::string_view v)
+		{
+			domain_.assign(v.data(), v.size());
+		}
+
+		// advertised in the EHLO reply; SIZE is also enforced by read_data/read_bdat
+		const extensions& capabilities() const
+		{
+			return ext_;
+		}
+		extensions& capabilities()
+		{
+			return ext_;
+		}
+
+		// The last command read. Its views refer to the read buffer and are
+		// invalidated by the next read_command, read_data or read_bdat.
+		const command& get_command() const
+		{
+			return cmd_parser_.get();
+		}
+
+		// >>220 domain ESMTP
+		void open();
+		void open(boost::beast::error_code& ec);
+		template <class OpenHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			OpenHandler, void(boost::beast::error_code)
+		) async_open(OpenHandler&& handler);
+
+		// <<COMMAND argument
+		// Pending replies are flushed before blocking on the stream, so replies
+		// to pipelined commands leave in a single write. A malformed command
+		// completes with error::syntax_error, and a line too long with
+		// error::line_too_long once it has been read up to its LF; either is
+		// skipped by the next read.
+		void read_command();
+		void read_command(boost::beast::error_code& ec);
+		template <class ReadHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			ReadHandler, void(boost::beast::error_code)
+		) async_read_command(ReadHandler&& handler);
+
+		// >>xxx text
+		// The reply is held back while more pipelined commands are buffered.
+		// text must remain valid until the handler is called.
+		void reply(reply_code code, boost::beast::string_view text);
+		void reply(reply_code code, boost::beast::string_view text,
+				   boost::beast::error_code& ec);
+		template <class ReplyHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			ReplyHandler, void(boost::beast::error_code)
+		) async_reply(reply_code code, boost::beast::string_view text,
+					  ReplyHandler&& handler);
+
+		// >>250-domain
+		// >>250-(capabilities)
+		void reply_ehlo();
+		void reply_ehlo(boost::beast::error_code& ec);
+		template <class ReplyHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			ReplyHandler, void(boost::beast::error_code)
+		) async_reply_ehlo(ReplyHandler&& handler);
+
+		// >>354
+		// <<xxx
+		// <<.
+		// The body is dot-unstuffed into a BodyReader without the terminating
+		// line. Past the advertised SIZE the rest is discarded and the
+		// operation completes with error::size_exceeded.
+		template <class BodyReader>
+		void read_data(BodyReader& reader);
+		template <class BodyReader>
+		void read_data(BodyReader& reader, boost::beast::error_code& ec);
+		template <class BodyReader, class ReadHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			ReadHandler, void(boost::beast::error_code)
+		) async_read_data(BodyReader& reader, ReadHandler&& handler);
+
+		// <<(BDAT chunk)
+		// Call after read_command returned BDAT. The reader is initialized by
+		// the first chunk of a message and finished by the LAST one.
+		template <class BodyReader>
+		void read_bdat(BodyReader& reader);
+		template <class BodyReader>
+		void read_bdat(BodyReader& reader, boost::beast::error_code& ec);
+		template <class BodyReader, class ReadHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			ReadHandler, void(boost::beast::error_code)
+		) async_read_bdat(BodyReader& reader, ReadHandler&& handler);
+	private:
+		enum class reply_kind {
+			banner,
+			ehlo,
+			text,
+		};
+
+		void queue_line(reply_code code, bool more,
+						boost::beast::string_view text1,
+						boost::beast::string_view text2,
+						boost::beast::error_code& ec);
+		void queue_reply(reply_kind kind, reply_code code,
+						 boost::beast::string_view text,
+						 boost::beast::error_code& ec);
+		void write_reply(reply_kind kind, reply_code code,
+						 boost::beast::string_view text,
+						 boost::beast::error_code& ec);
+		bool has_pipelined_input() const
+		{
+			const auto b = rd_buf_.data();
+			return b.size() > cmd_size_ &&
+				std::memchr(static_cast<const char*>(b.data()) + cmd_size_,
+							'\n', b.size() - cmd_size_) != nullptr;
+		}
+		void consume_command()
+		{
+			rd_buf_.consume(cmd_size_);
+			cmd_size_ = 0;
+		}
+
+		template <class> class reply_op;
+		template <class> class read_command_op;
+		template <class, class> class read_data_op;
+		template <class, class> class read_bdat_op;
+
+		Stream s_;
+		std::string domain_;
+		extensions ext_;
+
+		static std::size_t constexpr read_buffer_size = 4096;
+		static std::size_t constexpr write_buffer_size = 1024;
+		boost::beast::flat_static_buffer<read_buffer_size> rd_buf_;
+		boost::beast::flat_static_buffer<write_buffer_size> wr_buf_;
+		command_parser cmd_parser_;
+		std::size_t cmd_size_ = 0;
+		std::uint64_t bdat_size_ = 0;
+		bool bdat_started_ = false;
+	};
+}
+
+#include "impl/reply.inl"
+#include "impl/read_command.inl"
+#include "impl/read_data.inl"
@@ -1,16 +1,148 @@
 #pragma once
 
+#include "dot_stuffer.hpp"
+#include "extensions.hpp"
+#include "message.hpp"
+#include "metrics.hpp"
 #include "response.hpp"
 #include "response_parser.hpp"
+#include "transcript.hpp"
 #include "read_response.hpp"
+#include "../mime/content_class.hpp"
 #include "../mime/entity.hpp"
 #include "../mime/serializer.hpp"
 #include <boost/beast/core/type_traits.hpp>
 #include <boost/beast/core/string.hpp>
 #include <boost/beast/core/static_buffer.hpp>
+#include <boost/beast/core/flat_static_buffer.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/asio/executor.hpp>
+#include <boost/asio/associated_allocator.hpp>
 #include <boost/asio/async_result.hpp>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace boost::asio::ssl {
+	template <typename Stream> class stream;
+}
 
 namespace mail::smtp {
+	namespace detail {
+		template <class T>
+		struct is_ssl_stream : std::false_type {};
+		template <class T>
+		struct is_ssl_stream<boost::asio::ssl::stream<T>> : std::true_type {};
+
+		// Operation state kept per message is in the memory of the
+		// handler's associated allocator, see bind_allocator.
+		template <class Handler, class T>
+		using handler_alloc = typename std::allocator_traits<
+			boost::asio::associated_allocator_t<Handler>>::template rebind_alloc<T>;
+		template <class Handler>
+		using handler_string = std::basic_string<char, std::char_traits<char>, handler_alloc<Handler, char>>;
+
+		// how session::send_file_op sends file content
+		enum class file_transfer {
+			// after DATA, as it is
+			wire,
+			// after DATA, doubling the dots which start a line
+			stuffed,
+			// in one BDAT LAST, as it is
+			chunked,
+		};
+
+		// The parameters of MAIL, each with its leading space: SIZE (RFC
+		// 1870), BODY (RFC 6152, RFC 3030) and SMTPUTF8 (RFC 6531)
+		class mail_parameters
+		{
+		public:
+			void size(std::uint64_t n)
+			{
+				append(" SIZE=");
+				size_ = static_cast<std::size_t>(std::to_chars(buf_ + size_, buf_ + sizeof(buf_), n).ptr - buf_);
+			}
+			// "8BITMIME" or "BINARYMIME"
+			void body(boost::beast::string_view type)
+			{
+				append(" BODY=");
+				append(type);
+			}
+			void smtputf8()
+			{
+				append(" SMTPUTF8");
+			}
+			boost::asio::const_buffer buffer() const
+			{
+				return { buf_, size_ };
+			}
+		private:
+			void append(boost::beast::string_view v)
+			{
+				std::memcpy(buf_ + size_, v.data(), v.size());
+				size_ += v.size();
+			}
+
+			char buf_[64];
+			std::size_t size_ = 0;
+		};
+
+		// What MAIL declares of message content, see session::inspect.
+		struct content_info
+		{
+			// unset for content produced while it is sent
+			bool sized = false;
+			std::uint64_t size = 0;
+			mime::content_class header = mime::content_class::seven_bit;
+			mime::content_class body = mime::content_class::seven_bit;
+		};
+
+		// Whether an address needs SMTPUTF8.
+		inline bool is_ascii(boost::beast::string_view v)
+		{
+			return std::all_of(v.begin(), v.end(), [](char c) {
+				return (static_cast<unsigned char>(c) & 0x80) == 0;
+			});
+		}
+
+		// The two parts of message content async_send_mail fills and writes
+		// in turn, see session::encode_ahead.
+		struct encode_pipeline
+		{
+			static std::size_t constexpr max_part = 65536;
+
+			// where parts are prepared, right after each write when empty
+			boost::asio::executor ex;
+			boost::beast::flat_buffer parts[2];
+			// the size of the next part
+			std::size_t next = 0;
+			// the write rate, in bytes per second
+			double rate = 0;
+
+			// Sizes the next part to what the connection takes in about a
+			// millisecond, from a write of n bytes which took t.
+			void measure(std::size_t n, std::chrono::steady_clock::duration t, std::size_t min_part)
+			{
+				const auto seconds = std::chrono::duration<double>(t).count();
+				if (n == 0 || seconds <= 0) {
+					return;
+				}
+				rate = rate == 0 ? n / seconds : (3 * rate + n / seconds) / 4;
+				next = std::clamp(static_cast<std::size_t>((std::min)(rate / 1000, double(max_part))), min_part, max_part);
+			}
+		};
+	}
+
+	// The bytes sr takes after DATA: its output with the dots which start a
+	// line doubled, and the end of data. See mime::serializer::walk.
+	template <class Body, class Fields>
+	std::uint64_t data_size(const mime::serializer<Body, Fields>& sr, boost::beast::error_code& ec);
+
 	template <class Stream>
 	class session {
 	public:
@@ -50,6 +182,84 @@ namespace mail::smtp {
 
 		bool is_open() const;
 
+		// The last reply read from the server.
+		const response& get_response() const
+		{
+			return resp_parser_.get();
+		}
+
+		// Extensions advertised in the last EHLO reply, none after HELO.
+		const extensions& capabilities() const
+		{
+			return ext_;
+		}
+
+		// When set, async_send_mail keeps a read pending on the server while
+		// the message content is written. A reply arriving before the end of
+		// data cancels the remaining writes and the operation completes with
+		// error::premature_reply; the reply is available from get_response()
+		// and the session should be closed. Requires lowest_layer().cancel().
+		bool early_abort() const
+		{
+			return early_abort_;
+		}
+		void early_abort(bool v)
+		{
+			early_abort_ = v;
+		}
+
+		// When set, async_send_mail prepares the next part of the message
+		// content, running the serializer and doubling dots, while the
+		// previous part is written, so that encoding and the network work
+		// at the same time. Parts are sized from the measured write rate,
+		// up to 64 KiB. By default the next part is prepared right after
+		// each write is started; given an executor, a thread pool say, it
+		// is prepared there, and the body writer and transforms must then
+		// not depend on the calling thread. Bodies which wait for content,
+		// like channel_body, are sent as usual.
+		bool encode_ahead() const
+		{
+			return pipe_ != nullptr;
+		}
+		void encode_ahead(bool v)
+		{
+			if (!v) {
+				pipe_.reset();
+			}
+			else if (!pipe_) {
+				pipe_ = std::make_unique<detail::encode_pipeline>();
+			}
+		}
+		void encode_ahead(const boost::asio::executor& ex)
+		{
+			encode_ahead(true);
+			pipe_->ex = ex;
+		}
+
+		// Where the session records the commands it sends and the replies
+		// it reads, nothing when null (the default).
+		smtp::transcript* transcript() const
+		{
+			return transcript_;
+		}
+		void transcript(smtp::transcript* t)
+		{
+			transcript_ = t;
+		}
+
+#if defined(MAIL_SMTP_ENABLE_METRICS)
+		// Where the session records the latency of each phase and the
+		// replies it reads, nothing when null (the default).
+		smtp::metrics* metrics() const
+		{
+			return probe_.get();
+		}
+		void metrics(smtp::metrics* m)
+		{
+			probe_.set(m);
+		}
+#endif
+
 		// <<220
 		// >>HELO/EHLO
 		// <<250
@@ -123,7 +333,17 @@ namespace mail::smtp {
 						   boost::beast::string_view password,
 						   AuthHandler&& handler);
 
-		// >>MAIL FROM:<xxx@xx.com>
+		// When the server advertised SIZE, MAIL declares the size of the
+		// content, computed without serializing it (see
+		// mime::serializer::size), and content over the server's limit
+		// fails with error::size_exceeded before any command is sent.
+		// BODY=8BITMIME and SMTPUTF8 are declared when the server advertised
+		// them and the content or the addresses need them; binary content
+		// goes in a single BDAT, as it is, with BODY=BINARYMIME when the
+		// server advertised it and CHUNKING, and otherwise fails with
+		// error::binary_not_supported before any command is sent, to be
+		// encoded again.
+		// >>MAIL FROM:<xxx@xx.com> SIZE=xxx
 		// <<250
 		// >>RCPT TO:<xxx@xx.com>
 		// <<250
@@ -167,6 +387,11 @@ namespace mail::smtp {
 					   Iterator to_first, Iterator to_last,
 					   const mime::entity<Body, Fields>& entity,
 					   boost::beast::error_code& ec);
+		// A body writer whose get fails with http::error::need_more while
+		// content is still being produced, and which has an
+		// async_wait(void(error_code)) telling when to ask again, is waited
+		// for between chunks; see mime::channel_body. The synchronous
+		// overloads take need_more for an error.
 		template <class Body, class Fields, class SendHandler>
 		BOOST_ASIO_INITFN_RESULT_TYPE(
 			SendHandler, void(boost::beast::error_code)
@@ -195,6 +420,174 @@ namespace mail::smtp {
 						  Iterator to_first, Iterator to_last,
 						  const mime::entity<Body, Fields>& entity,
 						  SendHandler&& handler);
+
+		// Sends to the paths of env. The asynchronous operation takes env
+		// over when it is an rvalue, and otherwise refers to it: it must
+		// outlive the send. Either way nothing is copied per recipient.
+		// When the server advertised DSN, MAIL and RCPT carry the
+		// parameters of env, RET, ENVID, NOTIFY and ORCPT, as far as they
+		// are set.
+		template <class Body, class Fields>
+		void send_mail(const envelope& env,
+					   mime::serializer<Body, Fields>& serializer);
+		template <class Body, class Fields>
+		void send_mail(const envelope& env,
+					   mime::serializer<Body, Fields>& serializer,
+					   boost::beast::error_code& ec);
+		template <class Body, class Fields>
+		void send_mail(const envelope& env,
+					   const mime::entity<Body, Fields>& entity);
+		template <class Body, class Fields>
+		void send_mail(const envelope& env,
+					   const mime::entity<Body, Fields>& entity,
+					   boost::beast::error_code& ec);
+		template <class Body, class Fields, class SendHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			SendHandler, void(boost::beast::error_code)
+		) async_send_mail(const envelope& env,
+						  mime::serializer<Body, Fields>& serializer,
+						  SendHandler&& handler);
+		template <class Body, class Fields, class SendHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			SendHandler, void(boost::beast::error_code)
+		) async_send_mail(envelope&& env,
+						  mime::serializer<Body, Fields>& serializer,
+						  SendHandler&& handler);
+		template <class Body, class Fields, class SendHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			SendHandler, void(boost::beast::error_code)
+		) async_send_mail(const envelope& env,
+						  const mime::entity<Body, Fields>& entity,
+						  SendHandler&& handler);
+		template <class Body, class Fields, class SendHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			SendHandler, void(boost::beast::error_code)
+		) async_send_mail(envelope&& env,
+						  const mime::entity<Body, Fields>& entity,
+						  SendHandler&& handler);
+
+#if !defined(_WIN32)
+		// Sends a message whose content is in a file, see file_region; the
+		// session ends it with CRLF "." CRLF. Over a plain TCP socket (on
+		// Linux), or a ktls_stream which has kernel TLS after the handshake,
+		// the content goes from the page cache to the socket with sendfile;
+		// otherwise it is read into the write buffer one part at a time.
+		// >>MAIL FROM:<xxx@xx.com>
+		// <<250
+		// >>RCPT TO:<xxx@xx.com>
+		// <<250
+		// >>DATA
+		// >>(file)
+		// >>.
+		// <<250
+		void send_file(boost::beast::string_view from,
+					   boost::beast::string_view to,
+					   const file_region& content);
+		void send_file(boost::beast::string_view from,
+					   boost::beast::string_view to,
+					   const file_region& content,
+					   boost::beast::error_code& ec);
+		template <class Iterator>
+		void send_file(boost::beast::string_view from,
+					   Iterator to_first, Iterator to_last,
+					   const file_region& content);
+		template <class Iterator>
+		void send_file(boost::beast::string_view from,
+					   Iterator to_first, Iterator to_last,
+					   const file_region& content,
+					   boost::beast::error_code& ec);
+		template <class SendHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			SendHandler, void(boost::beast::error_code)
+		) async_send_file(boost::beast::string_view from,
+						  boost::beast::string_view to,
+						  const file_region& content,
+						  SendHandler&& handler);
+		template <class Iterator, class SendHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			SendHandler, void(boost::beast::error_code)
+		) async_send_file(boost::beast::string_view from,
+						  Iterator to_first, Iterator to_last,
+						  const file_region& content,
+						  SendHandler&& handler);
+
+		// Relays a message built elsewhere, like an .eml file, whose content
+		// is in a file: CRLF line endings, but no transparency dots. With
+		// CHUNKING it goes as it is in a single BDAT, with sendfile where
+		// send_file would use it; otherwise after DATA, the session doubling
+		// the dots which start a line as it reads the file. To send a file
+		// by path, open it with boost::beast::file and pass
+		// { f.native_handle(), 0, f.size(ec) }.
+		// >>MAIL FROM:<xxx@xx.com>
+		// <<250
+		// >>RCPT TO:<xxx@xx.com>
+		// <<250
+		// >>BDAT (size) LAST
+		// >>(file)
+		// <<250
+		void send_raw(boost::beast::string_view from,
+					  boost::beast::string_view to,
+					  const file_region& content);
+		void send_raw(boost::beast::string_view from,
+					  boost::beast::string_view to,
+					  const file_region& content,
+					  boost::beast::error_code& ec);
+		template <class Iterator>
+		void send_raw(boost::beast::string_view from,
+					  Iterator to_first, Iterator to_last,
+					  const file_region& content);
+		template <class Iterator>
+		void send_raw(boost::beast::string_view from,
+					  Iterator to_first, Iterator to_last,
+					  const file_region& content,
+					  boost::beast::error_code& ec);
+		template <class SendHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			SendHandler, void(boost::beast::error_code)
+		) async_send_raw(boost::beast::string_view from,
+						 boost::beast::string_view to,
+						 const file_region& content,
+						 SendHandler&& handler);
+		template <class Iterator, class SendHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			SendHandler, void(boost::beast::error_code)
+		) async_send_raw(boost::beast::string_view from,
+						 Iterator to_first, Iterator to_last,
+						 const file_region& content,
+						 SendHandler&& handler);
+#endif
+
+		// Sends each message of [first, last), a range of message or message_ref,
+		// in its own transaction. With PIPELINING the commands of a message
+		// are sent in one write together with the end of the previous
+		// message's data. A message is delivered to the recipients that were
+		// accepted; results receive the outcome of every message, and only
+		// stream errors end the batch early. Binary content is not sent, its
+		// message fails with error::binary_not_supported.
+		// >>MAIL FROM:<xxx@xx.com>
+		// >>RCPT TO:<xxx@xx.com>
+		// >>DATA
+		// <<250
+		// <<250
+		// <<354
+		// >>xxx
+		// >>.
+		// >>MAIL FROM:<xxx@xx.com>
+		// ...
+		// <<250
+		template <class Iterator>
+		void send_batch(Iterator first, Iterator last,
+						std::vector<send_result>& results);
+		template <class Iterator>
+		void send_batch(Iterator first, Iterator last,
+						std::vector<send_result>& results,
+						boost::beast::error_code& ec);
+		template <class Iterator, class SendHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			SendHandler, void(boost::beast::error_code)
+		) async_send_batch(Iterator first, Iterator last,
+						   std::vector<send_result>& results,
+						   SendHandler&& handler);
 	private:
 		void read_resp(boost::beast::error_code& ec)
 		{
@@ -208,12 +601,136 @@ namespace mail::smtp {
 			return async_read_response(s_, rd_buf_, resp_parser_, std::forward<Handler>(handler));
 		}
 
+		// Sizes the content of sr without serializing it and finds the class
+		// of its header and body, as far as the body tells it without being
+		// read (see mime::serializer::body_class). Content which cannot be
+		// read ahead is taken for 8bit.
+		template <class Body, class Fields>
+		detail::content_info inspect(const mime::serializer<Body, Fields>& sr, boost::beast::error_code& ec) const;
+		// Whether content goes as it is in a single BDAT: binary content,
+		// to a server which takes it.
+		bool chunked(const detail::content_info& c) const
+		{
+			return c.sized && (std::max)(c.header, c.body) == mime::content_class::binary &&
+				ext_.has(extension::binarymime) && ext_.has(extension::chunking);
+		}
+		// The parameters of MAIL for content c, sent in BDAT when chunked is
+		// set, from addresses which need SMTPUTF8 when utf8 is set, as far
+		// as the server advertised them; error::size_exceeded when c is over
+		// the server's limit and error::binary_not_supported for binary
+		// content not sent in BDAT, so that the message is refused before it
+		// is sent.
+		detail::mail_parameters mail_parameters(const detail::content_info& c, bool chunked, bool utf8,
+												boost::beast::error_code& ec) const;
+		// env, for its DSN parameters, when the server advertised DSN
+		const envelope* dsn(const envelope& env) const
+		{
+			return ext_.has(extension::dsn) ? &env : nullptr;
+		}
+		// send_mail, with the DSN parameters of env when it is not null
+		template <class Iterator, class Body, class Fields>
+		void transfer_mail(boost::beast::string_view from,
+						   Iterator to_first, Iterator to_last,
+						   const envelope* env,
+						   mime::serializer<Body, Fields>& serializer,
+						   boost::beast::error_code& ec);
+
+		template <class ConstBufferSequence>
+		void queue(const ConstBufferSequence& buffers, boost::beast::error_code& ec);
+		template <class ConstBufferSequence>
+		bool try_queue(const ConstBufferSequence& buffers);
+		// Copies serializer output into the write buffer until it is full,
+		// doubling the dots which start a line.
+		// Returns true when the next chunk is too large to copy and should be
+		// written in place behind the buffered bytes.
+		template <class Body, class Fields>
+		bool gather(mime::serializer<Body, Fields>& sr, boost::beast::error_code& ec)
+		{
+			return gather(sr, wr_buf_, wr_buf_.capacity(), true, ec);
+		}
+		// Copies into buffer until it holds limit bytes; chunks are written
+		// in place only when in_place is set.
+		template <class Body, class Fields, class DynamicBuffer>
+		bool gather(mime::serializer<Body, Fields>& sr, DynamicBuffer& buffer,
+					std::size_t limit, bool in_place, boost::beast::error_code& ec);
+		// Fills part with up to n bytes of content, ending it with the end
+		// of data once sr is done.
+		template <class Body, class Fields>
+		void prepare_part(mime::serializer<Body, Fields>& sr, boost::beast::flat_buffer& part,
+						  std::size_t n, boost::beast::error_code& ec);
+		// Consumes n bytes of serializer output written in place.
+		template <class Body, class Fields>
+		void consume_in_place(mime::serializer<Body, Fields>& sr, std::size_t n);
+		void flush(boost::beast::error_code& ec);
+		// Records a command line in the transcript.
+		template <class ConstBufferSequence>
+		void transcribe(const ConstBufferSequence& command);
+		void transcribe_redacted()
+		{
+			if (transcript_ != nullptr) {
+				transcript_->sent("<redacted>");
+			}
+		}
+		// Accounts for the reply just read, ending phase p.
+		void on_reply()
+		{
+			probe_.reply(resp_parser_.get().code());
+			transcribe_reply();
+		}
+		void on_reply(phase p)
+		{
+			probe_.stop(p, resp_parser_.get().code());
+			transcribe_reply();
+		}
+		void transcribe_reply()
+		{
+			if (transcript_ == nullptr) {
+				return;
+			}
+			const auto& r = resp_parser_.get();
+			if (r.lines().empty()) {
+				transcript_->received(r.code(), false, {});
+			}
+			for (std::size_t i = 0; i < r.lines().size(); ++i) {
+				transcript_->received(r.code(), i + 1 != r.lines().size(), r.lines()[i]);
+			}
+		}
+#if !defined(_WIN32)
+		// Whether file content can go to the stream with sendfile.
+		bool sends_file() const;
+		// Reads the part of content from done on that fits in the write
+		// buffer, doubling the dots which start a line when stuff is set.
+		// Returns the bytes of content read.
+		std::size_t read_file(const file_region& content, std::uint64_t done, bool stuff, boost::beast::error_code& ec);
+		// Sends the part of content from done on with sendfile.
+		std::size_t write_file(const file_region& content, std::uint64_t done, boost::beast::error_code& ec);
+		template <class Handler>
+		void async_write_file(const file_region& content, std::uint64_t done, Handler&& handler);
+		template <class Iterator>
+		void transfer_file(boost::beast::string_view from,
+						   Iterator to_first, Iterator to_last,
+						   const file_region& content,
+						   detail::file_transfer how,
+						   boost::beast::error_code& ec);
+#endif
+		void parse_capabilities()
+		{
+			ext_.clear();
+			const auto& lines = resp_parser_.get().lines();
+			for (std::size_t i = 1; i < lines.size(); ++i) {
+				ext_.parse_line(lines[i]);
+			}
+		}
+
 		template <class> class open_op;
 		template <class> class open_starttls_op;
 		template <class> class close_op;
 		template <class> class noop_op;
 		template <class> class auth_login_op;
 		template <class, class, class> class send_mail_op;
+		template <class> class batch;
+		template <class, class> class send_batch_op;
+		template <class> class send_file_op;
 
 
 		//enum class status {
@@ -227,6 +744,16 @@ namespace mail::smtp {
 		static std::size_t constexpr tcp_frame_size = 1536;
 		boost::beast::static_buffer<tcp_frame_size> rd_buf_;
 		response_parser resp_parser_;
+		extensions ext_;
+		// one TLS record worth of data, otherwise a few TCP segments
+		static std::size_t constexpr write_buffer_size =
+			detail::is_ssl_stream<next_layer_type>::value ? 16384 : 4096;
+		boost::beast::flat_static_buffer<write_buffer_size> wr_buf_;
+		detail::dot_stuffer stuffer_;
+		bool early_abort_ = false;
+		std::unique_ptr<detail::encode_pipeline> pipe_;
+		detail::probe probe_;
+		smtp::transcript* transcript_ = nullptr;
 	};
 }
 
@@ -235,3 +762,5 @@ namespace mail::smtp {
 #include "impl/noop.inl"
 #include "impl/auth_login.inl"
 #include "impl/send_mail.inl"
+#include "impl/send_batch.inl"
+#include "impl/send_file.inl"
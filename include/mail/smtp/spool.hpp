@@ -0,0 +1,105 @@
+#pragma once
+
+#include "envelope.hpp"
+#include "../mime/entity.hpp"
+#include "../mime/serializer.hpp"
+#include <boost/beast/core/error.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mail::smtp {
+	enum class spool_state : std::uint8_t
+	{
+		queued								=	0,
+		in_flight							=	1,
+		delivered							=	2,
+		deferred							=	3,
+		failed								=	4,
+	};
+
+	namespace detail {
+		class spool_file;
+	}
+
+	// Durable outbound queue in a single append-only segment file.
+	//
+	// Each message is one record holding its envelope and the serialized
+	// entity; every change of a recipient's state appends a small record
+	// after it. Records are buffered in memory and made durable by commit(),
+	// which writes everything buffered so far with one write and one
+	// fdatasync; concurrent callers of commit() share the same sync (group
+	// commit). open() recovers the queue with a sequential scan, skipping a
+	// record damaged in place and dropping a torn record at the end of the
+	// file; recipients found in flight are queued again.
+	class spool
+	{
+	public:
+		static constexpr std::size_t all_recipients = static_cast<std::size_t>(-1);
+
+		struct entry
+		{
+			std::uint64_t id = 0;
+			smtp::envelope envelope;
+			// position of the serialized entity in the segment file
+			std::uint64_t offset = 0;
+			std::uint64_t size = 0;
+			std::vector<spool_state> states;
+		};
+
+		spool();
+		spool(const spool&) = delete;
+		spool& operator=(const spool&) = delete;
+		~spool();
+
+		bool is_open() const;
+		void open(const char* path, boost::beast::error_code& ec);
+		void close(boost::beast::error_code& ec);
+
+		// Buffers a message with all recipients queued and returns its id.
+		template <class Body, class Fields>
+		std::uint64_t enqueue(const envelope& env,
+							  const mime::entity<Body, Fields>& entity,
+							  boost::beast::error_code& ec);
+		// Buffers a state change of one recipient, or of all_recipients. A
+		// message leaves the queue once every recipient is delivered or
+		// failed.
+		void mark(std::uint64_t id, std::size_t recipient, spool_state state,
+				  boost::beast::error_code& ec);
+		// Returns once everything buffered before the call is on disk, or
+		// bad_file_descriptor when the spool is not open.
+		void commit(boost::beast::error_code& ec);
+
+		bool find(std::uint64_t id, entry& out) const;
+		// ids of the messages with queued or deferred recipients
+		void pending(std::vector<std::uint64_t>& out) const;
+		void read_body(std::uint64_t id, std::string& out, boost::beast::error_code& ec) const;
+	private:
+		void append(std::vector<char>& record, entry&& e);
+		void apply_state(std::uint64_t id, std::uint32_t recipient, spool_state state);
+		void recover(boost::beast::error_code& ec);
+
+		mutable std::mutex m_;
+		mutable std::condition_variable cv_;
+		std::unique_ptr<detail::spool_file> file_;
+		std::unordered_map<std::uint64_t, entry> entries_;
+		std::atomic<std::uint64_t> next_id_{ 1 };
+		// records appended to buf_ but not yet written
+		std::vector<char> buf_;
+		std::uint64_t written_ = 0;		// file size
+		std::uint64_t end_ = 0;			// file size once buf_ is written
+		std::uint64_t appended_ = 0;	// bytes ever appended to buf_
+		std::uint64_t synced_ = 0;		// bytes ever made durable
+		bool syncing_ = false;
+		// close() is waiting for the running sync, commits are refused
+		bool closing_ = false;
+		boost::beast::error_code sync_ec_;
+	};
+}
+
+#include "impl/spool.inl"
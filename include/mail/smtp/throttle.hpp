@@ -0,0 +1,162 @@
+#pragma once
+
+#include "delivery_status.hpp"
+#include "response.hpp"
+#include <boost/beast/core/string.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+
+namespace mail::smtp {
+	// Lock-free token bucket, as a generic cell rate algorithm: the state is
+	// the single time at which the bucket would be full again, updated with
+	// compare and swap.
+	class token_bucket
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		// rate in tokens per second, 0 for no limit
+		explicit token_bucket(double rate = 0, double burst = 1);
+		token_bucket(const token_bucket&) = delete;
+		token_bucket& operator=(const token_bucket&) = delete;
+
+		double rate() const;
+		void rate(double v);
+
+		// Takes n tokens and returns zero, or returns how long to wait until
+		// they are available and takes nothing. More than burst tokens are
+		// taken once the bucket is full, the excess delaying what follows.
+		clock::duration try_acquire(double n = 1, clock::time_point now = clock::now());
+		// The wait try_acquire would return, without taking anything.
+		clock::duration wait(double n = 1, clock::time_point now = clock::now()) const;
+		// Gives back n tokens taken by try_acquire.
+		void release(double n = 1);
+	private:
+		std::atomic<std::int64_t> interval_;	// ns per token
+		std::atomic<std::int64_t> tat_{ 0 };	// ns since epoch
+		double burst_;
+	};
+
+	struct destination_limits
+	{
+		// 0 for no limit
+		unsigned max_connections = 0;
+		double messages_per_second = 0;
+		double recipients_per_second = 0;
+		// tokens that may be taken at once after an idle period
+		double burst = 5;
+	};
+
+	// Limits of one destination, shared by every worker sending to it. The
+	// limits tighten on 421/451 replies and recover slowly with successes
+	// (additive increase, multiplicative decrease), so that sending stays
+	// just under what the receiver accepts.
+	class destination_throttle
+	{
+	public:
+		using clock = token_bucket::clock;
+
+		explicit destination_throttle(const destination_limits& limits);
+
+		// scale of the configured limits in effect, in 1/1000
+		unsigned scale() const
+		{
+			return scale_.load(std::memory_order_relaxed);
+		}
+		unsigned connections() const
+		{
+			return connections_.load(std::memory_order_relaxed);
+		}
+
+		// Takes a connection slot, false when the limit is reached.
+		bool try_connect();
+		void disconnect();
+
+		// Takes the tokens for a message of n recipients and returns zero, or
+		// returns how long to wait.
+		clock::duration try_send(std::size_t recipients, clock::time_point now = clock::now());
+
+		// Feeds back the reply to a command or message.
+		void on_reply(reply_code code);
+	private:
+		void apply(unsigned scale);
+
+		destination_limits limits_;
+		std::atomic<unsigned> connections_{ 0 };
+		std::atomic<unsigned> scale_{ 1000 };
+		token_bucket messages_;
+		token_bucket recipients_;
+	};
+
+	// RAII connection slot of a destination
+	class connection_slot
+	{
+	public:
+		connection_slot() = default;
+		explicit connection_slot(destination_throttle& t)
+			: t_(t.try_connect() ? &t : nullptr)
+		{
+		}
+		connection_slot(connection_slot&& other) noexcept
+			: t_(other.t_)
+		{
+			other.t_ = nullptr;
+		}
+		connection_slot& operator=(connection_slot&& other) noexcept
+		{
+			if (this != &other) {
+				reset();
+				t_ = other.t_;
+				other.t_ = nullptr;
+			}
+			return *this;
+		}
+		~connection_slot()
+		{
+			reset();
+		}
+
+		explicit operator bool() const
+		{
+			return t_ != nullptr;
+		}
+		void reset()
+		{
+			if (t_ != nullptr) {
+				t_->disconnect();
+				t_ = nullptr;
+			}
+		}
+	private:
+		destination_throttle* t_ = nullptr;
+	};
+
+	// Throttles by destination (a domain or MX host), created on first use
+	// with the default limits or those set for it.
+	class throttle
+	{
+	public:
+		explicit throttle(const destination_limits& defaults = {})
+			: defaults_(defaults)
+		{
+		}
+		throttle(const throttle&) = delete;
+		throttle& operator=(const throttle&) = delete;
+
+		// false if the destination is already in use
+		bool set_limits(boost::beast::string_view destination, const destination_limits& limits);
+		// The returned reference stays valid for the life of the throttle.
+		destination_throttle& get(boost::beast::string_view destination);
+	private:
+		std::shared_mutex m_;
+		destination_limits defaults_;
+		std::map<std::string, std::unique_ptr<destination_throttle>, std::less<>> map_;
+	};
+}
+
+#include "impl/throttle.inl"
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <boost/optional/optional.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace mail::smtp {
+	// Hierarchical timing wheel of 4 levels of 256 slots. Insertion and
+	// cancellation are O(1); an entry is moved down at most 3 times before it
+	// expires. Times are in ticks, the caller picks the tick length.
+	// Entries live in one pool and are linked by index, so millions of them
+	// cost no allocation once the pool has grown.
+	template <class T>
+	class timer_wheel
+	{
+	public:
+		using handle = std::uint64_t;
+
+		explicit timer_wheel(std::uint64_t now = 0);
+
+		std::uint64_t now() const
+		{
+			return now_;
+		}
+		std::size_t size() const
+		{
+			return size_;
+		}
+		bool empty() const
+		{
+			return size_ == 0;
+		}
+
+		// An expiry not after now() fires on the next tick.
+		handle insert(std::uint64_t expiry, T value);
+		bool cancel(handle h);
+
+		// Moves to tick now and calls f(T&&) for every entry expired on the
+		// way. f may insert.
+		template <class F>
+		void advance(std::uint64_t now, F&& f);
+	private:
+		static constexpr unsigned bits = 8;
+		static constexpr unsigned slots = 1u << bits;
+		static constexpr unsigned levels = 4;
+		static constexpr std::uint32_t nil = 0xffffffff;
+
+		struct node
+		{
+			boost::optional<T> value;
+			std::uint64_t expiry = 0;
+			std::uint32_t next = nil;
+			std::uint32_t prev = nil;
+			std::uint32_t generation = 0;
+			std::uint16_t slot = 0;
+			bool linked = false;
+		};
+
+		std::uint32_t allocate();
+		void release(std::uint32_t i);
+		void link(std::uint32_t i, bool cascading = false);
+		void unlink(std::uint32_t i);
+		void cascade(unsigned level);
+
+		std::vector<node> nodes_;
+		std::uint32_t free_ = nil;
+		std::array<std::uint32_t, levels * slots> heads_;
+		std::uint64_t now_;
+		std::size_t size_ = 0;
+	};
+}
+
+#include "impl/timer_wheel.inl"
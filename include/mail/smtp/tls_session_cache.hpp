@@ -0,0 +1,80 @@
+#pragma once
+
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/beast/core/string.hpp>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mail::smtp {
+	// Client TLS sessions by destination, so that a new connection to a
+	// server resumes the last session with it (TLS 1.2 session ID or ticket,
+	// TLS 1.3 PSK) instead of doing a full handshake. Works for implicit TLS
+	// and STARTTLS alike: the context hands every new session to the cache,
+	// and prepare() offers the cached one before a handshake.
+	//
+	//	ssl::context ctx{ ssl::context_base::tls };
+	//	tls_session_cache cache{ ctx };
+	//	session<ssl::stream<ip::tcp::socket>> s{ ioc, ctx };
+	//	cache.prepare(s.next_layer(), "mx.example.com");
+	//	// connect, then open_starttls() or handshake and open()
+	class tls_session_cache
+	{
+	public:
+		struct stats_type
+		{
+			std::uint64_t full = 0;
+			std::uint64_t resumed = 0;
+		};
+
+		tls_session_cache() = default;
+		explicit tls_session_cache(boost::asio::ssl::context& ctx)
+		{
+			attach(ctx);
+		}
+		tls_session_cache(const tls_session_cache&) = delete;
+		tls_session_cache& operator=(const tls_session_cache&) = delete;
+		~tls_session_cache();
+
+		// Makes the connections of ctx store their sessions here. This takes
+		// over the new session and info callbacks of ctx.
+		void attach(boost::asio::ssl::context& ctx);
+
+		// Call before the handshake of stream: offers the cached session of
+		// destination, and keeps the session the handshake ends with.
+		template <class Stream>
+		void prepare(boost::asio::ssl::stream<Stream>& stream, boost::beast::string_view destination)
+		{
+			prepare(stream.native_handle(), destination);
+		}
+		void prepare(SSL* ssl, boost::beast::string_view destination);
+
+		// Forgets the session of destination, e.g. after it failed.
+		void erase(boost::beast::string_view destination);
+
+		// Handshakes of the attached contexts, full and resumed.
+		stats_type stats() const
+		{
+			return { full_.load(std::memory_order_relaxed), resumed_.load(std::memory_order_relaxed) };
+		}
+	private:
+		static int context_index();
+		static int destination_index();
+		static int counted_index();
+		static int on_new_session(SSL* ssl, SSL_SESSION* session);
+		static void on_info(const SSL* ssl, int where, int ret);
+
+		mutable std::mutex m_;
+		// nodes are never removed, an SSL refers to its destination's key
+		std::map<std::string, SSL_SESSION*, std::less<>> sessions_;
+		std::vector<SSL_CTX*> contexts_;
+		std::atomic<std::uint64_t> full_{ 0 };
+		std::atomic<std::uint64_t> resumed_{ 0 };
+	};
+}
+
+#include "impl/tls_session_cache.inl"
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "response.hpp"
+#include <boost/beast/core/string.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mail::smtp {
+	// The last command and reply lines of a session, kept in a fixed ring
+	// of fixed size slots. Message content is never recorded, and the
+	// credentials sent after AUTH are recorded as <redacted>. Recording
+	// takes no lock and allocates nothing; the ring can be read at any time
+	// from any thread, for example to log it when a delivery fails.
+	//
+	// A transcript has one writer, the session it is set on.
+	class transcript
+	{
+	public:
+		using clock = std::chrono::system_clock;
+
+		enum class direction : std::uint8_t
+		{
+			sent,
+			received,
+		};
+		struct entry
+		{
+			clock::time_point time;
+			direction dir;
+			// received only
+			reply_code code;
+			bool more;
+			std::string text;
+		};
+
+		// longer lines are cut
+		static std::size_t constexpr max_line = 128;
+
+		explicit transcript(std::size_t capacity = 64);
+		transcript(const transcript&) = delete;
+		transcript& operator=(const transcript&) = delete;
+
+		std::size_t capacity() const
+		{
+			return capacity_;
+		}
+
+		void sent(boost::beast::string_view line);
+		// more: another line of the same reply follows
+		void received(reply_code code, bool more, boost::beast::string_view line);
+
+		// Oldest first. Entries overwritten while reading are left out.
+		std::vector<entry> entries() const;
+		// One line per entry, UTC time of day, ">>" for sent and "<<" for
+		// received lines.
+		void dump(std::ostream& os) const;
+	private:
+		struct slot
+		{
+			// odd while being written, twice the number of writes otherwise
+			std::atomic<std::uint64_t> seq{ 0 };
+			std::atomic<std::int64_t> time{ 0 };
+			// direction | more << 1 | code << 2 | size << 16
+			std::atomic<std::uint32_t> info{ 0 };
+			std::array<std::atomic<std::uint64_t>, max_line / 8> text{};
+		};
+
+		void record(direction dir, reply_code code, bool more, boost::beast::string_view line);
+
+		std::size_t capacity_;
+		std::unique_ptr<slot[]> slots_;
+		std::atomic<std::uint64_t> head_{ 0 };
+	};
+}
+
+#include "impl/transcript.inl"
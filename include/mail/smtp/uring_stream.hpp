@@ -0,0 +1,206 @@
+#pragma once
+
+#if defined(__linux__)
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/beast/core/error.hpp>
+#include <cstdint>
+#include <deque>
+#include <linux/io_uring.h>
+
+namespace mail::smtp {
+	namespace detail {
+		// what the user_data of a submission points to
+		class uring_op {
+		public:
+			virtual void complete(int res, std::uint32_t flags) = 0;
+		protected:
+			~uring_op() = default;
+		};
+	}
+
+	// An io_uring instance for the uring_streams of one io_context, which
+	// must be run by a single thread. Submissions made while handlers run
+	// go to the kernel together, in one io_uring_enter, and completions are
+	// reaped in batches when the ring's eventfd becomes readable. Received
+	// data lands in a ring of buffers registered with the kernel
+	// (provided buffers), which multishot receives pick from.
+	class uring_context
+	{
+	public:
+		using executor_type = boost::asio::io_context::executor_type;
+
+		struct stats_type
+		{
+			// io_uring_enter calls
+			std::uint64_t enters = 0;
+			// times the eventfd woke the io_context
+			std::uint64_t wakeups = 0;
+			std::uint64_t submitted = 0;
+			std::uint64_t completed = 0;
+		};
+
+		// entries: submission queue size; buffer_count (a power of two) and
+		// buffer_size: the receive buffers shared by the streams.
+		explicit uring_context(boost::asio::io_context& ioc,
+							   unsigned entries = 4096,
+							   unsigned buffer_count = 4096,
+							   std::size_t buffer_size = 4096);
+		uring_context(const uring_context&) = delete;
+		uring_context& operator=(const uring_context&) = delete;
+		~uring_context();
+
+		executor_type get_executor() noexcept
+		{
+			return ioc_.get_executor();
+		}
+		boost::asio::io_context& context() noexcept
+		{
+			return ioc_;
+		}
+
+		// Whether receives are multishot on provided buffers (Linux 6.0),
+		// otherwise one receive into the reader's buffer per read.
+		bool multishot() const
+		{
+			return buffers_ != nullptr;
+		}
+
+		const stats_type& stats() const
+		{
+			return stats_;
+		}
+	private:
+		friend class uring_stream;
+
+		void release();
+		// A free submission entry; submits the queue when it is full.
+		io_uring_sqe* get_sqe();
+		// Makes sure the entries are submitted before the io_context waits.
+		void schedule_submit();
+		void submit();
+		void reap();
+		// Accounts for an operation whose completion is awaited: the
+		// io_context waits on the ring while there is one.
+		void started();
+		void finished();
+		void wait();
+
+		const char* buffer(unsigned id) const
+		{
+			return buffers_ + static_cast<std::size_t>(id) * buffer_size_;
+		}
+		void recycle(unsigned id);
+
+		boost::asio::io_context& ioc_;
+		int fd_ = -1;
+		// submission and completion rings
+		void* sq_ring_ = nullptr;
+		std::size_t sq_ring_size_ = 0;
+		void* cq_ring_ = nullptr;
+		std::size_t cq_ring_size_ = 0;
+		io_uring_sqe* sqes_ = nullptr;
+		std::size_t sqes_size_ = 0;
+		unsigned* sq_tail_ = nullptr;
+		const unsigned* sq_head_ = nullptr;
+		const unsigned* sq_flags_ = nullptr;
+		unsigned sq_mask_ = 0;
+		unsigned sq_entries_ = 0;
+		unsigned* cq_head_ = nullptr;
+		const unsigned* cq_tail_ = nullptr;
+		const io_uring_cqe* cqes_ = nullptr;
+		unsigned cq_mask_ = 0;
+		// entries filled and not yet submitted
+		unsigned tail_ = 0;
+		unsigned pending_ = 0;
+		bool submit_scheduled_ = false;
+		// provided buffers
+		io_uring_buf_ring* buf_ring_ = nullptr;
+		char* buffers_ = nullptr;
+		unsigned buffer_count_ = 0;
+		std::size_t buffer_size_ = 0;
+		std::uint16_t buf_tail_ = 0;
+		// completions
+		boost::asio::posix::stream_descriptor event_;
+		std::size_t outstanding_ = 0;
+		bool waiting_ = false;
+		// IORING_ASYNC_CANCEL_FD is supported (Linux 5.19)
+		bool cancel_fd_ = true;
+		stats_type stats_;
+	};
+
+	// A TCP stream whose asynchronous reads and writes go through a
+	// uring_context: a multishot receive stays armed while the stream is
+	// read, and each write is one SENDMSG gathering the whole buffer
+	// sequence. Connecting, options and closing use next_layer(), an
+	// ordinary socket. Synchronous operations go to the socket directly
+	// and should not be mixed with asynchronous reads.
+	//
+	// Usable as the Stream of a session. cancel() stops the pending
+	// operations; lowest_layer().cancel() does not, so early_abort is not
+	// supported.
+	class uring_stream
+	{
+	public:
+		using executor_type = uring_context::executor_type;
+		using next_layer_type = boost::asio::ip::tcp::socket;
+		using lowest_layer_type = next_layer_type::lowest_layer_type;
+
+		explicit uring_stream(uring_context& ctx);
+		uring_stream(uring_stream&& other) noexcept
+			: impl_(other.impl_)
+		{
+			other.impl_ = nullptr;
+		}
+		uring_stream(const uring_stream&) = delete;
+		uring_stream& operator=(const uring_stream&) = delete;
+		// Pending operations complete with operation_aborted.
+		~uring_stream();
+
+		executor_type get_executor() noexcept;
+		next_layer_type& next_layer();
+		const next_layer_type& next_layer() const;
+		lowest_layer_type& lowest_layer()
+		{
+			return next_layer().lowest_layer();
+		}
+		const lowest_layer_type& lowest_layer() const
+		{
+			return next_layer().lowest_layer();
+		}
+
+		// Makes the pending operations complete with operation_aborted.
+		// Before Linux 5.19 only the pending read is cancelled.
+		void cancel();
+
+		template <class MutableBufferSequence>
+		std::size_t read_some(const MutableBufferSequence& buffers);
+		template <class MutableBufferSequence>
+		std::size_t read_some(const MutableBufferSequence& buffers, boost::beast::error_code& ec);
+		template <class MutableBufferSequence, class ReadHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			ReadHandler, void(boost::beast::error_code, std::size_t)
+		) async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler);
+
+		template <class ConstBufferSequence>
+		std::size_t write_some(const ConstBufferSequence& buffers);
+		template <class ConstBufferSequence>
+		std::size_t write_some(const ConstBufferSequence& buffers, boost::beast::error_code& ec);
+		template <class ConstBufferSequence, class WriteHandler>
+		BOOST_ASIO_INITFN_RESULT_TYPE(
+			WriteHandler, void(boost::beast::error_code, std::size_t)
+		) async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler);
+	private:
+		struct impl;
+		class read_base;
+		template <class, class> class read_op;
+		template <class> class write_op;
+
+		impl* impl_;
+	};
+}
+
+#include "impl/uring_stream.inl"
+#endif